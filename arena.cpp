@@ -0,0 +1,82 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace bd {
+
+namespace {
+
+// the first block, enough for the scratch of a small flock
+constexpr std::size_t minBlock{1 << 16};
+
+unsigned char* newBlock(std::size_t size) {
+  return static_cast<unsigned char*>(
+      ::operator new(size, std::align_val_t{Arena::alignment}));
+}
+
+void deleteBlock(unsigned char* data) {
+  ::operator delete(data, std::align_val_t{Arena::alignment});
+}
+
+}  // namespace
+
+Arena::~Arena() {
+  for (auto& block : m_blocks) {
+    deleteBlock(block.data);
+  }
+}
+
+void* Arena::take(std::size_t bytes) {
+  if (m_scopes == 0) {
+    throw std::runtime_error{"Arena buffers are taken within a Scope"};
+  }
+  // rounded up, so the next buffer starts on a cache line too
+  bytes = (bytes + alignment - 1) / alignment * alignment;
+  if (m_top.block < m_blocks.size() &&
+      m_top.used + bytes <= m_blocks[m_top.block].size) {
+    void* buffer = m_blocks[m_top.block].data + m_top.used;
+    m_top.used += bytes;
+    return buffer;
+  }
+  // on to the next block, grown to hold the buffer; at least as large as
+  // all the others, so the blocks stay few
+  std::size_t next = m_blocks.empty() ? 0 : m_top.block + 1;
+  std::size_t size = std::max({bytes, minBlock, capacity()});
+  if (next == m_blocks.size()) {
+    m_blocks.push_back({newBlock(size), size});
+    ++m_grows;
+  } else if (m_blocks[next].size < bytes) {
+    deleteBlock(m_blocks[next].data);
+    m_blocks[next] = {newBlock(size), size};
+    ++m_grows;
+  }
+  m_top = {next, bytes};
+  return m_blocks[next].data;
+}
+
+void Arena::release(const Mark& mark) {
+  m_top = mark;
+  if (--m_scopes > 0 || m_blocks.size() < 2) {
+    return;
+  }
+  // nothing is in use: the blocks become one that holds them all
+  std::size_t size = capacity();
+  for (auto& block : m_blocks) {
+    deleteBlock(block.data);
+  }
+  m_blocks.clear();
+  m_blocks.push_back({newBlock(size), size});
+  ++m_grows;
+  m_top = {};
+}
+
+std::size_t Arena::capacity() const {
+  std::size_t size = 0;
+  for (auto const& block : m_blocks) {
+    size += block.size;
+  }
+  return size;
+}
+
+}  // namespace bd
@@ -0,0 +1,85 @@
+#pragma once
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace bd {
+
+// Scratch memory of a tick: buffers are taken one after the other from large
+// blocks and given back all at once when the Scope they were taken in ends.
+// When the last Scope ends with the buffers spread over several blocks, the
+// blocks are merged into one as large as all of them, so once a tick has run
+// the next ones like it take no memory from the heap at all. Buffers are
+// aligned to a cache line. Not thread safe: buffers are taken before the
+// threads start, each thread then writes its own part.
+class Arena {
+ public:
+  static constexpr std::size_t alignment{64};
+
+ private:
+  struct Block {
+    unsigned char* data{};
+    std::size_t size{};
+  };
+  struct Mark {
+    std::size_t block{};
+    std::size_t used{};
+  };
+
+  std::vector<Block> m_blocks;
+  Mark m_top;
+  int m_scopes{};
+  long m_grows{};
+
+  void* take(std::size_t bytes);
+  void release(const Mark& mark);
+
+ public:
+  // gives back, when it ends, all the buffers taken since it began
+  class Scope {
+    Arena& m_arena;
+    Mark m_mark;
+
+   public:
+    explicit Scope(Arena& arena) : m_arena{arena}, m_mark{arena.m_top} {
+      ++m_arena.m_scopes;
+    }
+    ~Scope() { m_arena.release(m_mark); }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+  };
+
+  Arena() = default;
+  ~Arena();
+  // scratch is not state: a copy starts with no blocks, and assigning
+  // leaves the blocks where they are
+  Arena(const Arena&) : Arena{} {}
+  Arena& operator=(const Arena&) { return *this; }
+
+  // n default-initialized T, which must be trivially destructible, valid
+  // until the innermost Scope ends
+  template <class T>
+  T* allocate(std::size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena buffers are never destroyed");
+    static_assert(alignof(T) <= alignment, "over-aligned type");
+    T* buffer = static_cast<T*>(take(n * sizeof(T)));
+    for (std::size_t i = 0; i < n; ++i) {
+      new (buffer + i) T;
+    }
+    return buffer;
+  }
+
+  // bytes in the blocks, and the times a block was taken from the heap
+  std::size_t capacity() const;
+  long grows() const { return m_grows; }
+};
+
+}  // namespace bd
+
+#endif
@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boid.hpp"
+#include "flock.hpp"
+
+// Benchmarks of the hot paths of the simulation, for uniform and clustered
+// flocks of 100 to 100k boids. Results are printed as a table and, with
+// --json FILE, written in the JSON format of Google Benchmark, so two runs
+// can be compared with its tools/compare.py. Every benchmark also reports
+// ns_per_boid, the time per boid and per tick for the updates.
+
+namespace {
+
+struct Options {
+  double minTime{0.5};  // seconds each benchmark runs for at least
+  int maxN{100000};
+  std::string filter;   // only benchmarks whose name contains it
+  std::string json;     // output file, "-" for stdout
+};
+
+struct Result {
+  std::string name;
+  long iterations{};
+  double realTime{};  // ns per iteration
+  double cpuTime{};   // ns per iteration
+  double nsPerBoid{};
+};
+
+const bd::Parameters par{50.0, 10.0, 0.05, 0.05, 0.05};
+constexpr double maxspeed{500};
+constexpr double delta_t{1. / 60.};
+
+enum class Layout { uniform, clustered };
+
+const char* layoutName(Layout layout) {
+  return layout == Layout::uniform ? "uniform" : "clustered";
+}
+
+// uniform: positions spread over the whole world.
+// clustered: 16 gaussian clusters of 40 pixels, the crowded case for the
+// neighbor search.
+bd::Flock makeFlock(int n, Layout layout) {
+  bd::Flock flock;
+  const bd::World& world = flock.world();
+  std::default_random_engine eng(n);
+  std::uniform_real_distribution<double> xDist(0, world.width);
+  std::uniform_real_distribution<double> yDist(0, world.height);
+  std::uniform_real_distribution<double> vDist(-100, 100);
+  std::normal_distribution<double> spread(0, 40);
+
+  std::vector<bd::Vec2<double>> centers;
+  for (int k = 0; k < 16; ++k) {
+    centers.push_back({xDist(eng), yDist(eng)});
+  }
+
+  for (int i = 0; i < n; ++i) {
+    bd::Vec2<double> position{xDist(eng), yDist(eng)};
+    if (layout == Layout::clustered) {
+      const auto& center = centers[i % centers.size()];
+      position = {std::clamp(center.x + spread(eng), 0., world.width),
+                  std::clamp(center.y + spread(eng), 0., world.height)};
+    }
+    flock.addBoid(bd::Boid(position, {vDist(eng), vDist(eng)}, par, maxspeed));
+  }
+  return flock;
+}
+
+std::vector<bd::Boid> toVector(const bd::Flock& flock) {
+  std::vector<bd::Boid> boids;
+  for (int i = 0; i < flock.size(); ++i) {
+    boids.push_back(flock.getBoid(i));
+  }
+  return boids;
+}
+
+// runs body until minTime has passed, at least once; each run of body
+// counts as one iteration covering the given number of boids
+Result measure(const std::string& name, const Options& options, int boids,
+               const std::function<void()>& body) {
+  using clock = std::chrono::steady_clock;
+  Result result{name};
+  std::clock_t cpuStart = std::clock();
+  auto start = clock::now();
+  double elapsed = 0.;
+  do {
+    body();
+    ++result.iterations;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < options.minTime);
+  double cpu = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+  result.realTime = elapsed * 1e9 / result.iterations;
+  result.cpuTime = cpu * 1e9 / result.iterations;
+  result.nsPerBoid = result.realTime / boids;
+  return result;
+}
+
+std::string escape(const std::string& s) {
+  std::string result;
+  for (char ch : s) {
+    if (ch == '"' || ch == '\\') {
+      result += '\\';
+    }
+    result += ch;
+  }
+  return result;
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results,
+               const char* executable) {
+  std::time_t now = std::time(nullptr);
+  char date[32];
+  std::strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+
+  out << std::setprecision(10) << "{\n"
+      << "  \"context\": {\n"
+      << "    \"date\": \"" << date << "\",\n"
+      << "    \"executable\": \"" << escape(executable) << "\",\n"
+      << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+      << "    \"library_build_type\": \"release\"\n"
+#else
+      << "    \"library_build_type\": \"debug\"\n"
+#endif
+      << "  },\n"
+      << "  \"benchmarks\": [";
+  for (std::size_t k = 0; k < results.size(); ++k) {
+    const Result& r = results[k];
+    out << (k == 0 ? "\n" : ",\n") << "    {\n"
+        << "      \"name\": \"" << escape(r.name) << "\",\n"
+        << "      \"run_name\": \"" << escape(r.name) << "\",\n"
+        << "      \"run_type\": \"iteration\",\n"
+        << "      \"iterations\": " << r.iterations << ",\n"
+        << "      \"real_time\": " << r.realTime << ",\n"
+        << "      \"cpu_time\": " << r.cpuTime << ",\n"
+        << "      \"time_unit\": \"ns\",\n"
+        << "      \"ns_per_boid\": " << r.nsPerBoid << "\n"
+        << "    }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+Options readOptions(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      throw std::runtime_error{"Missing value for option " + arg};
+    }
+    std::string value = argv[++i];
+    if (arg == "--min-time") {
+      options.minTime = std::stod(value);
+    } else if (arg == "--max-n") {
+      options.maxN = std::stoi(value);
+    } else if (arg == "--filter") {
+      options.filter = value;
+    } else if (arg == "--json") {
+      options.json = value;
+    } else {
+      throw std::runtime_error{"Unknown option " + arg};
+    }
+  }
+  return options;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  try {
+    Options options = readOptions(argc, argv);
+    std::vector<Result> results;
+
+    auto bench = [&](const std::string& name, int boids,
+                     const std::function<void()>& body) {
+      if (name.find(options.filter) == std::string::npos) {
+        return;
+      }
+      Result r = measure(name, options, boids, body);
+      std::cout << std::left << std::setw(36) << r.name << std::right
+                << std::setw(14) << std::fixed << std::setprecision(0)
+                << r.realTime << " ns" << std::setw(12) << std::setprecision(1)
+                << r.nsPerBoid << " ns/boid" << std::setw(10) << r.iterations
+                << '\n';
+      results.push_back(r);
+    };
+
+    std::cout << std::left << std::setw(36) << "benchmark" << std::right
+              << std::setw(17) << "time" << std::setw(20) << "per boid"
+              << std::setw(10) << "iters" << '\n';
+
+    for (Layout layout : {Layout::uniform, Layout::clustered}) {
+      for (int n : {100, 1000, 10000, 100000}) {
+        if (n > options.maxN) {
+          continue;
+        }
+        std::string suffix =
+            "/" + std::string{layoutName(layout)} + "/" + std::to_string(n);
+        const bd::Flock start = makeFlock(n, layout);
+
+        // the flock evolves over the iterations, as in a real run
+        bd::Flock flock = start;
+        bench("updateFlock" + suffix, n, [&] { flock.updateFlock(delta_t); });
+        // the same boids in float
+        bd::FlockF flockF;
+        flockF.restore(start.state());
+        bench("updateFlock<float>" + suffix, n,
+              [&] { flockF.updateFlock(delta_t); });
+        // rule sets, against the default one above: separation only needs
+        // the close boids, wander no neighbors at all
+        bd::RuleFlock<bd::Separation> separation;
+        separation.restore(start.state());
+        separation.setCollectStatistics(false);
+        bench("updateFlock<Separation>" + suffix, n,
+              [&] { separation.updateFlock(delta_t); });
+        bd::RuleFlock<bd::Separation, bd::Alignment, bd::Cohesion, bd::Wander>
+            wander;
+        wander.restore(start.state());
+        bench("updateFlock<+Wander>" + suffix, n,
+              [&] { wander.updateFlock(delta_t); });
+        // four species, each one ignoring two of the others: the grid is
+        // split by species, and half of the pairs are not searched
+        bd::Flock species = start;
+        for (int g = 1; g < 4; ++g) {
+          species.addGroup(par, maxspeed);
+        }
+        for (int i = 0; i < n; ++i) {
+          species.setGroup(i, i % 4);
+        }
+        for (int g = 0; g < 4; ++g) {
+          for (int h = 0; h < 4; ++h) {
+            if ((g + h) % 2 == 1) {
+              species.setInteraction(g, h, {0, 0, 0});
+            } else if (g != h) {
+              species.setInteraction(g, h, {0.5, 0.5, 0.5});
+            }
+          }
+        }
+        bench("updateFlock<species>" + suffix, n,
+              [&] { species.updateFlock(delta_t); });
+        // Verlet lists, with a skin of a few steps at the speed of the
+        // boids; in place, a step at maxspeed (8 px) comes off the half skin
+        bd::Flock verlet = start;
+        verlet.setSkin(30);
+        bench("updateFlock<verlet>" + suffix, n,
+              [&] { verlet.updateFlock(delta_t); });
+        bd::Flock verletDouble = start;
+        verletDouble.setUpdateMode(bd::UpdateMode::doubleBuffered);
+        verletDouble.setSkin(30);
+        bench("updateFlock<verlet,double>" + suffix, n,
+              [&] { verletDouble.updateFlock(delta_t); });
+        bd::Flock gridDouble = start;
+        gridDouble.setUpdateMode(bd::UpdateMode::doubleBuffered);
+        bench("updateFlock<double>" + suffix, n,
+              [&] { gridDouble.updateFlock(delta_t); });
+        // the same world with walls, so without the minimum image
+        bd::Flock walls = start;
+        walls.setWorld({start.world().width, start.world().height,
+                        bd::Boundary::reflective});
+        bench("updateFlock<reflective>" + suffix, n,
+              [&] { walls.updateFlock(delta_t); });
+        // the world grown with n, at the density of 1000 boids in the
+        // default one: the cost per boid should stay flat
+        bd::FlockState scaled = start.state();
+        double scale = std::sqrt(n / 1000.);
+        for (int i = 0; i < n; ++i) {
+          scaled.boids.x[i] *= scale;
+          scaled.boids.y[i] *= scale;
+        }
+        scaled.world.width *= scale;
+        scaled.world.height *= scale;
+        bd::Flock dense;
+        dense.restore(scaled);
+        bench("updateFlock<density>" + suffix, n,
+              [&] { dense.updateFlock(delta_t); });
+        // the boids come in random order: sorted along a Z-order curve
+        // every 10 ticks, neighbors in the world are neighbors in memory
+        bd::Flock reordered = start;
+        reordered.setReorderEvery(10);
+        bench("updateFlock<reorder>" + suffix, n,
+              [&] { reordered.updateFlock(delta_t); });
+        bd::Flock denseReordered;
+        denseReordered.restore(scaled);
+        denseReordered.setReorderEvery(10);
+        bench("updateFlock<reorder,density>" + suffix, n,
+              [&] { denseReordered.updateFlock(delta_t); });
+        bench("reorder" + suffix, n, [&] { reordered.reorder(); });
+        // a reach of a third of the world, where the grid visits most of
+        // the flock for every boid and Barnes-Hut adds it a node at a time
+        bd::Flock wide = start;
+        wide.setGroupPar(0, {400, par.ds, par.s, par.a, par.c});
+        bd::Flock wideTree = wide;
+        wideTree.setBarnesHut(true);
+        if (n <= 10000) {
+          bench("updateFlock<wide>" + suffix, n,
+                [&] { wide.updateFlock(delta_t); });
+        }
+        bench("updateFlock<barnes-hut,wide>" + suffix, n,
+              [&] { wideTree.updateFlock(delta_t); });
+        bd::Flock tree = start;
+        tree.setBarnesHut(true);
+        bench("updateFlock<barnes-hut>" + suffix, n,
+              [&] { tree.updateFlock(delta_t); });
+
+        // one call per boid is a tick worth of work, so each iteration
+        // runs the rule for every boid of a sample of at most 1000
+        std::vector<bd::Boid> boids = toVector(start);
+        int sample = std::min(n, 1000);
+        bd::Vec2<double> sink;
+        bench("separation" + suffix, sample, [&] {
+          for (int i = 0; i < sample; ++i) {
+            sink += boids[i].separation(boids);
+          }
+        });
+        bench("alignment" + suffix, sample, [&] {
+          for (int i = 0; i < sample; ++i) {
+            sink += boids[i].alignment(boids);
+          }
+        });
+        bench("cohesion" + suffix, sample, [&] {
+          for (int i = 0; i < sample; ++i) {
+            sink += boids[i].cohesion(boids);
+          }
+        });
+        if (sink.x == 42.) {  // keeps the calls from being optimized away
+          std::cout << '\n';
+        }
+
+        flock = start;
+        bench("average_distance" + suffix, n,
+              [&] { flock.average_distance(); });
+        bench("average_distance_blocked" + suffix, n,
+              [&] { flock.average_distance_blocked(); });
+        bench("average_distance_sampled" + suffix, n,
+              [&] { flock.average_distance_sampled(10000); });
+        bench("average_speed" + suffix, n, [&] { flock.average_speed(); });
+      }
+    }
+
+    if (options.json == "-") {
+      writeJson(std::cout, results, argv[0]);
+    } else if (!options.json.empty()) {
+      std::ofstream out(options.json);
+      if (!out) {
+        throw std::runtime_error{"Cannot write " + options.json};
+      }
+      writeJson(out, results, argv[0]);
+    }
+  } catch (std::exception const& e) {
+    std::cerr << "An exception occurred: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  } catch (...) {
+    std::cerr << "Caught unknown exception\n";
+    return EXIT_FAILURE;
+  }
+}
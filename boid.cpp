@@ -1,239 +1,421 @@
 #include "boid.hpp"
 
-#include <cassert>
+#include <algorithm>
 #include <cmath>
-#include <iostream>
+#include <stdexcept>
 
 namespace bd {
 
-double distance(const sf::Vector2<double>& vec1,
-                const sf::Vector2<double>& vec2) {
-  double dX = vec2.x - vec1.x;
-  double dY = vec2.y - vec1.y;
+template <class T>
+T distance(const Vec2<T>& vec1, const Vec2<T>& vec2) {
+  T dX = vec2.x - vec1.x;
+  T dY = vec2.y - vec1.y;
   return std::sqrt(dX * dX + dY * dY);
 }
 
-double magnitude(const sf::Vector2<double>& vec) {
+template <class T>
+T magnitude(const Vec2<T>& vec) {
   return std::sqrt(vec.x * vec.x + vec.y * vec.y);
 }
 
-double angle(const sf::Vector2<double>& v) { return std::atan2(v.y, v.x); }
-
-Boid::Boid() : position(0, 0) {}
-Boid::Boid(double pos_x, double pos_y) : position(pos_x, pos_y) {}
-
-sf::Vector2<double> Boid::getPosition() const { return position; }
-void Boid::setPosition(const sf::Vector2<double>& newPos) { position = newPos; }
+template <class T>
+T angle(const Vec2<T>& v) {
+  return std::atan2(v.y, v.x);
+}
 
-sf::Vector2<double> Boid::getVelocity() const { return velocity; }
-void Boid::setVelocity(const sf::Vector2<double>& newVel) { velocity = newVel; }
+std::array<Vec2<double>, 3> triangle(const Vec2<double>& position,
+                                     const Vec2<double>& velocity,
+                                     double side) {
+  // the shape is drawn around the y axis, so it is turned by the angle of
+  // velocity minus 90 degrees: the rotation matrix is made of the
+  // components of the unit velocity, with no trigonometric function
+  double speed = magnitude(velocity);
+  Vec2<double> u = speed > 0. ? velocity / speed : Vec2<double>{1., 0.};
+  auto place = [&](double x, double y) {
+    return position + Vec2<double>{x * u.y + y * u.x, y * u.y - x * u.x};
+  };
+  return {place(-side, side), place(side, side), place(0., 5 * side)};
+}
 
-Parameters Boid::getPar() const { return par; }
-void Boid::setPar(const Parameters& newPar) {
-  par = newPar;
-  assert(par.d >= 0.);
-  if (par.d < 0.) {
-    std::cout << "Something went wrong. Parameter d must be positive.\n";
-    exit(EXIT_SUCCESS);
+const char* boundaryName(Boundary boundary) {
+  switch (boundary) {
+    case Boundary::periodic:
+      return "periodic";
+    case Boundary::reflective:
+      return "reflective";
+    case Boundary::open:
+      return "open";
   }
+  return "unknown";
+}
 
-  assert(par.ds >= 0. && par.ds < par.d);
-  if (par.ds < 0. || par.ds >= par.d) {
-    std::cout << "Something went wrong. Parameter ds must be positive and "
-                 "smaller than d.\n";
-    exit(EXIT_SUCCESS);
+Boundary boundaryFromName(const std::string& name) {
+  for (Boundary b :
+       {Boundary::periodic, Boundary::reflective, Boundary::open}) {
+    if (name == boundaryName(b)) {
+      return b;
+    }
   }
+  throw std::runtime_error{"Unknown boundary " + name};
+}
 
-  assert(par.s >= 0. && par.s <= 1.);
-  if (par.s < 0. || par.s > 1.) {
-    std::cout << "Something went wrong. Parameter s must be a number between 0 "
-                 "and 1.\n";
-    exit(EXIT_SUCCESS);
+namespace {
+// one check per parameter, shared by checkParameters() and the setters
+void checkD(const Parameters& par) {
+  if (!(par.d >= 0.)) {
+    throw std::runtime_error{"Parameter d must be positive"};
   }
-
-  assert(par.a >= 0. && par.a <= 1.);
-  if (par.a < 0. || par.a > 1.) {
-    std::cout << "Something went wrong. Parameter a must be a number between 0 "
-                 "and 1.\n";
-    exit(EXIT_SUCCESS);
+}
+void checkDs(const Parameters& par) {
+  if (!(par.ds >= 0. && par.ds < par.d)) {
+    throw std::runtime_error{
+        "Parameter ds must be positive and smaller than d"};
   }
-
-  assert(par.c >= 0. && par.c <= 1.);
-  if (par.c < 0. || par.c > 1.) {
-    std::cout << "Something went wrong. Parameter c must be a number between 0 "
-                 "and 1.\n";
-    exit(EXIT_SUCCESS);
+}
+void checkUnit(double p, const char* message) {
+  if (!(p >= 0. && p <= 1.)) {
+    throw std::runtime_error{message};
   }
 }
+void checkS(const Parameters& par) {
+  checkUnit(par.s, "Parameter s must be a number between 0 and 1");
+}
+void checkA(const Parameters& par) {
+  checkUnit(par.a, "Parameter a must be a number between 0 and 1");
+}
+void checkC(const Parameters& par) {
+  checkUnit(par.c, "Parameter c must be a number between 0 and 1");
+}
 
-void Boid::setPar_d(const double new_d) {
-  par.d = new_d;
-  assert(par.d >= 0.);
-  if (par.d < 0.) {
-    std::cout << "Something went wrong. Parameter d must be positive.\n";
-    exit(EXIT_SUCCESS);
-  }
+// par with its field changed by set, if check accepts it
+template <class Set, class Check>
+void setChecked(Parameters& par, Set set, Check check) {
+  Parameters changed = par;
+  set(changed);
+  check(changed);
+  par = changed;
+}
+}  // namespace
+
+void checkParameters(const Parameters& par) {
+  checkD(par);
+  checkDs(par);
+  checkS(par);
+  checkA(par);
+  checkC(par);
 }
 
-void Boid::setPar_ds(const double new_ds) {
-  par.ds = new_ds;
-  assert(par.ds >= 0. && par.ds < par.d);
-  if (par.ds < 0. || par.ds >= par.d) {
-    std::cout << "Something went wrong. Parameter ds must be positive and "
-                 "smaller than d.\n";
-    exit(EXIT_SUCCESS);
+void checkMaxspeed(double maxspeed) {
+  if (!(maxspeed >= 0.)) {
+    throw std::runtime_error{"Maxspeed must be positive"};
   }
 }
 
-void Boid::setPar_s(const double new_s) {
-  par.s = new_s;
-  assert(par.s >= 0. && par.s <= 1.);
-  if (par.s < 0. || par.s > 1.) {
-    std::cout << "Something went wrong. Parameter s must be a number between 0 "
-                 "and 1.\n";
-    exit(EXIT_SUCCESS);
-  }
+template <class T>
+BasicBoid<T>::BasicBoid() : position(0, 0) {}
+template <class T>
+BasicBoid<T>::BasicBoid(T pos_x, T pos_y) : position(pos_x, pos_y) {}
+template <class T>
+BasicBoid<T>::BasicBoid(const Vec2<T>& pos, const Vec2<T>& vel,
+                        const Parameters& newPar, T newMaxspeed)
+    : position(pos), velocity(vel), par(newPar), maxspeed(newMaxspeed) {}
+
+template <class T>
+Vec2<T> BasicBoid<T>::getPosition() const {
+  return position;
+}
+template <class T>
+void BasicBoid<T>::setPosition(const Vec2<T>& newPos) {
+  position = newPos;
 }
 
-void Boid::setPar_a(const double new_a) {
-  par.a = new_a;
-  assert(par.a >= 0. && par.a <= 1.);
-  if (par.a < 0. || par.a > 1.) {
-    std::cout << "Something went wrong. Parameter a must be a number between 0 "
-                 "and 1.\n";
-    exit(EXIT_SUCCESS);
-  }
+template <class T>
+Vec2<T> BasicBoid<T>::getVelocity() const {
+  return velocity;
+}
+template <class T>
+void BasicBoid<T>::setVelocity(const Vec2<T>& newVel) {
+  velocity = newVel;
 }
 
-void Boid::setPar_c(const double new_c) {
-  par.c = new_c;
-  assert(par.c >= 0. && par.c <= 1.);
-  if (par.c < 0. || par.c > 1.) {
-    std::cout << "Something went wrong. Parameter c must be a number between 0 "
-                 "and 1.\n";
-    exit(EXIT_SUCCESS);
-  }
+template <class T>
+Parameters BasicBoid<T>::getPar() const {
+  return par;
+}
+template <class T>
+void BasicBoid<T>::setPar(const Parameters& newPar) {
+  checkParameters(newPar);
+  par = newPar;
+}
+
+template <class T>
+void BasicBoid<T>::setPar_d(const double new_d) {
+  setChecked(par, [=](Parameters& p) { p.d = new_d; }, checkD);
 }
 
-double Boid::getMaxspeed() const { return maxspeed; }
-void Boid::setMaxspeed(double new_Maxspeed) { maxspeed = new_Maxspeed; }
+template <class T>
+void BasicBoid<T>::setPar_ds(const double new_ds) {
+  setChecked(par, [=](Parameters& p) { p.ds = new_ds; }, checkDs);
+}
 
-sf::Vector2<double> Boid::separation(const std::vector<Boid>& boids) {
-  double ds = par.ds;
-  double s = par.s;
+template <class T>
+void BasicBoid<T>::setPar_s(const double new_s) {
+  setChecked(par, [=](Parameters& p) { p.s = new_s; }, checkS);
+}
+
+template <class T>
+void BasicBoid<T>::setPar_a(const double new_a) {
+  setChecked(par, [=](Parameters& p) { p.a = new_a; }, checkA);
+}
+
+template <class T>
+void BasicBoid<T>::setPar_c(const double new_c) {
+  setChecked(par, [=](Parameters& p) { p.c = new_c; }, checkC);
+}
+
+template <class T>
+T BasicBoid<T>::getMaxspeed() const {
+  return maxspeed;
+}
+template <class T>
+void BasicBoid<T>::setMaxspeed(T new_Maxspeed) {
+  checkMaxspeed(new_Maxspeed);
+  maxspeed = new_Maxspeed;
+}
+
+template <class T>
+Vec2<T> BasicBoid<T>::separation(const std::vector<BasicBoid>& boids) {
+  T ds = par.ds;
+  T s = par.s;
   int N = boids.size();
 
   if (N < 2) {
     throw std::runtime_error{"Not enough boids"};
   }
 
-  sf::Vector2<double> Displacements(0, 0);
+  Vec2<T> Displacements(0, 0);
 
   for (auto const& boid : boids) {
-    const sf::Vector2<double>& otherPosition = boid.position;
-    double distance1 = distance(position, otherPosition);
+    const Vec2<T>& otherPosition = boid.position;
+    T distance1 = distance(position, otherPosition);
     if (distance1 < ds) {
-      sf::Vector2<double> displacement = otherPosition - position;
+      Vec2<T> displacement = otherPosition - position;
       Displacements = Displacements + displacement;
     }
   }
-  sf::Vector2<double> v1 = -s * Displacements;
+  Vec2<T> v1 = -s * Displacements;
   return v1;
 }
 
-sf::Vector2<double> Boid::alignment(const std::vector<Boid>& boids) {
-  double a = par.a;
-  double d = par.d;
+template <class T>
+Vec2<T> BasicBoid<T>::alignment(const std::vector<BasicBoid>& boids) {
+  T a = par.a;
+  T d = par.d;
   int N = boids.size();
 
   if (N < 2) {
     throw std::runtime_error{"Not enough boids"};
   }
 
-  sf::Vector2<double> Velocities(0, 0);
+  Vec2<T> Velocities(0, 0);
 
   for (auto const& boid : boids) {
-    double distance1 = distance(position, boid.position);
+    T distance1 = distance(position, boid.position);
     if (distance1 < d) {
-      sf::Vector2<double> speed = boid.velocity - velocity;
+      Vec2<T> speed = boid.velocity - velocity;
       Velocities = Velocities + speed;
     }
   }
 
-  sf::Vector2<double> v2 = a * (1.0 / (N - 1)) * Velocities;
+  Vec2<T> v2 = a * (T{1} / (N - 1)) * Velocities;
   return v2;
 }
 
-sf::Vector2<double> Boid::cohesion(const std::vector<Boid>& boids) {
-  double c = par.c;
-  double d = par.d;
+template <class T>
+Vec2<T> BasicBoid<T>::cohesion(const std::vector<BasicBoid>& boids) {
+  T c = par.c;
+  T d = par.d;
   int N = boids.size();
 
   if (N < 2) {
     throw std::runtime_error{"Not enough boids"};
   }
 
-  sf::Vector2<double> sum_pos(0, 0);
-  sf::Vector2<double> v3(0, 0);
+  Vec2<T> sum_pos(0, 0);
+  Vec2<T> v3(0, 0);
 
   for (auto const& boid : boids) {
-    double distance1 = distance(position, boid.position);
+    T distance1 = distance(position, boid.position);
     if (distance1 < d) {
-      sf::Vector2<double> otherPosition = boid.position;
+      Vec2<T> otherPosition = boid.position;
       sum_pos = sum_pos + otherPosition;
     }
   }
   sum_pos = sum_pos - position;
-  sf::Vector2<double> xc = (1.0 / (N - 1)) * sum_pos;
+  Vec2<T> xc = (T{1} / (N - 1)) * sum_pos;
   if (xc.x != 0 && xc.y != 0) {
-    sf::Vector2<double> v3 = c * (xc - position);
+    Vec2<T> v3 = c * (xc - position);
     return v3;
   } else {
     return v3;
   }
 }
 
-void Boid::updateVelocity(const std::vector<Boid>& boids) {
-  sf::Vector2<double> v1 = separation(boids);
-  sf::Vector2<double> v2 = alignment(boids);
-  sf::Vector2<double> v3 = cohesion(boids);
+namespace {
+template <class T>
+inline void accumulate(BasicSteeringSums<T>& sums, const Vec2<T>& position,
+                       const Vec2<T>& velocity, const Vec2<T>& otherPosition,
+                       const Vec2<T>& otherVelocity, T ds2, T d2) {
+  Vec2<T> displacement = otherPosition - position;
+  T distance2 =
+      displacement.x * displacement.x + displacement.y * displacement.y;
+  if (distance2 < ds2) {
+    sums.displacements = sums.displacements + displacement;
+  }
+  if (distance2 < d2) {
+    sums.velocities = sums.velocities + (otherVelocity - velocity);
+    sums.positions = sums.positions + otherPosition;
+    ++sums.neighbors;
+  }
+}
+}  // namespace
+
+template <class T>
+BasicSteeringSums<T> BasicBoid<T>::steeringSums(
+    const std::vector<BasicBoid>& boids) const {
+  BasicSteeringSums<T> sums;
+  // squared in double like the kernels of simd.cpp, then rounded to T
+  T ds2 = par.ds * par.ds;
+  T d2 = par.d * par.d;
+  for (auto const& boid : boids) {
+    accumulate(sums, position, velocity, boid.position, boid.velocity, ds2,
+               d2);
+  }
+  return sums;
+}
+
+template <class T>
+Vec2<T> BasicBoid<T>::steering(const BasicSteeringSums<T>& sums,
+                               int N) const {
+  if (N < 2) {
+    throw std::runtime_error{"Not enough boids"};
+  }
+
+  // same expressions as separation, alignment and cohesion
+  Vec2<T> v1 = -T(par.s) * sums.displacements;
+  Vec2<T> v2 = T(par.a) * (T{1} / (N - 1)) * sums.velocities;
+  Vec2<T> v3(0, 0);
+  Vec2<T> xc = (T{1} / (N - 1)) * (sums.positions - position);
+  if (xc.x != 0 && xc.y != 0) {
+    v3 = T(par.c) * (xc - position);
+  }
+  return v1 + v2 + v3;
+}
+
+template <class T>
+void BasicBoid<T>::updateVelocity(const std::vector<BasicBoid>& boids) {
+  updateVelocity(steeringSums(boids), boids.size());
+}
 
-  velocity = velocity + v1 + v2 + v3;
+template <class T>
+void BasicBoid<T>::updateVelocity(const BasicSteeringSums<T>& sums, int N) {
+  updateVelocity(steering(sums, N));
+}
 
-  double mag_v = magnitude(velocity);
+template <class T>
+void BasicBoid<T>::updateVelocity(const Vec2<T>& steering) {
+  velocity = velocity + steering;
+
+  T mag_v = magnitude(velocity);
 
   if (mag_v > maxspeed) {
     velocity.x = (velocity.x / mag_v) * maxspeed;  // da vedere
     velocity.y = (velocity.y / mag_v) * maxspeed;
   };
 }
-void Boid::updatePosition(double const delta_t) {
-  position = position + velocity * delta_t;
+
+template <class T>
+void BasicBoid<T>::updatePosition(double const delta_t) {
+  position = position + velocity * T(delta_t);
 }
 
-void Boid::borders() {
-  double screenWidth{1280};
-  double screenHeight{720};
-  // passati per copy perchè altrimenti warning: "narrowing conversion from
-  // unsigned int to double"
+template <class T>
+void BasicBoid<T>::borders() {
+  borders(World{});
+}
 
-  if (position.x < 0.) {
-    position.x = screenWidth;
-  } else if (position.x > screenWidth) {
-    position.x = 0;
-  }
-  if (position.y < 0.) {
-    position.y =
-        screenHeight;  // lo schermo va al contrario quindi bordo superiore
-  } else if (position.y > screenHeight) {
-    position.y = 0;
+template <class T>
+void BasicBoid<T>::borders(const World& world) {
+  T screenWidth = world.width;
+  T screenHeight = world.height;
+
+  switch (world.boundary) {
+    case Boundary::periodic:
+      if (position.x < 0.) {
+        position.x = screenWidth;
+      } else if (position.x > screenWidth) {
+        position.x = 0;
+      }
+      if (position.y < 0.) {
+        position.y =
+            screenHeight;  // lo schermo va al contrario quindi bordo superiore
+      } else if (position.y > screenHeight) {
+        position.y = 0;
+      }
+      return;
+    case Boundary::reflective:
+      // mirrored at the edge, the excess folded back in
+      if (position.x < 0.) {
+        position.x = std::min(-position.x, screenWidth);
+        velocity.x = -velocity.x;
+      } else if (position.x > screenWidth) {
+        position.x = std::max(2 * screenWidth - position.x, T{});
+        velocity.x = -velocity.x;
+      }
+      if (position.y < 0.) {
+        position.y = std::min(-position.y, screenHeight);
+        velocity.y = -velocity.y;
+      } else if (position.y > screenHeight) {
+        position.y = std::max(2 * screenHeight - position.y, T{});
+        velocity.y = -velocity.y;
+      }
+      return;
+    case Boundary::open: {
+      // turned back towards the world, harder nowhere than turn * maxspeed
+      // per tick; the next updateVelocity() bounds the speed again
+      T push = static_cast<T>(world.turn) * maxspeed;
+      T margin = world.margin;
+      if (position.x < margin) {
+        velocity.x += push;
+      } else if (position.x > screenWidth - margin) {
+        velocity.x -= push;
+      }
+      if (position.y < margin) {
+        velocity.y += push;
+      } else if (position.y > screenHeight - margin) {
+        velocity.y -= push;
+      }
+      return;
+    }
   }
 }
 
-void Boid::update(const std::vector<Boid>& boids, double const delta_t) {
+template <class T>
+void BasicBoid<T>::update(const std::vector<BasicBoid>& boids,
+                          double const delta_t) {
   updateVelocity(boids);
   updatePosition(delta_t);
   borders();
 }
 
-}  // namespace bd
\ No newline at end of file
+template double distance(const Vec2<double>&, const Vec2<double>&);
+template float distance(const Vec2<float>&, const Vec2<float>&);
+template double magnitude(const Vec2<double>&);
+template float magnitude(const Vec2<float>&);
+template double angle(const Vec2<double>&);
+template float angle(const Vec2<float>&);
+
+template class BasicBoid<double>;
+template class BasicBoid<float>;
+
+}  // namespace bd
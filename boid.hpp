@@ -2,18 +2,35 @@
 #ifndef BOID_HPP
 #define BOID_HPP
 
-#include <SFML/System/Vector2.hpp>
-#include "SFML/Window/VideoMode.hpp"
+#include <array>
+#include <string>
 #include <vector>
 
+#include "vec2.hpp"
+
 namespace bd {
 
-double distance(const sf::Vector2<double>& vec1,
-                const sf::Vector2<double>& vec2);
+// The core is written for any floating point scalar T and compiled for
+// double, the default everywhere, and float: see the explicit
+// instantiations at the bottom of boid.cpp, flock.cpp and grid.cpp. Boids in
+// float take half the memory and twice the SIMD lanes in the neighbor loop,
+// at the price of about 7 significant digits instead of 16.
+
+template <class T>
+T distance(const Vec2<T>& vec1, const Vec2<T>& vec2);
+
+template <class T>
+T magnitude(const Vec2<T>& vec);
 
-double magnitude(const sf::Vector2<double>& vec);
+template <class T>
+T angle(const Vec2<T>& v);
 
-double angle(const sf::Vector2<double>& v);
+// corners of the triangle a boid is drawn as, 2 * side wide and 5 * side
+// long from the base, with the tip pointing along velocity (to the right
+// when velocity is zero)
+std::array<Vec2<double>, 3> triangle(const Vec2<double>& position,
+                                     const Vec2<double>& velocity,
+                                     double side);
 
 struct Parameters {
   double d{};
@@ -23,23 +40,141 @@ struct Parameters {
   double c{};
 };
 
-class Boid {
-  sf::Vector2<double> position;
-  sf::Vector2<double> velocity;
+// what happens to a boid at the edge of the world:
+//   periodic:   it comes back in from the opposite edge, and boids see each
+//               other across the edges, at their minimum image distance;
+//   reflective: it bounces off the edge, the velocity component mirrored;
+//   open:       it may leave, but is turned back within margin of an edge.
+enum class Boundary { periodic, reflective, open };
+
+const char* boundaryName(Boundary boundary);
+Boundary boundaryFromName(const std::string& name);
+
+// size and edges of the world the boids live in, the window by default
+struct World {
+  double width{1280};
+  double height{720};
+  Boundary boundary{Boundary::periodic};
+  double margin{50};   // open: distance from an edge where boids turn
+  double turn{0.05};   // open: push back per tick, a fraction of maxspeed
+};
+
+// checks the ranges of the parameters, throwing std::runtime_error with the
+// first one out of range
+void checkParameters(const Parameters& par);
+// the same for a maxspeed, which must not be negative
+void checkMaxspeed(double maxspeed);
+
+// sums of the three rules, gathered in a single pass over the neighbors
+template <class T>
+struct BasicSteeringSums {
+  Vec2<T> displacements;  // other - own position, closer than ds
+  Vec2<T> velocities;     // other - own velocity, closer than d
+  Vec2<T> positions;      // closer than d, own position included
+  int neighbors{};        // boids closer than d, own one included
+};
+
+// the members of SteeringSums, to gather only the ones some rules need
+enum SteeringTerm : unsigned {
+  displacementsTerm = 1,
+  velocitiesTerm = 2,
+  positionsTerm = 4,
+  neighborsTerm = 8,
+  allTerms = 15,
+};
+
+// positions and velocities of many boids, one contiguous array per component
+template <class T>
+struct BasicBoidArrays {
+  std::vector<T> x;
+  std::vector<T> y;
+  std::vector<T> vx;
+  std::vector<T> vy;
+
+  BasicBoidArrays() = default;
+  // explicit, since it can lose precision
+  template <class U>
+  explicit BasicBoidArrays(const BasicBoidArrays<U>& other)
+      : x(other.x.begin(), other.x.end()),
+        y(other.y.begin(), other.y.end()),
+        vx(other.vx.begin(), other.vx.end()),
+        vy(other.vy.begin(), other.vy.end()) {}
+
+  int size() const { return x.size(); }
+
+  void resize(int n) {
+    x.resize(n);
+    y.resize(n);
+    vx.resize(n);
+    vy.resize(n);
+  }
+
+  void push_back(const Vec2<T>& position, const Vec2<T>& velocity) {
+    x.push_back(position.x);
+    y.push_back(position.y);
+    vx.push_back(velocity.x);
+    vy.push_back(velocity.y);
+  }
+};
+
+// entries begin ... end - 1 of an array
+struct Range {
+  int begin{};
+  int end{};
+};
+
+// fused kernel over the entries begin ... end - 1 of boids, for a boid with
+// the given position, velocity and parameters, adding the SteeringTerm
+// members in terms to sums; the others are left alone, and cost nothing.
+// With a periodic world, distances are taken to the nearest image of each
+// boid and positions sums those images. Runs the widest SIMD kernel the CPU
+// supports, see simd.hpp.
+void steeringSums(BasicSteeringSums<double>& sums,
+                  const Vec2<double>& position,
+                  const Vec2<double>& velocity, const Parameters& par,
+                  const BasicBoidArrays<double>& boids, int begin, int end,
+                  unsigned terms = allTerms, const World* world = nullptr);
+void steeringSums(BasicSteeringSums<float>& sums, const Vec2<float>& position,
+                  const Vec2<float>& velocity, const Parameters& par,
+                  const BasicBoidArrays<float>& boids, int begin, int end,
+                  unsigned terms = allTerms, const World* world = nullptr);
+// the same over count ranges of boids at once, as if they were one
+void steeringSums(BasicSteeringSums<double>& sums,
+                  const Vec2<double>& position,
+                  const Vec2<double>& velocity, const Parameters& par,
+                  const BasicBoidArrays<double>& boids, const Range* ranges,
+                  int count, unsigned terms = allTerms,
+                  const World* world = nullptr);
+void steeringSums(BasicSteeringSums<float>& sums, const Vec2<float>& position,
+                  const Vec2<float>& velocity, const Parameters& par,
+                  const BasicBoidArrays<float>& boids, const Range* ranges,
+                  int count, unsigned terms = allTerms,
+                  const World* world = nullptr);
+
+// Parameters stay in double whatever T is: they are read once per boid
+template <class T>
+class BasicBoid {
+  Vec2<T> position;
+  Vec2<T> velocity;
   Parameters par;
-  double maxspeed;
+  T maxspeed{};
 
  public:
-  Boid();
-  Boid(double, double);
+  BasicBoid();
+  BasicBoid(T, T);
+  // parameters are taken as they are, they must have been checked already
+  BasicBoid(const Vec2<T>& pos, const Vec2<T>& vel, const Parameters& newPar,
+            T newMaxspeed);
 
-  sf::Vector2<double> getPosition() const;
-  void setPosition(const sf::Vector2<double>& newPos);
+  Vec2<T> getPosition() const;
+  void setPosition(const Vec2<T>& newPos);
 
-  sf::Vector2<double> getVelocity() const;
-  void setVelocity(const sf::Vector2<double>& newVel);
+  Vec2<T> getVelocity() const;
+  void setVelocity(const Vec2<T>& newVel);
 
   Parameters getPar() const;
+  // the setters check the new value first, and leave the parameters as they
+  // were when it is out of range
   void setPar(const Parameters& newPar);
 
   void setPar_d(const double new_d);
@@ -48,20 +183,41 @@ class Boid {
   void setPar_a(const double new_a);
   void setPar_c(const double new_c);
 
-  double getMaxspeed() const;
-  void setMaxspeed(double new_Maxspeed);
+  T getMaxspeed() const;
+  void setMaxspeed(T new_Maxspeed);
 
-  sf::Vector2<double> separation(const std::vector<Boid>& boids);
-  sf::Vector2<double> alignment(const std::vector<Boid>& boids);
-  sf::Vector2<double> cohesion(const std::vector<Boid>& boids);
+  // reference implementation of the rules, one pass over boids each
+  Vec2<T> separation(const std::vector<BasicBoid>& boids);
+  Vec2<T> alignment(const std::vector<BasicBoid>& boids);
+  Vec2<T> cohesion(const std::vector<BasicBoid>& boids);
 
-  void updateVelocity(const std::vector<Boid>& boids);
+  // fused kernel: the three sums in one pass with squared distances
+  BasicSteeringSums<T> steeringSums(const std::vector<BasicBoid>& boids) const;
+  // v1 + v2 + v3 from the sums, N being the size of the whole flock
+  Vec2<T> steering(const BasicSteeringSums<T>& sums, int N) const;
+
+  void updateVelocity(const std::vector<BasicBoid>& boids);
+  void updateVelocity(const BasicSteeringSums<T>& sums, int N);
+  // adds steering to the velocity, within maxspeed
+  void updateVelocity(const Vec2<T>& steering);
   void updatePosition(double const delta_t);
   void borders();
+  void borders(const World& world);
 
-  void update(const std::vector<Boid>& boids, double const delta_t);
+  void update(const std::vector<BasicBoid>& boids, double const delta_t);
 
 };
 
+using SteeringSums = BasicSteeringSums<double>;
+using BoidArrays = BasicBoidArrays<double>;
+using Boid = BasicBoid<double>;
+
+using SteeringSumsF = BasicSteeringSums<float>;
+using BoidArraysF = BasicBoidArrays<float>;
+using BoidF = BasicBoid<float>;
+
+extern template class BasicBoid<double>;
+extern template class BasicBoid<float>;
+
 }  // namespace bd
 #endif
\ No newline at end of file
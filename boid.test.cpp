@@ -2,38 +2,169 @@
 
 #include "boid.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "checkpoint.hpp"
 #include "doctest.h"
 #include "flock.hpp"
+#include "morton.hpp"
+#include "profiler.hpp"
+#include "rules.hpp"
+#include "simd.hpp"
+#include "simulation.hpp"
+#include "statistics.hpp"
+#include "trajectory.hpp"
+
+// Every allocation of the test program goes through these, so that a test
+// can count the ones some code makes; malloc and free otherwise. All the
+// forms are replaced, so that none of them pairs with one of the library.
+// Once inlined, GCC takes the free() of these for a mismatch.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+namespace {
+std::atomic<long> allocations{0};
+
+void* allocate(std::size_t size, std::size_t align) {
+  ++allocations;
+  // a multiple of the alignment, and never 0
+  return align > alignof(std::max_align_t)
+             ? std::aligned_alloc(align, (size / align + 1) * align)
+             : std::malloc(size > 0 ? size : 1);
+}
+void* allocateOrThrow(std::size_t size, std::size_t align) {
+  if (void* p = allocate(size, align)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+constexpr std::size_t plain{alignof(std::max_align_t)};
+}  // namespace
+
+void* operator new(std::size_t size) { return allocateOrThrow(size, plain); }
+void* operator new[](std::size_t size) { return allocateOrThrow(size, plain); }
+void* operator new(std::size_t size, std::align_val_t align) {
+  return allocateOrThrow(size, static_cast<std::size_t>(align));
+}
+void* operator new[](std::size_t size, std::align_val_t align) {
+  return allocateOrThrow(size, static_cast<std::size_t>(align));
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size, plain);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size, plain);
+}
+void* operator new(std::size_t size, std::align_val_t align,
+                   const std::nothrow_t&) noexcept {
+  return allocate(size, static_cast<std::size_t>(align));
+}
+void* operator new[](std::size_t size, std::align_val_t align,
+                     const std::nothrow_t&) noexcept {
+  return allocate(size, static_cast<std::size_t>(align));
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+#pragma GCC diagnostic pop
 
 TEST_CASE("Testing the vectors functions") {
   SUBCASE("Distance between vectors") {
-    sf::Vector2<double> v1{1, 1};
-    sf::Vector2<double> v2{4, 5};
+    bd::Vec2<double> v1{1, 1};
+    bd::Vec2<double> v2{4, 5};
     double distance12 = bd::distance(v1, v2);
     CHECK(distance12 == doctest::Approx(5));
   }
   SUBCASE("Magnitude of a vector") {
-    sf::Vector2<double> v1{4, 3};
+    bd::Vec2<double> v1{4, 3};
     double magnitude1 = bd::magnitude(v1);
     CHECK(magnitude1 == doctest::Approx(5));
   }
   SUBCASE("Angle of a vector") {
-    sf::Vector2<double> v1{4, 3};
+    bd::Vec2<double> v1{4, 3};
     double angle1 = bd::angle(v1);
     CHECK(angle1 == doctest::Approx(0.64).epsilon(0.01));
   }
+  SUBCASE("Triangle of a boid") {
+    // the sf::ConvexShape the boids were drawn with: points (-4, 4), (4, 4)
+    // and (0, 20) turned by 270 degrees plus the angle of the velocity,
+    // with the rotation of sf::Transform
+    const double side = 4;
+    const bd::Vec2<double> points[3]{{-side, side}, {side, side}, {0, 5 * side}};
+    bd::Vec2<double> position{100, 50};
+    for (bd::Vec2<double> velocity :
+         {bd::Vec2<double>{3, 4}, {-1, 0}, {0, -2}, {-5, 0.1}, {0, 0}}) {
+      double theta = 1.5 * M_PI + bd::angle(velocity);
+      auto corners = bd::triangle(position, velocity, side);
+      for (int k = 0; k < 3; ++k) {
+        const auto& p = points[k];
+        CHECK(corners[k].x == doctest::Approx(position.x + std::cos(theta) * p.x -
+                                              std::sin(theta) * p.y));
+        CHECK(corners[k].y == doctest::Approx(position.y + std::sin(theta) * p.x +
+                                              std::cos(theta) * p.y));
+      }
+    }
+  }
+  SUBCASE("Vector operators") {
+    constexpr bd::Vec2<double> v1{1, 2};
+    constexpr bd::Vec2<double> v2 = 2. * (v1 + bd::Vec2<double>{3, 4}) / 4.;
+    static_assert(v2 == bd::Vec2<double>{2, 3}, "constexpr arithmetic");
+    static_assert(sizeof(bd::Vec2<float>) == 2 * sizeof(float), "no padding");
+    bd::Vec2<double> v3 = v1;
+    v3 -= v2;
+    v3 *= -1.;
+    CHECK(v3.x == 1.);
+    CHECK(v3.y == 1.);
+    CHECK(-v3 == bd::Vec2<double>{-1, -1});
+    CHECK(bd::dot(v1, v2) == 8.);
+    bd::Vec2<float> f{v1};
+    CHECK(f.y == 2.f);
+  }
 }
 
 TEST_CASE("Testing the class Boid") {
   SUBCASE("getPosition, setPosition, getVelocity, setVelocity") {
     bd::Boid boid1;
-    sf::Vector2<double> pos1{0, 1};
+    bd::Vec2<double> pos1{0, 1};
     boid1.setPosition(pos1);
-    sf::Vector2<double> p1 = boid1.getPosition();
+    bd::Vec2<double> p1 = boid1.getPosition();
 
-    sf::Vector2<double> vel1{2, 0};
+    bd::Vec2<double> vel1{2, 0};
     boid1.setVelocity(vel1);
-    sf::Vector2<double> v1 = boid1.getVelocity();
+    bd::Vec2<double> v1 = boid1.getVelocity();
 
     CHECK(p1.x == doctest::Approx(0.0));
     CHECK(p1.y == doctest::Approx(1.0));
@@ -69,21 +200,21 @@ TEST_CASE("Testing the class Boid") {
 
   SUBCASE("Separation, Alignment and Cohesion rules, and updateVelocity") {
     bd::Boid boid1;
-    sf::Vector2<double> pos1{0, 0};
+    bd::Vec2<double> pos1{0, 0};
     boid1.setPosition(pos1);
-    sf::Vector2<double> vel1{0, 0};
+    bd::Vec2<double> vel1{0, 0};
     boid1.setVelocity(vel1);
 
     bd::Boid boid2;
-    sf::Vector2<double> pos2{3, 4};
+    bd::Vec2<double> pos2{3, 4};
     boid2.setPosition(pos2);
-    sf::Vector2<double> vel2{0, 4};
+    bd::Vec2<double> vel2{0, 4};
     boid2.setVelocity(vel2);
 
     bd::Boid testBoid;
-    sf::Vector2<double> pos_test{1, 1};
+    bd::Vec2<double> pos_test{1, 1};
     testBoid.setPosition(pos_test);
-    sf::Vector2<double> vel_test{1, 1};
+    bd::Vec2<double> vel_test{1, 1};
     testBoid.setVelocity(vel_test);
 
     double ds = 5;
@@ -101,12 +232,12 @@ TEST_CASE("Testing the class Boid") {
     testBoid.setMaxspeed(maxspeed);
 
     std::vector<bd::Boid> boids = {boid1, boid2, testBoid};
-    sf::Vector2<double> v1 = testBoid.separation(boids);
-    sf::Vector2<double> v2 = testBoid.alignment(boids);
-    sf::Vector2<double> v3 = testBoid.cohesion(boids);
+    bd::Vec2<double> v1 = testBoid.separation(boids);
+    bd::Vec2<double> v2 = testBoid.alignment(boids);
+    bd::Vec2<double> v3 = testBoid.cohesion(boids);
 
     testBoid.updateVelocity(boids);
-    sf::Vector2<double> v = testBoid.getVelocity();
+    bd::Vec2<double> v = testBoid.getVelocity();
 
     CHECK(v1.x == doctest::Approx(-1.0));
     CHECK(v1.y == doctest::Approx(-2.0));
@@ -118,6 +249,29 @@ TEST_CASE("Testing the class Boid") {
     CHECK(v.y == doctest::Approx(1.0));
   }
 
+  SUBCASE("The fused kernel matches separation, alignment and cohesion") {
+    std::default_random_engine eng(7);
+    std::uniform_real_distribution<double> pDist(0, 100);
+    std::uniform_real_distribution<double> vDist(-1, 1);
+    std::vector<bd::Boid> boids;
+    for (int i = 0; i < 200; ++i) {
+      bd::Boid boid(pDist(eng), pDist(eng));
+      boid.setVelocity({vDist(eng), vDist(eng)});
+      boids.push_back(boid);
+    }
+
+    bd::Parameters par{20.0, 8.0, 0.5, 0.3, 0.2};
+    for (auto& boid : boids) {
+      boid.setPar(par);
+      bd::Vec2<double> v = boid.separation(boids) +
+                              boid.alignment(boids) + boid.cohesion(boids);
+      bd::Vec2<double> fused =
+          boid.steering(boid.steeringSums(boids), boids.size());
+      CHECK(fused.x == doctest::Approx(v.x));
+      CHECK(fused.y == doctest::Approx(v.y));
+    }
+  }
+
   SUBCASE("Calling separation, alignment, cohesion with one point throws") {
     bd::Boid boid1;
     std::vector<bd::Boid> boids = {boid1};
@@ -129,9 +283,9 @@ TEST_CASE("Testing the class Boid") {
 
   SUBCASE("updatePosition") {
     bd::Boid boid1;
-    sf::Vector2<double> pos1{0, 0};
+    bd::Vec2<double> pos1{0, 0};
     boid1.setPosition(pos1);
-    sf::Vector2<double> vel1{1, 1};
+    bd::Vec2<double> vel1{1, 1};
     boid1.setVelocity(vel1);
     double const delta_t = 1;
     boid1.updatePosition(delta_t);
@@ -142,9 +296,9 @@ TEST_CASE("Testing the class Boid") {
   SUBCASE("borders: the boid exceeds the superior border") {
     double screenHeight{720};
     bd::Boid boid1;
-    sf::Vector2<double> pos1{5., -1.};
+    bd::Vec2<double> pos1{5., -1.};
     boid1.setPosition(pos1);
-    sf::Vector2<double> vel1{0, -1};
+    bd::Vec2<double> vel1{0, -1};
     boid1.setVelocity(vel1);
     boid1.borders();
     pos1 = boid1.getPosition();
@@ -154,9 +308,9 @@ TEST_CASE("Testing the class Boid") {
   SUBCASE("borders: the boid exceeds the inferior border") {
     double screenHeight{720};
     bd::Boid boid1;
-    sf::Vector2<double> pos1{5, screenHeight + 1};
+    bd::Vec2<double> pos1{5, screenHeight + 1};
     boid1.setPosition(pos1);
-    sf::Vector2<double> vel1{0, 1};
+    bd::Vec2<double> vel1{0, 1};
     boid1.setVelocity(vel1);
     boid1.borders();
     pos1 = boid1.getPosition();
@@ -167,9 +321,9 @@ TEST_CASE("Testing the class Boid") {
   SUBCASE("borders: the boid exceeds the right border") {
     double screenWidth{1280};
     bd::Boid boid1;
-    sf::Vector2<double> pos1{screenWidth + 1, 5};
+    bd::Vec2<double> pos1{screenWidth + 1, 5};
     boid1.setPosition(pos1);
-    sf::Vector2<double> vel1{1, 0};
+    bd::Vec2<double> vel1{1, 0};
     boid1.setVelocity(vel1);
     boid1.borders();
     pos1 = boid1.getPosition();
@@ -179,9 +333,9 @@ TEST_CASE("Testing the class Boid") {
   SUBCASE("borders: the boid exceeds the left border") {
     double screenWidth{1280};
     bd::Boid boid1;
-    sf::Vector2<double> pos1{-1., 5};
+    bd::Vec2<double> pos1{-1., 5};
     boid1.setPosition(pos1);
-    sf::Vector2<double> vel1{-1, 0};
+    bd::Vec2<double> vel1{-1, 0};
     boid1.setVelocity(vel1);
     boid1.borders();
     pos1 = boid1.getPosition();
@@ -191,15 +345,15 @@ TEST_CASE("Testing the class Boid") {
 
   SUBCASE("update") {
     bd::Boid boid1;
-    sf::Vector2<double> pos1{1, 1};
+    bd::Vec2<double> pos1{1, 1};
     boid1.setPosition(pos1);
-    sf::Vector2<double> vel1{1, 0};
+    bd::Vec2<double> vel1{1, 0};
     boid1.setVelocity(vel1);
 
     bd::Boid boid2;
-    sf::Vector2<double> pos2{1, 4};
+    bd::Vec2<double> pos2{1, 4};
     boid2.setPosition(pos2);
-    sf::Vector2<double> vel2{0, 2};
+    bd::Vec2<double> vel2{0, 2};
     boid2.setVelocity(vel2);
 
     double ds = 5;
@@ -220,8 +374,8 @@ TEST_CASE("Testing the class Boid") {
     double const delta_t = 1;
 
     boid2.update(boids, delta_t);
-    sf::Vector2<double> v = boid2.getVelocity();
-    sf::Vector2<double> p = boid2.getPosition();
+    bd::Vec2<double> v = boid2.getVelocity();
+    bd::Vec2<double> p = boid2.getPosition();
 
     CHECK(v.x == doctest::Approx(1.0));
     CHECK(v.y == doctest::Approx(0.0));
@@ -232,8 +386,8 @@ TEST_CASE("Testing the class Boid") {
   SUBCASE("Testing getMaxspeed and the the Maxspeed in updateVelocity") {
     bd::Boid boid1;
     bd::Boid boid2;
-    sf::Vector2<double> vel1{5, 12};
-    sf::Vector2<double> vel2{5, 12};
+    bd::Vec2<double> vel1{5, 12};
+    bd::Vec2<double> vel2{5, 12};
     boid1.setVelocity(vel1);
     boid2.setVelocity(vel2);
     boid1.setMaxspeed(10);
@@ -246,6 +400,8 @@ TEST_CASE("Testing the class Boid") {
 
     CHECK(m_s == doctest::Approx(10));
     CHECK(speed == doctest::Approx(10));
+    CHECK_THROWS(boid2.setMaxspeed(-10));
+    CHECK(boid2.getMaxspeed() == 10);
   }
 }
 TEST_CASE("Testing the Flock class") {
@@ -255,11 +411,11 @@ TEST_CASE("Testing the Flock class") {
     bd::Boid boid2(1, 3);
     bd::Boid boid3(2, 2);
 
-    sf::Vector2<double> vel1{4, 3};
+    bd::Vec2<double> vel1{4, 3};
     boid1.setVelocity(vel1);
-    sf::Vector2<double> vel2{3, 4};
+    bd::Vec2<double> vel2{3, 4};
     boid2.setVelocity(vel2);
-    sf::Vector2<double> vel3{-1, 0};
+    bd::Vec2<double> vel3{-1, 0};
     boid3.setVelocity(vel3);
 
     test_flock.addBoid(boid1);
@@ -279,11 +435,11 @@ TEST_CASE("Testing the Flock class") {
 
   SUBCASE("Testing the updateFlock method") {
     bd::Boid boid1(1, 1);
-    sf::Vector2<double> vel1{1, 0};
+    bd::Vec2<double> vel1{1, 0};
     boid1.setVelocity(vel1);
 
     bd::Boid boid2(1, 2);
-    sf::Vector2<double> vel2{0, 2};
+    bd::Vec2<double> vel2{0, 2};
     boid2.setVelocity(vel2);
 
     bd::Parameters par1{10.0, 7.0, 1.0, 1.0, 1.0};
@@ -302,10 +458,10 @@ TEST_CASE("Testing the Flock class") {
 
     test_flock.updateFlock(delta_t);
 
-    sf::Vector2<double> v1 = test_flock.getBoid(0).getVelocity();
-    sf::Vector2<double> p1 = test_flock.getBoid(0).getPosition();
-    sf::Vector2<double> v2 = test_flock.getBoid(1).getVelocity();
-    sf::Vector2<double> p2 = test_flock.getBoid(1).getPosition();
+    bd::Vec2<double> v1 = test_flock.getBoid(0).getVelocity();
+    bd::Vec2<double> p1 = test_flock.getBoid(0).getPosition();
+    bd::Vec2<double> v2 = test_flock.getBoid(1).getVelocity();
+    bd::Vec2<double> p2 = test_flock.getBoid(1).getPosition();
 
     CHECK(v1.x == doctest::Approx(0.0));
     CHECK(v1.y == doctest::Approx(2.0));
@@ -318,6 +474,116 @@ TEST_CASE("Testing the Flock class") {
     CHECK(p2.y == doctest::Approx(4.0));
   }
 
+  SUBCASE("Double buffered update reads the state at the start of the tick") {
+    bd::Boid boid1(1, 1);
+    boid1.setVelocity({1, 0});
+    bd::Boid boid2(1, 2);
+    boid2.setVelocity({0, 2});
+
+    bd::Parameters par1{10.0, 7.0, 1.0, 1.0, 1.0};
+    boid1.setPar(par1);
+    boid2.setPar(par1);
+    boid1.setMaxspeed(100);
+    boid2.setMaxspeed(100);
+
+    bd::Flock test_flock;
+    test_flock.addBoid(boid1);
+    test_flock.addBoid(boid2);
+    test_flock.setUpdateMode(bd::UpdateMode::doubleBuffered);
+
+    test_flock.updateFlock(1);
+
+    // boid2 steers against boid1 before it moved, unlike the in place update
+    bd::Vec2<double> v1 = test_flock.getBoid(0).getVelocity();
+    bd::Vec2<double> v2 = test_flock.getBoid(1).getVelocity();
+    bd::Vec2<double> p2 = test_flock.getBoid(1).getPosition();
+    CHECK(v1.x == doctest::Approx(0.0));
+    CHECK(v1.y == doctest::Approx(2.0));
+    CHECK(v2.x == doctest::Approx(1.0));
+    CHECK(v2.y == doctest::Approx(0.0));
+    CHECK(p2.x == doctest::Approx(2.0));
+    CHECK(p2.y == doctest::Approx(2.0));
+  }
+
+  SUBCASE("Double buffered results do not depend on the number of threads") {
+    std::default_random_engine eng(11);
+    std::uniform_real_distribution<double> xDist(0, 1280);
+    std::uniform_real_distribution<double> yDist(0, 720);
+    std::uniform_real_distribution<double> vDist(-50, 50);
+    bd::Parameters par{40.0, 10.0, 0.1, 0.1, 0.1};
+
+    bd::Flock single;
+    for (int i = 0; i < 1000; ++i) {
+      bd::Boid boid(xDist(eng), yDist(eng));
+      boid.setVelocity({vDist(eng), vDist(eng)});
+      boid.setPar(par);
+      boid.setMaxspeed(100);
+      single.addBoid(boid);
+    }
+    single.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    bd::Flock multi = single;
+    multi.setThreads(4);
+    CHECK(single.threads() == 1);
+    CHECK(multi.threads() == 4);
+
+    for (int t = 0; t < 10; ++t) {
+      single.updateFlock(0.05);
+      multi.updateFlock(0.05);
+    }
+
+    bool identical = true;
+    for (int i = 0; i < 1000; ++i) {
+      identical = identical && single.arrays().x[i] == multi.arrays().x[i] &&
+                  single.arrays().y[i] == multi.arrays().y[i] &&
+                  single.arrays().vx[i] == multi.arrays().vx[i] &&
+                  single.arrays().vy[i] == multi.arrays().vy[i];
+    }
+    CHECK(identical);
+  }
+
+  SUBCASE("Idle threads steal the work of a crowded area") {
+    std::default_random_engine eng(5);
+    std::uniform_real_distribution<double> clump(600, 640);
+    std::uniform_real_distribution<double> xDist(0, 1280);
+    std::uniform_real_distribution<double> yDist(0, 720);
+    bd::Parameters par{30.0, 5.0, 0.1, 0.1, 0.1};
+
+    // most of the boids in one clump, the rest spread over the world
+    bd::Flock test_flock;
+    for (int i = 0; i < 4000; ++i) {
+      bd::Boid boid = i < 2000 ? bd::Boid(clump(eng), clump(eng))
+                               : bd::Boid(xDist(eng), yDist(eng));
+      boid.setPar(par);
+      boid.setMaxspeed(100);
+      test_flock.addBoid(boid);
+    }
+    test_flock.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    test_flock.setThreads(4);
+    test_flock.updateFlock(0.01);
+
+    std::vector<bd::ThreadStats> stats = test_flock.threadStats();
+    CHECK(stats.size() == 4);
+    long tasks = 0;
+    for (auto const& s : stats) {
+      tasks += s.tasks;
+      CHECK(s.stolen <= s.tasks);
+      CHECK(s.busy <= s.wall);
+      CHECK(s.utilization() <= 1.0);
+    }
+    CHECK(tasks == (4000 + 127) / 128);
+
+    test_flock.resetThreadStats();
+    CHECK(test_flock.threadStats()[0].tasks == 0);
+  }
+
+  SUBCASE("Errors in the threads reach the caller") {
+    bd::Flock test_flock;
+    test_flock.addBoid(bd::Boid(1, 1));
+    test_flock.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    test_flock.setThreads(2);
+    CHECK_THROWS(test_flock.updateFlock(1));
+  }
+
   SUBCASE("setParameters") {
     bd::Flock test_flock;
     bd::Boid boid1(5, 6);
@@ -344,6 +610,24 @@ TEST_CASE("Testing the Flock class") {
     CHECK(gPar2.c == doctest::Approx(1.0));
   }
 
+  SUBCASE("getBoid on a non-const flock writes through to the arrays") {
+    bd::Flock f1;
+    f1.addBoid(bd::Boid(1, 2));
+    f1.addBoid(bd::Boid(3, 4));
+
+    f1.getBoid(1).setPosition({5, 6});
+    f1.getBoid(1).setVelocity({-1, 1});
+    f1.getBoid(1).setMaxspeed(20);
+
+    const bd::BoidArrays& arrays = f1.arrays();
+    CHECK(arrays.x[1] == doctest::Approx(5));
+    CHECK(arrays.y[1] == doctest::Approx(6));
+    CHECK(arrays.vx[1] == doctest::Approx(-1));
+    CHECK(arrays.vy[1] == doctest::Approx(1));
+    CHECK(f1.getBoid(1).getMaxspeed() == doctest::Approx(20));
+    CHECK(arrays.x[0] == doctest::Approx(1));
+  }
+
   SUBCASE("Testing getBoid ") {
     bd::Boid b1;
     bd::Boid b2(2, 3);
@@ -355,12 +639,2014 @@ TEST_CASE("Testing the Flock class") {
     bd::Boid test_b1 = f1.getBoid(0);
     bd::Boid test_b2 = f1.getBoid(1);
 
-    sf::Vector2<double> p1 = test_b1.getPosition();
-    sf::Vector2<double> p2 = test_b2.getPosition();
+    bd::Vec2<double> p1 = test_b1.getPosition();
+    bd::Vec2<double> p2 = test_b2.getPosition();
 
     CHECK(p1.x == doctest::Approx(0));
     CHECK(p1.y == doctest::Approx(0));
     CHECK(p2.x == doctest::Approx(2));
     CHECK(p2.y == doctest::Approx(3));
   }
-}
\ No newline at end of file
+}
+TEST_CASE("Testing the Grid") {
+  SUBCASE("Boids are bucketed by cell") {
+    bd::Grid grid(100, 50);
+    bd::BoidArrays boids;
+    boids.push_back({5, 5}, {1, 0});
+    boids.push_back({95, 45}, {0, 1});
+    boids.push_back({15, 5}, {2, 0});
+    boids.push_back({-3, 60}, {0, 2});
+    grid.build(boids, 10);
+
+    CHECK(grid.cols() == 10);
+    CHECK(grid.rows() == 5);
+    CHECK(grid.cell(5, 5) == 0);
+    CHECK(grid.cell(95, 45) == 49);
+    CHECK(grid.cell(-3, 60) == 40);  // clamped to the edge cells
+
+    CHECK(grid.cellStart(1) - grid.cellStart(0) == 1);
+    CHECK(grid.indices()[grid.cellStart(0)] == 0);
+    CHECK(grid.sorted().vx[grid.slot(2)] == doctest::Approx(2.0));
+
+    grid.update(2, {16, 6}, {3, 0});
+    CHECK(grid.sorted().x[grid.slot(2)] == doctest::Approx(16.0));
+    CHECK(grid.sorted().vx[grid.slot(2)] == doctest::Approx(3.0));
+  }
+
+  SUBCASE("The 3x3 neighbor cells wrap around the borders") {
+    bd::Grid grid(100, 50);
+    bd::BoidArrays boids;
+    boids.push_back({1, 1}, {0, 0});
+    boids.push_back({99, 49}, {0, 0});
+    boids.push_back({50, 25}, {0, 0});
+    grid.build(boids, 10);
+
+    bd::Grid::Spans spans;
+    int n = grid.neighbors(1, 1, spans);
+    CHECK(n == 6);
+    int count = 0;
+    bool corner = false;
+    for (int k = 0; k < n; ++k) {
+      for (int j = spans[k].begin; j < spans[k].end; ++j) {
+        ++count;
+        corner = corner || grid.indices()[j] == 1;
+      }
+    }
+    CHECK(count == 2);
+    CHECK(corner);
+  }
+
+  SUBCASE("Small grids do not visit a cell twice") {
+    bd::Grid grid(100, 50);
+    bd::BoidArrays boids;
+    boids.push_back({1, 1}, {0, 0});
+    boids.push_back({99, 49}, {0, 0});
+    grid.build(boids, 40);
+
+    CHECK(grid.cols() == 2);
+    CHECK(grid.rows() == 1);
+    bd::Grid::Spans spans;
+    CHECK(grid.neighbors(1, 1, spans) == 1);
+    CHECK(spans[0].end - spans[0].begin == 2);
+  }
+
+  SUBCASE("updateFlock matches the brute-force update") {
+    std::default_random_engine eng(42);
+    std::uniform_real_distribution<double> xDist(0, 1280);
+    std::uniform_real_distribution<double> yDist(0, 720);
+    std::uniform_real_distribution<double> vDist(-1, 1);
+    bd::Parameters par{40.0, 10.0, 0.1, 0.1, 0.1};
+
+    bd::Flock grid_flock;
+    for (int i = 0; i < 500; ++i) {
+      bd::Boid boid(xDist(eng), yDist(eng));
+      boid.setVelocity({vDist(eng), vDist(eng)});
+      boid.setPar(par);
+      boid.setMaxspeed(500);
+      grid_flock.addBoid(boid);
+    }
+    bd::Flock brute_flock = grid_flock;
+
+    grid_flock.updateFlock(0.01);
+    brute_flock.updateFlockBruteForce(0.01);
+
+    // cells of d and one step at maxspeed, 40 + 500 * 0.01
+    CHECK(grid_flock.grid().cols() == 28);
+    CHECK(grid_flock.grid().rows() == 16);
+    for (int i = 0; i < 500; ++i) {
+      bd::Vec2<double> p1 = grid_flock.getBoid(i).getPosition();
+      bd::Vec2<double> p2 = brute_flock.getBoid(i).getPosition();
+      bd::Vec2<double> v1 = grid_flock.getBoid(i).getVelocity();
+      bd::Vec2<double> v2 = brute_flock.getBoid(i).getVelocity();
+      CHECK(p1.x == doctest::Approx(p2.x));
+      CHECK(p1.y == doctest::Approx(p2.y));
+      CHECK(v1.x == doctest::Approx(v2.x));
+      CHECK(v1.y == doctest::Approx(v2.y));
+    }
+  }
+}
+
+TEST_CASE("Testing the SIMD kernels") {
+  std::default_random_engine eng(3);
+  std::uniform_real_distribution<double> pDist(0, 60);
+  std::uniform_real_distribution<double> vDist(-1, 1);
+  bd::BoidArrays boids;
+  for (int i = 0; i < 64; ++i) {
+    boids.push_back({pDist(eng), pDist(eng)}, {vDist(eng), vDist(eng)});
+  }
+  bd::Parameters par{25.0, 10.0, 0.5, 0.5, 0.5};
+  bd::Vec2<double> position{30, 30};
+  bd::Vec2<double> velocity{0.5, -0.5};
+
+  SUBCASE("Every supported kernel matches the scalar one") {
+    for (bd::Simd level :
+         {bd::Simd::sse2, bd::Simd::avx2, bd::Simd::avx512}) {
+      if (!bd::simdSupported(level)) {
+        continue;
+      }
+      // every length from 0 to 19 covers the vector tails
+      for (int begin = 0; begin < 3; ++begin) {
+        for (int end = begin; end < begin + 20; ++end) {
+          bd::SteeringSums scalar;
+          bd::SteeringSums vector;
+          bd::steeringSums(bd::Simd::scalar, scalar, position, velocity, par,
+                           boids, begin, end);
+          bd::steeringSums(level, vector, position, velocity, par, boids,
+                           begin, end);
+          CHECK(vector.displacements.x ==
+                doctest::Approx(scalar.displacements.x));
+          CHECK(vector.displacements.y ==
+                doctest::Approx(scalar.displacements.y));
+          CHECK(vector.velocities.x == doctest::Approx(scalar.velocities.x));
+          CHECK(vector.velocities.y == doctest::Approx(scalar.velocities.y));
+          CHECK(vector.positions.x == doctest::Approx(scalar.positions.x));
+          CHECK(vector.positions.y == doctest::Approx(scalar.positions.y));
+          CHECK(vector.neighbors == scalar.neighbors);
+        }
+      }
+    }
+  }
+
+  SUBCASE("The scalar kernel matches Boid::steeringSums") {
+    std::vector<bd::Boid> vec;
+    for (int i = 0; i < boids.size(); ++i) {
+      vec.push_back(bd::Boid({boids.x[i], boids.y[i]},
+                             {boids.vx[i], boids.vy[i]}, par, 10));
+    }
+    bd::Boid boid(position, velocity, par, 10);
+    bd::SteeringSums ref = boid.steeringSums(vec);
+    bd::SteeringSums sums;
+    bd::steeringSums(bd::Simd::scalar, sums, position, velocity, par, boids, 0,
+                     boids.size());
+    CHECK(sums.displacements.x == doctest::Approx(ref.displacements.x));
+    CHECK(sums.velocities.y == doctest::Approx(ref.velocities.y));
+    CHECK(sums.positions.x == doctest::Approx(ref.positions.x));
+    CHECK(sums.neighbors == ref.neighbors);
+    CHECK(sums.neighbors > 1);
+  }
+
+  SUBCASE("The kernel in use can be changed") {
+    bd::Simd best = bd::bestSimd();
+    CHECK(bd::currentSimd() == best);
+    bd::useSimd(bd::Simd::scalar);
+    CHECK(bd::currentSimd() == bd::Simd::scalar);
+    bd::useSimd(best);
+    CHECK(bd::currentSimd() == best);
+  }
+}
+
+TEST_CASE("Testing the ThreadPool") {
+  SUBCASE("Every index is visited once, whatever the grain") {
+    bd::ThreadPool pool(3);
+    for (int grain : {1, 7, 64, 1000}) {
+      std::vector<int> visits(500, 0);
+      std::atomic<bool> tooLong{false};
+      pool.parallelFor(500, grain, [&](int begin, int end) {
+        if (end - begin > grain) {
+          tooLong = true;
+        }
+        for (int i = begin; i < end; ++i) {
+          ++visits[i];
+        }
+      });
+      CHECK(std::count(visits.begin(), visits.end(), 1) == 500);
+      CHECK(!tooLong);
+    }
+  }
+
+  SUBCASE("A slow task makes the other threads steal") {
+    bd::ThreadPool pool(2);
+    // the first block belongs to thread 0, which is stuck on task 0
+    pool.parallelFor(64, 1, [&](int begin, int) {
+      if (begin == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      }
+    });
+    std::vector<bd::ThreadStats> stats = pool.stats();
+    CHECK(stats[0].tasks + stats[1].tasks == 64);
+    CHECK(stats[1].stolen > 0);
+    CHECK(stats[1].tasks > 32);
+  }
+}
+
+TEST_CASE("Testing the profiler") {
+  bd::Profiler profiler;
+  for (int k = 1; k <= 100; ++k) {
+    profiler.record("steering", k * 1e-6);
+  }
+  profiler.record("borders", 2e-6);
+
+  std::vector<bd::PhaseSummary> summary = profiler.summary();
+  REQUIRE(summary.size() == 2);
+  CHECK(summary[0].phase == "steering");
+  CHECK(summary[0].samples == 100);
+  CHECK(summary[0].min == doctest::Approx(1e-6));
+  CHECK(summary[0].mean == doctest::Approx(50.5e-6));
+  CHECK(summary[0].p99 == doctest::Approx(99e-6));
+  CHECK(summary[1].p99 == doctest::Approx(2e-6));
+
+  SUBCASE("CSV output") {
+    std::ostringstream out;
+    profiler.writeCsv(out);
+    std::string csv = out.str();
+    CHECK(csv.rfind("phase,samples,min_us,mean_us,p99_us\nsteering,100,1,", 0) ==
+          0);
+  }
+
+  SUBCASE("The flock records its phases when profiling") {
+    bd::profiler().clear();
+    bd::Flock flock;
+    for (int i = 0; i < 10; ++i) {
+      flock.addBoid(
+          bd::Boid({10. * i, 5.}, {1, 0}, {50, 10, .05, .05, .05}, 500));
+    }
+    flock.updateFlock(0.1);
+    CHECK(bd::profiler().summary().size() == (bd::profiling ? 6 : 0));
+  }
+
+  SUBCASE("Only the last samples are kept") {
+    for (int k = 0; k < bd::Profiler::windowSize; ++k) {
+      profiler.record("steering", 1e-3);
+    }
+    bd::PhaseSummary s = profiler.summary()[0];
+    CHECK(s.samples == 100 + bd::Profiler::windowSize);
+    CHECK(s.min == doctest::Approx(1e-3));
+    CHECK(s.mean == doctest::Approx(1e-3));
+  }
+}
+
+TEST_CASE("Testing the fixed step simulation") {
+  SUBCASE("The triple buffer hands over the last value") {
+    bd::TripleBuffer<int> buffer;
+    CHECK(!buffer.update());
+    buffer.back() = 1;
+    buffer.publish();
+    buffer.back() = 2;
+    buffer.publish();
+    CHECK(buffer.update());
+    CHECK(buffer.front() == 2);
+    CHECK(!buffer.update());
+    CHECK(buffer.front() == 2);
+  }
+
+  SUBCASE("The reader never sees a value being written") {
+    bd::TripleBuffer<std::vector<int>> buffer;
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+      for (int k = 1; k <= 2000; ++k) {
+        buffer.back().assign(100, k);
+        buffer.publish();
+      }
+      done = true;
+    });
+    bool torn = false;
+    int last = 0;
+    auto read = [&] {
+      buffer.update();
+      const std::vector<int>& v = buffer.front();
+      if (!v.empty()) {
+        torn = torn || std::count(v.begin(), v.end(), v[0]) != 100 ||
+               v[0] < last;
+        last = v[0];
+      }
+    };
+    while (!done) {
+      read();
+    }
+    writer.join();
+    read();
+    CHECK(!torn);
+    CHECK(last == 2000);
+  }
+
+  SUBCASE("Interpolation") {
+    bd::BoidArrays from;
+    bd::BoidArrays to;
+    from.push_back({10, 10}, {1, 0});
+    to.push_back({20, 30}, {3, 0});
+    // crossed the right border
+    from.push_back({1279, 10}, {1, 0});
+    to.push_back({0, 12}, {1, 0});
+    bd::BoidArrays out;
+    bd::interpolate(from, to, 0.25, bd::World{}, out);
+    CHECK(out.x[0] == doctest::Approx(12.5));
+    CHECK(out.y[0] == doctest::Approx(15));
+    CHECK(out.vx[0] == doctest::Approx(1.5));
+    CHECK(out.x[1] == 0);
+    CHECK(out.y[1] == doctest::Approx(10.5));
+  }
+
+  SUBCASE("The result only depends on the number of ticks") {
+    bd::Flock flock;
+    std::default_random_engine eng(3);
+    std::uniform_real_distribution<double> pos(0, 400);
+    for (int i = 0; i < 50; ++i) {
+      flock.addBoid(bd::Boid({pos(eng), pos(eng)}, {1, 1},
+                             {50, 10, .05, .05, .05}, 500));
+    }
+    bd::Simulation simulation(flock, 0.002);
+    CHECK(simulation.latest().tick == 0);
+    simulation.start();
+    while (simulation.latest().tick < 5) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    simulation.stop();
+    CHECK(!simulation.running());
+
+    const bd::Snapshot& last = simulation.latest();
+    for (long t = 0; t < last.tick; ++t) {
+      flock.updateFlock(0.002);
+    }
+    CHECK(last.current.x == flock.arrays().x);
+    CHECK(last.current.vy == flock.arrays().vy);
+    CHECK(simulation.flock().arrays().x == flock.arrays().x);
+  }
+}
+
+TEST_CASE("Testing the fast average_distance") {
+  bd::Flock flock;
+  std::default_random_engine eng(11);
+  std::uniform_real_distribution<double> xDist(0, 1280);
+  std::uniform_real_distribution<double> yDist(0, 720);
+  for (int i = 0; i < 9001; ++i) {
+    flock.addBoid(bd::Boid({xDist(eng), yDist(eng)}, {0, 0},
+                           {50, 10, .05, .05, .05}, 500));
+  }
+  bd::Statistics exact = flock.average_distance();
+
+  SUBCASE("Blocked kernel") {
+    bd::Statistics blocked = flock.average_distance_blocked();
+    CHECK(blocked.mean == doctest::Approx(exact.mean).epsilon(1e-12));
+    CHECK(blocked.sigma == doctest::Approx(exact.sigma).epsilon(1e-9));
+
+    flock.setThreads(3);
+    bd::Statistics threaded = flock.average_distance_blocked();
+    CHECK(threaded.mean == blocked.mean);
+    CHECK(threaded.sigma == blocked.sigma);
+  }
+
+  SUBCASE("Random pairs") {
+    int samples = 100000;
+    bd::Statistics sampled = flock.average_distance_sampled(samples);
+    CHECK(std::abs(sampled.mean - exact.mean) <
+          4 * exact.sigma / std::sqrt(samples));
+    CHECK(sampled.sigma == doctest::Approx(exact.sigma).epsilon(0.02));
+    CHECK(flock.average_distance_sampled(samples, 5).mean != sampled.mean);
+    CHECK_THROWS(flock.average_distance_sampled(1));
+  }
+
+  SUBCASE("Small flocks") {
+    bd::Flock two;
+    two.addBoid(bd::Boid({0, 0}, {0, 0}, {50, 10, .05, .05, .05}, 500));
+    CHECK_THROWS(two.average_distance_blocked());
+    two.addBoid(bd::Boid({3, 4}, {0, 0}, {50, 10, .05, .05, .05}, 500));
+    two.addBoid(bd::Boid({6, 8}, {0, 0}, {50, 10, .05, .05, .05}, 500));
+    CHECK(two.average_distance_blocked().mean ==
+          doctest::Approx(two.average_distance().mean));
+    CHECK(two.average_distance_blocked().sigma ==
+          doctest::Approx(two.average_distance().sigma));
+  }
+}
+
+TEST_CASE("Testing the streaming statistics") {
+  SUBCASE("Welford accumulator") {
+    // large values with a small spread: sum(x^2) - N mean^2 cancels out
+    bd::Accumulator acc;
+    for (double x : {4., 7., 13., 16.}) {
+      acc.add(1e9 + x);
+    }
+    CHECK(acc.count() == 4);
+    CHECK(acc.mean() == doctest::Approx(1e9 + 10));
+    CHECK(acc.sigma() == doctest::Approx(std::sqrt(30.)).epsilon(1e-9));
+    CHECK(acc.min() == 1e9 + 4);
+    CHECK(acc.max() == 1e9 + 16);
+
+    bd::Accumulator empty;
+    CHECK(empty.variance() == 0.);
+    CHECK(bd::summary(empty).count == 0);
+  }
+
+  SUBCASE("Merged accumulators") {
+    std::default_random_engine eng(5);
+    std::normal_distribution<double> dist(3, 2);
+    bd::Accumulator all;
+    bd::Accumulator parts[3];
+    for (int k = 0; k < 3000; ++k) {
+      double x = dist(eng);
+      all.add(x);
+      parts[k % 3].add(x);
+    }
+    bd::Accumulator merged;
+    for (auto const& part : parts) {
+      merged.merge(part);
+    }
+    merged.merge(bd::Accumulator{});
+    CHECK(merged.count() == all.count());
+    CHECK(merged.mean() == doctest::Approx(all.mean()).epsilon(1e-12));
+    CHECK(merged.sigma() == doctest::Approx(all.sigma()).epsilon(1e-12));
+    CHECK(merged.min() == all.min());
+    CHECK(merged.max() == all.max());
+  }
+
+  SUBCASE("Time series") {
+    bd::FlockStatistics stats;
+    stats.setCapacity(3);
+    bd::Accumulator speed;
+    speed.add(1);
+    for (int t = 0; t < 5; ++t) {
+      stats.record(t + 1, speed, speed, 0.5);
+    }
+    CHECK(stats.ticks() == 5);
+    CHECK(stats.size() == 3);
+    CHECK(stats.last().tick == 5);
+    CHECK(stats.last().time == doctest::Approx(2.5));
+    CHECK(stats.find(2) == nullptr);
+    REQUIRE(stats.find(3) != nullptr);
+    CHECK(stats.find(3)->tick == 3);
+    CHECK(stats.find(6) == nullptr);
+  }
+
+  SUBCASE("Gathered by updateFlock") {
+    bd::Flock flock;
+    std::default_random_engine eng(9);
+    std::uniform_real_distribution<double> xDist(0, 300);
+    std::uniform_real_distribution<double> vDist(-5, 5);
+    for (int i = 0; i < 400; ++i) {
+      flock.addBoid(bd::Boid({xDist(eng), xDist(eng)}, {vDist(eng), vDist(eng)},
+                             {30, 5, .05, .05, .05}, 500));
+    }
+    bd::Flock copy = flock;
+
+    // the neighbors seen by the tick are the ones before it
+    const bd::BoidArrays& b = flock.arrays();
+    bd::Accumulator neighbors;
+    for (int i = 0; i < b.size(); ++i) {
+      int n = 0;
+      for (int j = 0; j < b.size(); ++j) {
+        double dx = b.x[j] - b.x[i];
+        double dy = b.y[j] - b.y[i];
+        n += j != i && dx * dx + dy * dy < 30 * 30;
+      }
+      neighbors.add(n);
+    }
+
+    copy.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    flock.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    copy.setThreads(4);
+    flock.updateFlock(0.1);
+    copy.updateFlock(0.1);
+
+    const bd::TickStatistics& tick = flock.statistics().last();
+    CHECK(flock.statistics().ticks() == 1);
+    CHECK(tick.neighbors.count == 400);
+    CHECK(tick.neighbors.mean == doctest::Approx(neighbors.mean()));
+    CHECK(tick.neighbors.max == neighbors.max());
+    CHECK(tick.speed.mean == doctest::Approx(flock.average_speed().mean));
+    CHECK(tick.speed.sigma == doctest::Approx(flock.average_speed().sigma));
+
+    const bd::TickStatistics& threaded = copy.statistics().last();
+    CHECK(threaded.speed.mean == tick.speed.mean);
+    CHECK(threaded.speed.sigma == tick.speed.sigma);
+    CHECK(threaded.neighbors.mean == tick.neighbors.mean);
+
+    flock.setCollectStatistics(false);
+    flock.updateFlock(0.1);
+    CHECK(flock.statistics().ticks() == 1);
+
+    // paused, the ticks recorded are labelled with the flock's all the same
+    flock.updateFlock(0.1);
+    flock.setCollectStatistics(true);
+    flock.updateFlock(0.1);
+    CHECK(flock.tick() == 4);
+    CHECK(flock.statistics().ticks() == 2);
+    CHECK(flock.statistics().last().tick == 4);
+    CHECK(flock.statistics().find(1) == &flock.statistics()[0]);
+    CHECK(flock.statistics().find(2) == nullptr);
+    CHECK(flock.statistics().find(3) == nullptr);
+    REQUIRE(flock.statistics().find(4) != nullptr);
+    CHECK(flock.statistics().find(4)->tick == 4);
+    // and back to an earlier tick, the ticks after it are dropped
+    bd::FlockState first = copy.state();
+    flock.updateFlock(0.1);
+    flock.restore(first);
+    flock.updateFlock(0.1);
+    CHECK(flock.statistics().size() == 2);
+    CHECK(flock.statistics().last().tick == 2);
+    CHECK(flock.statistics().find(4) == nullptr);
+  }
+}
+
+TEST_CASE("Testing the trajectory files") {
+  const std::string path = "boid.test.traj";
+  bd::TrajectoryHeader header;
+  header.n = 300;
+  header.seed = 42;
+  header.world = {640, 480};
+  header.delta_t = 0.01;
+  header.par = {50, 10, .1, .2, .3};
+  header.maxspeed = 100;
+
+  std::default_random_engine eng(2);
+  std::uniform_real_distribution<double> xDist(0, 640);
+  std::uniform_real_distribution<double> vDist(-100, 100);
+  std::vector<bd::BoidArrays> frames(20);
+  for (auto& frame : frames) {
+    for (unsigned i = 0; i < header.n; ++i) {
+      frame.push_back({xDist(eng), xDist(eng) * 0.75}, {vDist(eng), vDist(eng)});
+    }
+  }
+
+  for (bd::Encoding encoding :
+       {bd::Encoding::float64, bd::Encoding::float32, bd::Encoding::int16}) {
+    header.encoding = encoding;
+    {
+      bd::TrajectoryWriter writer(path, header);
+      for (int k = 0; k < 20; ++k) {
+        writer.write(10 * k, frames[k]);
+      }
+      CHECK_THROWS(writer.write(200, bd::BoidArrays{}));
+      writer.close();
+      CHECK(writer.frames() == 20);
+    }
+
+    bd::TrajectoryReader reader(path);
+    CHECK(reader.header().encoding == encoding);
+    CHECK(reader.header().n == 300);
+    CHECK(reader.header().seed == 42);
+    CHECK(reader.header().seedKnown);
+    CHECK(reader.header().world.height == 480);
+    CHECK(reader.header().par.c == .3);
+    CHECK(reader.header().maxspeed == 100);
+    CHECK(reader.frames() == 20);
+
+    // tolerance of the encoding: exact, float rounding, half a unit
+    double position = encoding == bd::Encoding::float64   ? 0.
+                      : encoding == bd::Encoding::float32 ? 1e-4
+                                                          : 640 / 32767. / 2;
+    double velocity = encoding == bd::Encoding::int16 ? 100 / 32767. / 2
+                                                      : position;
+    bd::BoidArrays read;
+    bool close = true;
+    for (int k : {13, 0, 19, 7}) {
+      CHECK(reader.tick(k) == 10 * k);
+      reader.read(k, read);
+      for (int i = 0; i < read.size(); ++i) {
+        close = close &&
+                std::abs(read.x[i] - frames[k].x[i]) <= position * 1.0001 &&
+                std::abs(read.y[i] - frames[k].y[i]) <= position * 1.0001 &&
+                std::abs(read.vx[i] - frames[k].vx[i]) <= velocity * 1.0001 &&
+                std::abs(read.vy[i] - frames[k].vy[i]) <= velocity * 1.0001;
+      }
+    }
+    CHECK(close);
+    CHECK_THROWS(reader.read(20, read));
+  }
+
+  SUBCASE("A frame cut short is ignored") {
+    {
+      std::ofstream out(path, std::ios::binary | std::ios::app);
+      out << "half a frame";
+    }
+    bd::TrajectoryReader reader(path);
+    CHECK(reader.frames() == 20);
+  }
+
+  SUBCASE("Not a trajectory") {
+    {
+      std::ofstream out(path, std::ios::binary | std::ios::trunc);
+      out << std::string(200, 'x');
+    }
+    CHECK_THROWS(bd::TrajectoryReader(path));
+    CHECK_THROWS(bd::TrajectoryReader("no such file"));
+    CHECK_THROWS(bd::encodingFromName("int8"));
+  }
+
+  SUBCASE("The boundary of the world is in the header") {
+    header.world = {640, 480, bd::Boundary::reflective, 30, 0.1};
+    {
+      bd::TrajectoryWriter writer(path, header);
+      writer.write(0, frames[0]);
+    }
+    {
+      bd::TrajectoryReader reader(path);
+      CHECK(reader.header().world.boundary == bd::Boundary::reflective);
+      CHECK(reader.header().world.margin == 30);
+      CHECK(reader.header().world.turn == 0.1);
+      CHECK(reader.header().world.width == 640);
+    }
+
+    // a file of version 1 knows no boundary: its world was periodic
+    {
+      std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+      file.seekp(8);
+      std::uint32_t old = 1;
+      file.write(reinterpret_cast<const char*>(&old), sizeof old);
+    }
+    {
+      bd::TrajectoryReader reader(path);
+      CHECK(reader.header().world.boundary == bd::Boundary::periodic);
+      CHECK(reader.frames() == 1);
+    }
+
+    {
+      std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+      file.seekp(8);
+      std::uint32_t newer = 3;
+      file.write(reinterpret_cast<const char*>(&newer), sizeof newer);
+    }
+    CHECK_THROWS(bd::TrajectoryReader(path));
+  }
+
+  SUBCASE("A resumed run says its seed is unknown") {
+    header.seedKnown = false;
+    {
+      bd::TrajectoryWriter writer(path, header);
+      writer.write(0, frames[0]);
+    }
+    bd::TrajectoryReader reader(path);
+    CHECK_FALSE(reader.header().seedKnown);
+    CHECK(reader.header().seed == 42);
+  }
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE("Testing the checkpoints") {
+  bd::Flock flock;
+  flock.setWorld({500, 400});
+  std::default_random_engine eng(21);
+  std::uniform_real_distribution<double> xDist(0, 400);
+  std::uniform_real_distribution<double> vDist(-20, 20);
+  for (int i = 0; i < 300; ++i) {
+    bd::Parameters par{40. + i % 3, 8, .05, .04, .03};
+    flock.addBoid(bd::Boid({xDist(eng), xDist(eng)}, {vDist(eng), vDist(eng)},
+                           par, 50. + i % 7));
+  }
+  for (int t = 0; t < 5; ++t) {
+    flock.updateFlock(0.05);
+  }
+
+  bd::FlockState state = flock.state();
+  state.tick = 5;
+  std::ostringstream engine;
+  engine << eng;
+  state.rng = engine.str();
+  std::stringstream file;
+  bd::saveState(state, file);
+  std::string bytes = file.str();
+
+  SUBCASE("A restored flock goes on bit for bit") {
+    bd::FlockState loaded = bd::loadState(file);
+    CHECK(loaded.tick == 5);
+    CHECK(loaded.world.width == 500);
+    CHECK(loaded.par[2].d == 42);
+    CHECK(loaded.maxspeed[6] == 56);
+
+    std::default_random_engine restoredEngine;
+    std::istringstream(loaded.rng) >> restoredEngine;
+    CHECK(restoredEngine() == eng());
+
+    bd::Flock restored;
+    restored.restore(loaded);
+    for (int t = 0; t < 20; ++t) {
+      flock.updateFlock(0.05);
+      restored.updateFlock(0.05);
+    }
+    CHECK(restored.arrays().x == flock.arrays().x);
+    CHECK(restored.arrays().vy == flock.arrays().vy);
+  }
+
+  SUBCASE("The update mode is part of the state") {
+    flock.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    bd::Flock restored;
+    restored.restore(flock.state());
+    CHECK(restored.updateMode() == bd::UpdateMode::doubleBuffered);
+  }
+
+  SUBCASE("Damaged and short files are refused") {
+    std::string damaged = bytes;
+    damaged[200] ^= 1;
+    std::istringstream in1(damaged);
+    CHECK_THROWS(bd::loadState(in1));
+    std::istringstream in2(bytes.substr(0, bytes.size() - 100));
+    CHECK_THROWS(bd::loadState(in2));
+    std::istringstream in3("not a checkpoint at all");
+    CHECK_THROWS(bd::loadState(in3));
+  }
+
+  SUBCASE("Checkpoints are saved in the background") {
+    const std::string path = "boid.test.ckpt";
+    long expected = -1;
+    {
+      bd::Checkpointer checkpointer(path, 4);
+      long saved = 0;
+      // the caller counts from 101, the flock from where it is
+      for (long t = 101; t <= 110; ++t) {
+        flock.updateFlock(0.05);
+        if (checkpointer.tick(flock, t, "engine")) {
+          ++saved;
+          expected = flock.tick();
+        }
+      }
+      CHECK(saved == 2);
+      checkpointer.flush();
+      CHECK(checkpointer.saved() >= 1);
+    }
+    bd::FlockState last = bd::loadState(path);
+    CHECK(last.tick == expected);
+    CHECK(last.rng == "engine");
+    CHECK(last.boids.size() == 300);
+    std::remove(path.c_str());
+    CHECK_THROWS(bd::Checkpointer(path, 0));
+  }
+}
+
+TEST_CASE("Testing the flock in float") {
+  // the same boids in both precisions, all of them exact in float
+  std::default_random_engine eng(17);
+  std::uniform_real_distribution<float> xDist(0, 1280);
+  std::uniform_real_distribution<float> yDist(0, 720);
+  std::uniform_real_distribution<float> vDist(-100, 100);
+  bd::Parameters par{50.0, 10.0, 0.05, 0.05, 0.05};
+  bd::Flock flock;
+  bd::FlockF flockF;
+  for (int i = 0; i < 500; ++i) {
+    bd::Vec2<float> position{xDist(eng), yDist(eng)};
+    bd::Vec2<float> velocity{vDist(eng), vDist(eng)};
+    flock.addBoid(bd::Boid(bd::Vec2<double>(position),
+                           bd::Vec2<double>(velocity), par, 200));
+    flockF.addBoid(bd::BoidF(position, velocity, par, 200));
+  }
+
+  SUBCASE("Every float kernel matches the double one") {
+    // packed as in the kernel test above, so that every range has neighbors
+    std::uniform_real_distribution<float> pDist(0, 60);
+    bd::BoidArrays boids;
+    bd::BoidArraysF boidsF;
+    for (int i = 0; i < 64; ++i) {
+      bd::Vec2<float> position{pDist(eng), pDist(eng)};
+      bd::Vec2<float> velocity{vDist(eng), vDist(eng)};
+      boids.push_back(bd::Vec2<double>(position), bd::Vec2<double>(velocity));
+      boidsF.push_back(position, velocity);
+    }
+    bd::Parameters near{25.0, 10.0, 0.5, 0.5, 0.5};
+    for (bd::Simd level : {bd::Simd::scalar, bd::Simd::sse2, bd::Simd::avx2,
+                           bd::Simd::avx512}) {
+      if (!bd::simdSupported(level)) {
+        continue;
+      }
+      // lengths up to 39 cover the tails of the 16 lanes of AVX-512
+      for (int begin = 0; begin < 3; ++begin) {
+        for (int end = begin; end < begin + 40; ++end) {
+          bd::SteeringSums sums;
+          bd::SteeringSumsF sumsF;
+          bd::steeringSums(bd::Simd::scalar, sums, {30., 30.}, {.5, -.5}, near,
+                           boids, begin, end);
+          bd::steeringSums(level, sumsF, {30.f, 30.f}, {.5f, -.5f}, near,
+                           boidsF, begin, end);
+          CHECK(sumsF.neighbors == sums.neighbors);
+          // the terms are below 200, and at most 40 of them are added
+          CHECK(std::abs(sumsF.displacements.x - sums.displacements.x) < 1e-3);
+          CHECK(std::abs(sumsF.displacements.y - sums.displacements.y) < 1e-3);
+          CHECK(std::abs(sumsF.velocities.x - sums.velocities.x) < 1e-3);
+          CHECK(std::abs(sumsF.velocities.y - sums.velocities.y) < 1e-3);
+          CHECK(std::abs(sumsF.positions.x - sums.positions.x) < 1e-3);
+          CHECK(std::abs(sumsF.positions.y - sums.positions.y) < 1e-3);
+        }
+      }
+    }
+  }
+
+  SUBCASE("A tick in float stays close to the one in double") {
+    flock.updateFlock(1. / 60.);
+    flockF.updateFlock(1. / 60.);
+    int far = 0;
+    for (int i = 0; i < flock.size(); ++i) {
+      bd::Vec2<double> p = flock.getBoid(i).getPosition();
+      bd::Vec2<double> pF(flockF.getBoid(i).getPosition());
+      bd::Vec2<double> v = flock.getBoid(i).getVelocity();
+      bd::Vec2<double> vF(flockF.getBoid(i).getVelocity());
+      // float keeps about 7 significant digits of a position up to 1280
+      far += bd::distance(p, pF) > 1e-3 || bd::distance(v, vF) > 1e-3;
+    }
+    CHECK(far == 0);
+  }
+
+  SUBCASE("The statistics of a run in float match the ones in double") {
+    for (int t = 0; t < 100; ++t) {
+      flock.updateFlock(1. / 60.);
+      flockF.updateFlock(1. / 60.);
+    }
+    // the two runs drift apart boid by boid, but not on average
+    bd::Statistics speed = flock.average_speed();
+    bd::Statistics speedF = flockF.average_speed();
+    CHECK(speedF.mean == doctest::Approx(speed.mean).epsilon(0.01));
+    bd::Statistics distance = flock.average_distance_blocked();
+    bd::Statistics distanceF = flockF.average_distance_blocked();
+    CHECK(distanceF.mean == doctest::Approx(distance.mean).epsilon(0.01));
+    CHECK(distanceF.sigma == doctest::Approx(distance.sigma).epsilon(0.01));
+    CHECK(flockF.statistics().last().neighbors.mean ==
+          doctest::Approx(flock.statistics().last().neighbors.mean)
+              .epsilon(0.05));
+  }
+
+  SUBCASE("A float flock is saved and restored without loss") {
+    flockF.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    std::stringstream file;
+    bd::saveState(flockF.state(), file);
+    bd::FlockF restored;
+    restored.restore(bd::loadState(file));
+    for (int t = 0; t < 10; ++t) {
+      flockF.updateFlock(1. / 60.);
+      restored.updateFlock(1. / 60.);
+    }
+    CHECK(restored.arrays().x == flockF.arrays().x);
+    CHECK(restored.arrays().vy == flockF.arrays().vy);
+  }
+}
+
+TEST_CASE("Testing the steering rules") {
+  std::default_random_engine eng(23);
+  std::uniform_real_distribution<double> xDist(0, 300);
+  std::uniform_real_distribution<double> vDist(-20, 20);
+  bd::Parameters par{40.0, 10.0, 0.1, 0.08, 0.06};
+  bd::Flock flock;
+  flock.setWorld({300, 300});
+  for (int i = 0; i < 200; ++i) {
+    flock.addBoid(bd::Boid({xDist(eng), xDist(eng)}, {vDist(eng), vDist(eng)},
+                           par, 60));
+  }
+
+  SUBCASE("The default rules are Boid::steering") {
+    const bd::BoidArrays& boids = flock.arrays();
+    for (int i = 0; i < flock.size(); i += 7) {
+      bd::Boid boid = flock.getBoid(i);
+      bd::SteeringSums sums;
+      bd::steeringSums(sums, boid.getPosition(), boid.getVelocity(), par,
+                       boids, 0, boids.size());
+      bd::Vec2<double> steer =
+          bd::DefaultRules::steer(boid, sums, {flock.size(), i, i, 0});
+      bd::Vec2<double> expected = boid.steering(sums, flock.size());
+      CHECK(steer.x == expected.x);
+      CHECK(steer.y == expected.y);
+    }
+    bd::Flock ruled = flock;
+    ruled.setRules<bd::Separation, bd::Alignment, bd::Cohesion>();
+    for (int t = 0; t < 5; ++t) {
+      flock.updateFlock(0.05);
+      ruled.updateFlock(0.05);
+    }
+    CHECK(ruled.arrays().x == flock.arrays().x);
+    CHECK(ruled.arrays().vy == flock.arrays().vy);
+  }
+
+  SUBCASE("A rule left out is the same as its parameter at 0") {
+    bd::Flock zero = flock;
+    zero.setParameters({40.0, 10.0, 0., 0., 0.06});
+    bd::RuleFlock<bd::Cohesion> cohesion;
+    cohesion.restore(zero.state());
+    for (int t = 0; t < 5; ++t) {
+      zero.updateFlock(0.05);
+      cohesion.updateFlock(0.05);
+    }
+    CHECK(cohesion.arrays().x == zero.arrays().x);
+    CHECK(cohesion.arrays().vy == zero.arrays().vy);
+    // the neighbors are still counted for the statistics
+    CHECK(cohesion.statistics().last().neighbors.mean ==
+          zero.statistics().last().neighbors.mean);
+  }
+
+  SUBCASE("Kernels only gather the terms asked for") {
+    const bd::BoidArrays& boids = flock.arrays();
+    bd::Vec2<double> position{150., 150.};
+    bd::Vec2<double> velocity{1., -1.};
+    for (bd::Simd level : {bd::Simd::scalar, bd::Simd::sse2, bd::Simd::avx2,
+                           bd::Simd::avx512}) {
+      if (!bd::simdSupported(level)) {
+        continue;
+      }
+      bd::SteeringSums all;
+      bd::steeringSums(level, all, position, velocity, par, boids, 3, 180);
+      for (unsigned terms = 0; terms <= bd::allTerms; ++terms) {
+        bd::SteeringSums sums;
+        bd::steeringSums(level, sums, position, velocity, par, boids, 3, 180,
+                         terms);
+        bool d = terms & bd::displacementsTerm;
+        bool v = terms & bd::velocitiesTerm;
+        bool p = terms & bd::positionsTerm;
+        bool n = terms & bd::neighborsTerm;
+        CHECK(sums.displacements.x == (d ? all.displacements.x : 0.));
+        CHECK(sums.displacements.y == (d ? all.displacements.y : 0.));
+        CHECK(sums.velocities.x == (v ? all.velocities.x : 0.));
+        CHECK(sums.velocities.y == (v ? all.velocities.y : 0.));
+        CHECK(sums.positions.x == (p ? all.positions.x : 0.));
+        CHECK(sums.positions.y == (p ? all.positions.y : 0.));
+        CHECK(sums.neighbors == (n ? all.neighbors : 0));
+      }
+    }
+  }
+
+  SUBCASE("Wander depends on the boid and the tick only") {
+    using Wandering = bd::Rules<bd::Separation, bd::Alignment, bd::Cohesion,
+                                bd::Wander>;
+    bd::Flock plain = flock;
+    bd::Flock inPlace = flock;
+    inPlace.setRules<bd::Separation, bd::Alignment, bd::Cohesion,
+                     bd::Wander>();
+    bd::RuleFlock<bd::Separation, bd::Alignment, bd::Cohesion, bd::Wander>
+        threaded;
+    threaded.restore(flock.state());
+    threaded.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    threaded.setThreads(3);
+    bd::Flock single = threaded;
+    single.setThreads(1);
+    long tick = flock.tick();
+    CHECK(Wandering::terms == bd::DefaultRules::terms);
+
+    for (int t = 0; t < 5; ++t) {
+      plain.updateFlock(0.05);
+      inPlace.updateFlock(0.05);
+      threaded.updateFlock(0.05);
+      single.updateFlock(0.05);
+    }
+    CHECK(inPlace.tick() == tick + 5);
+    CHECK(inPlace.arrays().x != plain.arrays().x);
+    CHECK(threaded.arrays().x == single.arrays().x);
+    CHECK(threaded.arrays().vy == single.arrays().vy);
+
+    // the tick is part of the state, so a restored flock wanders the same
+    bd::RuleFlock<bd::Separation, bd::Alignment, bd::Cohesion, bd::Wander>
+        restored;
+    restored.restore(inPlace.state());
+    CHECK(restored.tick() == tick + 5);
+    for (int t = 0; t < 5; ++t) {
+      inPlace.updateFlock(0.05);
+      restored.updateFlock(0.05);
+    }
+    CHECK(restored.arrays().x == inPlace.arrays().x);
+    CHECK(restored.arrays().vy == inPlace.arrays().vy);
+
+    // a push of at most strength * maxspeed per component
+    bd::Boid boid = flock.getBoid(0);
+    for (long t = 0; t < 100; ++t) {
+      bd::Vec2<double> push = bd::Wander::steer(boid, bd::SteeringSums{},
+                                                {flock.size(), 0, 0, t});
+      CHECK(std::abs(push.x) <= bd::Wander::strength * 60);
+      CHECK(std::abs(push.y) <= bd::Wander::strength * 60);
+    }
+  }
+
+  SUBCASE("No rules, no steering") {
+    bd::FlockState start = flock.state();
+    bd::RuleFlock<> still;
+    still.restore(start);
+    still.setCollectStatistics(false);
+    still.updateFlock(0.05);
+    // only the ones at maxspeed may be rounded again by the limit
+    int changed = 0;
+    for (int i = 0; i < still.size(); ++i) {
+      bd::Vec2<double> v0{start.boids.vx[i], start.boids.vy[i]};
+      changed += bd::distance(still.getBoid(i).getVelocity(), v0) > 1e-12;
+    }
+    CHECK(changed == 0);
+  }
+}
+
+TEST_CASE("Testing the parameter groups") {
+  SUBCASE("Parameters out of range throw") {
+    CHECK_NOTHROW(bd::checkParameters({10, 5, 1, 0, 0.5}));
+    CHECK_THROWS(bd::checkParameters({-1, 0, 0, 0, 0}));
+    CHECK_THROWS(bd::checkParameters({10, 10, 0, 0, 0}));
+    CHECK_THROWS(bd::checkParameters({10, 5, 1.5, 0, 0}));
+    CHECK_THROWS(bd::checkParameters({10, 5, 0, -0.1, 0}));
+    CHECK_THROWS(bd::checkParameters({10, 5, 0, 0, 2}));
+
+    bd::Boid boid;
+    boid.setPar({10, 5, 0.1, 0.2, 0.3});
+    CHECK_THROWS(boid.setPar_ds(12));
+    CHECK_THROWS(boid.setPar_a(3));
+    CHECK_THROWS(boid.setPar({10, 5, 0.1, 0.2, 3}));
+    // the parameters are left as they were
+    CHECK(boid.getPar().ds == 5);
+    CHECK(boid.getPar().a == 0.2);
+    CHECK(boid.getPar().c == 0.3);
+  }
+
+  bd::Flock flock;
+  for (int i = 0; i < 300; ++i) {
+    bd::Parameters par{40. + i % 3, 8, .05, .04, .03};
+    flock.addBoid(bd::Boid({i * 1., i * 2.}, {1., 0.}, par, 50. + i % 7));
+  }
+
+  SUBCASE("Boids with the same parameters share a group") {
+    CHECK(flock.groups() == 21);
+    CHECK(flock.getBoid(23).getPar().d == 42);
+    CHECK(flock.getBoid(23).getMaxspeed() == 52);
+    CHECK(flock.group(23) == flock.group(23 + 21));
+    CHECK(flock.group(23) != flock.group(24));
+  }
+
+  SUBCASE("A group changes all of its boids at once") {
+    int g = flock.group(5);
+    bd::Parameters par{30, 6, 0.5, 0.5, 0.5};
+    flock.setGroupPar(g, par);
+    flock.setGroupMaxspeed(g, 80);
+    for (int i = 0; i < flock.size(); ++i) {
+      bool in = flock.group(i) == g;
+      CHECK((flock.getBoid(i).getPar().d == 30) == in);
+      CHECK((flock.getBoid(i).getMaxspeed() == 80) == in);
+    }
+    CHECK_THROWS(flock.setGroupPar(g, {30, 40, 0.5, 0.5, 0.5}));
+    CHECK(flock.groupPar(g).ds == 6);
+    CHECK_THROWS(flock.setGroupMaxspeed(g, -1));
+    CHECK_THROWS(flock.setGroupMaxspeed(g, std::nan("")));
+    CHECK(flock.groupMaxspeed(g) == 80);
+
+    // groups that don't exist are refused, not written past the end
+    for (int other : {-1, flock.groups()}) {
+      CHECK_THROWS(flock.setGroupPar(other, par));
+      CHECK_THROWS(flock.setGroupMaxspeed(other, 80));
+    }
+    CHECK(flock.groups() == 21);
+  }
+
+  SUBCASE("A boid with its own parameters leaves its group") {
+    int g = flock.group(5);
+    double maxspeed = flock.getBoid(5).getMaxspeed();
+    flock.getBoid(5).setPar({35, 6, 0.5, 0.5, 0.5});
+    CHECK(flock.group(5) != g);
+    CHECK(flock.getBoid(5).getPar().d == 35);
+    CHECK(flock.getBoid(5).getMaxspeed() == maxspeed);
+    CHECK(flock.group(5 + 21) == g);
+    CHECK(flock.getBoid(5 + 21).getPar().d == flock.groupPar(g).d);
+    CHECK_THROWS(flock.getBoid(5).setPar({35, 60, 0.5, 0.5, 0.5}));
+    CHECK_THROWS(flock.getBoid(5).setMaxspeed(-10));
+    CHECK(flock.getBoid(5).getMaxspeed() == maxspeed);
+  }
+
+  SUBCASE("Boids added to a group") {
+    bd::Flock added;
+    int prey = added.addGroup({40, 8, 0.1, 0.1, 0.1}, 50);
+    int predators = added.addGroup({80, 8, 0.1, 0.1, 0.1}, 90);
+    CHECK_THROWS(added.addGroup({40, 80, 0.1, 0.1, 0.1}, 50));
+    CHECK_THROWS(added.addGroup({40, 8, 0.1, 0.1, 0.1}, -50));
+    added.addBoid({1., 2.}, {0., 1.}, predators);
+    added.addBoid({3., 4.}, {1., 0.}, prey);
+    CHECK_THROWS(added.addBoid({3., 4.}, {1., 0.}, 2));
+    CHECK(added.getBoid(0).getMaxspeed() == 90);
+    CHECK(added.getBoid(1).getPar().d == 40);
+    added.setGroup(1, predators);
+    CHECK(added.getBoid(1).getPar().d == 80);
+    added.setParameters({20, 5, 0.2, 0.2, 0.2});
+    CHECK(added.groupPar(prey).d == 20);
+    CHECK(added.getBoid(0).getMaxspeed() == 90);
+  }
+
+  SUBCASE("The groups are rebuilt on restore") {
+    bd::FlockState state = flock.state();
+    CHECK(static_cast<int>(state.par.size()) == flock.groups());
+    CHECK(state.par[state.group[23]].d == 42);
+    CHECK(state.maxspeed[state.group[23]] == 52);
+    bd::Flock restored;
+    restored.restore(state);
+    CHECK(restored.groups() == flock.groups());
+    CHECK(restored.getBoid(23).getPar().d == 42);
+
+    // or from one entry per boid, as in the checkpoints of version 1
+    bd::FlockState perBoid = state;
+    perBoid.group.clear();
+    perBoid.par.clear();
+    perBoid.maxspeed.clear();
+    for (int i = 0; i < flock.size(); ++i) {
+      perBoid.par.push_back(state.par[state.group[i]]);
+      perBoid.maxspeed.push_back(state.maxspeed[state.group[i]]);
+    }
+    bd::Flock regrouped;
+    regrouped.restore(perBoid);
+    // groups left with no boids are not made again
+    CHECK(regrouped.groups() <= flock.groups());
+    CHECK(regrouped.getBoid(23).getPar().d == 42);
+    CHECK(regrouped.getBoid(23).getMaxspeed() == 52);
+
+    state.par[7].ds = 100;
+    CHECK_THROWS(restored.restore(state));
+  }
+}
+
+TEST_CASE("Testing the species") {
+  std::default_random_engine eng(29);
+  std::uniform_real_distribution<double> xDist(0, 400);
+  std::uniform_real_distribution<double> vDist(-20, 20);
+  bd::Flock flock;
+  flock.setWorld({400, 400});
+  int prey = flock.addGroup({40, 10, 0.1, 0.08, 0.06}, 60);
+  int predators = flock.addGroup({60, 10, 0.05, 0.05, 0.1}, 90);
+  for (int i = 0; i < 300; ++i) {
+    flock.addBoid({xDist(eng), xDist(eng)}, {vDist(eng), vDist(eng)},
+                  i % 10 == 0 ? predators : prey);
+  }
+
+  SUBCASE("Weights of 1 change nothing") {
+    bd::Flock ones = flock;
+    ones.setInteraction(prey, predators, {1, 1, 1});
+    CHECK(ones.interaction(prey, predators).c == 1);
+    // a third group, with no boids, has the grid split by group
+    bd::Flock split = flock;
+    int empty = split.addGroup({40, 10, 0.1, 0.08, 0.06}, 60);
+    split.setInteraction(empty, empty, {0, 0, 0});
+    for (int t = 0; t < 3; ++t) {
+      flock.updateFlock(0.05);
+      ones.updateFlock(0.05);
+      split.updateFlock(0.05);
+    }
+    CHECK(ones.grid().layers() == 1);
+    CHECK(split.grid().layers() == 3);
+    CHECK(ones.arrays().x == flock.arrays().x);
+    for (int i = 0; i < flock.size(); ++i) {
+      // the same sums, added up in another order
+      CHECK(split.arrays().x[i] == doctest::Approx(flock.arrays().x[i]));
+      CHECK(split.arrays().vy[i] == doctest::Approx(flock.arrays().vy[i]));
+    }
+    CHECK(split.statistics().last().neighbors.mean ==
+          flock.statistics().last().neighbors.mean);
+  }
+
+  SUBCASE("Groups with weights 0 ignore each other") {
+    // separation only, which does not depend on the size of the flock
+    bd::RuleFlock<bd::Separation> mixed;
+    mixed.restore(flock.state());
+    mixed.setInteraction(prey, predators, {0, 0, 0});
+    mixed.setInteraction(predators, prey, {0, 0, 0});
+    bd::RuleFlock<bd::Separation> alone;
+    std::vector<int> preyIndex;
+    for (int i = 0; i < flock.size(); ++i) {
+      if (flock.group(i) == prey) {
+        preyIndex.push_back(i);
+        alone.addBoid(flock.getBoid(i));
+      }
+    }
+    alone.setWorld(flock.world());
+    for (int t = 0; t < 5; ++t) {
+      mixed.updateFlock(0.05);
+      alone.updateFlock(0.05);
+    }
+    int differ = 0;
+    for (int k = 0; k < alone.size(); ++k) {
+      int i = preyIndex[k];
+      differ += mixed.arrays().x[i] != alone.arrays().x[k] ||
+                mixed.arrays().vy[i] != alone.arrays().vy[k];
+    }
+    CHECK(differ == 0);
+    // only the boids of the own group are neighbors
+    CHECK(mixed.statistics().last().neighbors.mean <
+          flock.statistics().last().neighbors.mean);
+  }
+
+  SUBCASE("The grid matches the brute-force update with weights") {
+    bd::Flock grid = flock;
+    grid.setInteraction(prey, predators, {2, 0, -1});
+    grid.setInteraction(predators, prey, {0, 0.5, 3});
+    grid.setInteraction(predators, predators, {0, 0, 0});
+    bd::Flock brute = grid;
+    grid.updateFlock(0.05);
+    brute.updateFlockBruteForce(0.05);
+    for (int i = 0; i < flock.size(); ++i) {
+      CHECK(grid.arrays().x[i] == doctest::Approx(brute.arrays().x[i]));
+      CHECK(grid.arrays().y[i] == doctest::Approx(brute.arrays().y[i]));
+      CHECK(grid.arrays().vx[i] == doctest::Approx(brute.arrays().vx[i]));
+      CHECK(grid.arrays().vy[i] == doctest::Approx(brute.arrays().vy[i]));
+    }
+
+    // and the same in double buffered mode, whatever the threads
+    bd::Flock threaded = flock;
+    threaded.setInteraction(prey, predators, {2, 0, -1});
+    threaded.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    bd::Flock single = threaded;
+    threaded.setThreads(3);
+    for (int t = 0; t < 3; ++t) {
+      threaded.updateFlock(0.05);
+      single.updateFlock(0.05);
+    }
+    CHECK(threaded.arrays().x == single.arrays().x);
+    CHECK(threaded.arrays().vy == single.arrays().vy);
+  }
+
+  SUBCASE("Weights are checked and saved") {
+    CHECK_THROWS(flock.setInteraction(prey, 2, {1, 1, 1}));
+    CHECK_THROWS(flock.setInteraction(-1, prey, {1, 1, 1}));
+    CHECK_THROWS(
+        flock.setInteraction(prey, prey, {1, std::nan(""), 1}));
+    flock.setInteraction(predators, prey, {0, 0.5, 3});
+    // a group added afterwards weighs 1 with the others
+    int third = flock.addGroup({40, 10, 0.1, 0.08, 0.06}, 60);
+    CHECK(flock.interaction(third, prey).s == 1);
+    CHECK(flock.interaction(predators, prey).c == 3);
+
+    std::stringstream file;
+    bd::saveState(flock.state(), file);
+    bd::FlockState loaded = bd::loadState(file);
+    CHECK(loaded.interactions.size() == 9);
+    CHECK(loaded.group.size() == 300);
+    bd::Flock restored;
+    restored.restore(loaded);
+    CHECK(restored.groups() == 3);
+    CHECK(restored.interaction(predators, prey).a == 0.5);
+    for (int t = 0; t < 5; ++t) {
+      flock.updateFlock(0.05);
+      restored.updateFlock(0.05);
+    }
+    CHECK(restored.arrays().x == flock.arrays().x);
+    CHECK(restored.arrays().vy == flock.arrays().vy);
+
+    // back to the plain grid when all the weights are 1 again
+    flock.setInteraction(predators, prey, {1, 1, 1});
+    flock.updateFlock(0.05);
+    CHECK(flock.grid().layers() == 1);
+  }
+}
+
+TEST_CASE("Testing the world boundaries") {
+  bd::Parameters par{50, 20, 0.1, 0.1, 0.1};
+  bd::World torus{400, 300};
+  bd::World walls{400, 300, bd::Boundary::reflective};
+
+  SUBCASE("Boids see each other across the edges of a periodic world") {
+    bd::BoidArrays boids;
+    boids.push_back({5, 150}, {1, 0});
+    boids.push_back({395, 150}, {0, 1});
+    boids.push_back({200, 295}, {0, 0});
+    boids.push_back({200, 5}, {0, 0});
+    bd::SteeringSums sums;
+    bd::steeringSums(sums, {5, 150}, {1, 0}, par, boids, 0, 4, bd::allTerms,
+                     &torus);
+    CHECK(sums.neighbors == 2);
+    CHECK(sums.displacements.x == doctest::Approx(-10));
+    // the image of the other boid, at -5
+    CHECK(sums.positions.x == doctest::Approx(0));
+    CHECK(sums.velocities.y == doctest::Approx(1));
+
+    bd::SteeringSums plain;
+    bd::steeringSums(plain, {5, 150}, {1, 0}, par, boids, 0, 4);
+    CHECK(plain.neighbors == 1);
+    bd::SteeringSums walled;
+    bd::steeringSums(walled, {5, 150}, {1, 0}, par, boids, 0, 4,
+                     bd::allTerms, &walls);
+    CHECK(walled.neighbors == 1);
+
+    bd::SteeringSums vertical;
+    bd::steeringSums(vertical, {200, 295}, {0, 0}, par, boids, 0, 4,
+                     bd::allTerms, &torus);
+    CHECK(vertical.neighbors == 2);
+    CHECK(vertical.displacements.y == doctest::Approx(10));
+    CHECK(vertical.positions.y == doctest::Approx(2 * 295 + 10));
+  }
+
+  SUBCASE("All the kernels take the minimum image") {
+    std::default_random_engine eng(3);
+    std::uniform_real_distribution<double> xDist(0, 400);
+    std::uniform_real_distribution<double> yDist(0, 300);
+    bd::BoidArrays boids;
+    bd::BoidArraysF boidsF;
+    for (int i = 0; i < 203; ++i) {
+      // as many boids near the edges as inside
+      double x = i % 2 ? xDist(eng) : std::fmod(xDist(eng), 60) + 370;
+      double y = i % 2 ? yDist(eng) : std::fmod(yDist(eng), 60) - 30;
+      y += y < 0 ? 300 : 0;
+      x -= x > 400 ? 400 : 0;
+      boids.push_back({x, y}, {x / 100, -y / 100});
+      boidsF.push_back({float(x), float(y)}, {float(x / 100), float(-y / 100)});
+    }
+    bd::SteeringSums scalar;
+    bd::SteeringSumsF scalarF;
+    bd::steeringSums(bd::Simd::scalar, scalar, {398., 2.}, {1., 1.}, par,
+                     boids, 0, 203, bd::allTerms, &torus);
+    bd::steeringSums(bd::Simd::scalar, scalarF, {398.f, 2.f}, {1.f, 1.f}, par,
+                     boidsF, 0, 203, bd::allTerms, &torus);
+    CHECK(scalar.neighbors > 10);
+    CHECK(scalarF.neighbors == scalar.neighbors);
+    for (bd::Simd level :
+         {bd::Simd::sse2, bd::Simd::avx2, bd::Simd::avx512}) {
+      if (!bd::simdSupported(level)) {
+        continue;
+      }
+      bd::SteeringSums sums;
+      bd::steeringSums(level, sums, {398., 2.}, {1., 1.}, par, boids, 0, 203,
+                       bd::allTerms, &torus);
+      CHECK(sums.neighbors == scalar.neighbors);
+      CHECK(sums.displacements.x == doctest::Approx(scalar.displacements.x));
+      CHECK(sums.displacements.y == doctest::Approx(scalar.displacements.y));
+      CHECK(sums.positions.x == doctest::Approx(scalar.positions.x));
+      CHECK(sums.positions.y == doctest::Approx(scalar.positions.y));
+      CHECK(sums.velocities.x == doctest::Approx(scalar.velocities.x));
+      bd::SteeringSumsF sumsF;
+      bd::steeringSums(level, sumsF, {398.f, 2.f}, {1.f, 1.f}, par, boidsF, 0,
+                       203, bd::allTerms, &torus);
+      CHECK(sumsF.neighbors == scalarF.neighbors);
+      CHECK(sumsF.positions.x ==
+            doctest::Approx(scalarF.positions.x).epsilon(1e-5));
+      CHECK(sumsF.displacements.y ==
+            doctest::Approx(scalarF.displacements.y).epsilon(1e-5));
+    }
+  }
+
+  SUBCASE("Reflective and open edges") {
+    bd::Boid boid({395, 10}, {20, -30}, par, 100);
+    boid.updatePosition(1);
+    boid.borders(walls);
+    CHECK(boid.getPosition().x == doctest::Approx(385));
+    CHECK(boid.getPosition().y == doctest::Approx(20));
+    CHECK(boid.getVelocity().x == doctest::Approx(-20));
+    CHECK(boid.getVelocity().y == doctest::Approx(30));
+
+    bd::World open{400, 300, bd::Boundary::open, 50, 0.05};
+    bd::Boid inside({200, 150}, {0, 0}, par, 100);
+    inside.borders(open);
+    CHECK(inside.getVelocity().x == 0);
+    bd::Boid near({10, 280}, {0, 0}, par, 100);
+    near.borders(open);
+    CHECK(near.getVelocity().x == doctest::Approx(5));
+    CHECK(near.getVelocity().y == doctest::Approx(-5));
+    bd::Boid out({-100, 150}, {-10, 0}, par, 100);
+    out.borders(open);
+    CHECK(out.getPosition().x == -100);
+    CHECK(out.getVelocity().x == doctest::Approx(-5));
+  }
+
+  SUBCASE("The cut grid does not wrap") {
+    bd::Grid grid(100, 50, false);
+    bd::BoidArrays boids;
+    boids.push_back({1, 1}, {0, 0});
+    boids.push_back({99, 49}, {0, 0});
+    boids.push_back({15, 15}, {0, 0});
+    grid.build(boids, 10);
+    CHECK_FALSE(grid.periodic());
+    bd::Grid::Spans spans;
+    int n = grid.neighbors(1, 1, spans);
+    CHECK(n == 2);
+    int count = 0;
+    for (int k = 0; k < n; ++k) {
+      count += spans[k].end - spans[k].begin;
+    }
+    CHECK(count == 2);
+  }
+
+  SUBCASE("The grid matches the brute-force update in every world") {
+    std::default_random_engine eng(31);
+    std::uniform_real_distribution<double> xDist(0, 400);
+    std::uniform_real_distribution<double> yDist(0, 300);
+    std::uniform_real_distribution<double> vDist(-30, 30);
+    bd::Flock flock;
+    for (int i = 0; i < 400; ++i) {
+      flock.addBoid(bd::Boid({xDist(eng), yDist(eng)},
+                             {vDist(eng), vDist(eng)}, par, 60));
+    }
+    for (bd::Boundary boundary : {bd::Boundary::periodic,
+                                  bd::Boundary::reflective,
+                                  bd::Boundary::open}) {
+      bd::Flock grid = flock;
+      grid.setWorld({400, 300, boundary});
+      bd::Flock brute = grid;
+      // in place, with steps long enough that boids moved into reach from
+      // cells out of the 3x3 block they started in
+      for (int t = 0; t < 5; ++t) {
+        grid.updateFlock(0.2);
+        brute.updateFlockBruteForce(0.2);
+      }
+      int differ = 0;
+      for (int i = 0; i < flock.size(); ++i) {
+        differ += !(grid.arrays().x[i] == doctest::Approx(brute.arrays().x[i]) &&
+                    grid.arrays().vy[i] == doctest::Approx(brute.arrays().vy[i]));
+      }
+      CHECK(differ == 0);
+    }
+  }
+
+  SUBCASE("The world is checked and saved") {
+    CHECK(bd::boundaryFromName("open") == bd::Boundary::open);
+    CHECK(std::string{bd::boundaryName(bd::Boundary::reflective)} ==
+          "reflective");
+    CHECK_THROWS(bd::boundaryFromName("sphere"));
+    bd::Flock flock;
+    CHECK_THROWS(flock.setWorld({400, 300, bd::Boundary::open, -1}));
+    flock.setWorld({400, 300, bd::Boundary::open, 30, 0.1});
+    CHECK_FALSE(flock.grid().periodic());
+    flock.addBoid(bd::Boid({10, 10}, {1, 1}, par, 60));
+    flock.addBoid(bd::Boid({20, 10}, {1, 1}, par, 60));
+
+    std::stringstream file;
+    bd::saveState(flock.state(), file);
+    bd::Flock restored;
+    restored.restore(bd::loadState(file));
+    CHECK(restored.world().boundary == bd::Boundary::open);
+    CHECK(restored.world().margin == 30);
+    CHECK(restored.world().turn == 0.1);
+    CHECK_FALSE(restored.grid().periodic());
+  }
+}
+
+TEST_CASE("Testing the Verlet lists") {
+  std::default_random_engine eng(37);
+  std::uniform_real_distribution<double> xDist(0, 400);
+  std::uniform_real_distribution<double> yDist(0, 300);
+  std::uniform_real_distribution<double> vDist(-30, 30);
+  bd::Parameters par{40, 10, 0.1, 0.1, 0.1};
+  bd::Flock flock;
+  flock.setWorld({400, 300});
+  for (int i = 0; i < 400; ++i) {
+    flock.addBoid(bd::Boid({xDist(eng), yDist(eng)},
+                           {vDist(eng), vDist(eng)}, par, 60));
+  }
+
+  SUBCASE("The lists give the sums of the grid") {
+    bd::Flock grid = flock;
+    grid.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    bd::Flock lists = grid;
+    lists.setSkin(20);
+    lists.setThreads(3);
+    grid.updateFlock(0.05);
+    lists.updateFlock(0.05);
+    // the same neighbors, before the sums drift apart by rounding
+    CHECK(lists.statistics().last().neighbors.mean ==
+          grid.statistics().last().neighbors.mean);
+    for (int t = 1; t < 10; ++t) {
+      grid.updateFlock(0.05);
+      lists.updateFlock(0.05);
+    }
+    int differ = 0;
+    for (int i = 0; i < flock.size(); ++i) {
+      differ += !(lists.arrays().x[i] == doctest::Approx(grid.arrays().x[i]) &&
+                  lists.arrays().vy[i] == doctest::Approx(grid.arrays().vy[i]));
+    }
+    CHECK(differ == 0);
+    // at most 3 px a tick, against 10 px of half skin
+    CHECK(lists.verletLists().ticks() == 10);
+    CHECK(lists.verletLists().builds() < 10);
+    CHECK(lists.verletLists().buildRate() < 1);
+    CHECK(lists.verletLists().candidatesPerBoid() >
+          lists.statistics().last().neighbors.mean + 1);
+    CHECK(lists.verletLists().bytesPerBoid() >=
+          lists.verletLists().runsPerBoid() * sizeof(bd::Range));
+  }
+
+  SUBCASE("In place, the lists give the brute-force update") {
+    // unlike the grid, which misses the boids that moved in from a cell
+    // out of reach during the tick
+    bd::Flock lists = flock;
+    lists.setSkin(40);
+    bd::Flock brute = flock;
+    for (int t = 0; t < 5; ++t) {
+      lists.updateFlock(0.05);
+      brute.updateFlockBruteForce(0.05);
+    }
+    int differ = 0;
+    for (int i = 0; i < flock.size(); ++i) {
+      const auto& l = lists.arrays();
+      const auto& b = brute.arrays();
+      differ += !(l.x[i] == doctest::Approx(b.x[i]) &&
+                  l.vy[i] == doctest::Approx(b.vy[i]));
+    }
+    CHECK(differ == 0);
+    // a step at maxspeed is 3 px, taken off the half skin
+    CHECK(lists.verletLists().builds() < 5);
+  }
+
+  SUBCASE("The lists follow the groups and their weights") {
+    bd::Flock grid = flock;
+    grid.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    int other = grid.addGroup({60, 10, 0.05, 0.05, 0.1}, 90);
+    for (int i = 0; i < grid.size(); i += 7) {
+      grid.setGroup(i, other);
+    }
+    grid.setInteraction(0, other, {2, 0, -1});
+    grid.setInteraction(other, other, {0, 0, 0});
+    bd::Flock lists = grid;
+    lists.setSkin(20);
+    for (int t = 0; t < 5; ++t) {
+      grid.updateFlock(0.05);
+      lists.updateFlock(0.05);
+    }
+    int differ = 0;
+    for (int i = 0; i < flock.size(); ++i) {
+      differ += !(lists.arrays().x[i] == doctest::Approx(grid.arrays().x[i]) &&
+                  lists.arrays().vx[i] == doctest::Approx(grid.arrays().vx[i]));
+    }
+    CHECK(differ == 0);
+  }
+
+  SUBCASE("The lists are built again when needed") {
+    bd::Flock lists = flock;
+    lists.setSkin(20);
+    lists.updateFlock(0.01);
+    lists.updateFlock(0.01);
+    long builds = lists.verletLists().builds();
+    CHECK(builds == 1);
+    // a boid moved by hand, a larger d, a new boid
+    lists.getBoid(3).setPosition({200, 150});
+    lists.updateFlock(0.01);
+    CHECK(lists.verletLists().builds() == ++builds);
+    lists.setGroupPar(0, {45, 10, 0.1, 0.1, 0.1});
+    lists.updateFlock(0.01);
+    CHECK(lists.verletLists().builds() == ++builds);
+    lists.addBoid(bd::Boid({10, 10}, {0, 0}, par, 60));
+    lists.updateFlock(0.01);
+    CHECK(lists.verletLists().builds() == ++builds);
+    lists.updateFlock(0.01);
+    CHECK(lists.verletLists().builds() == builds);
+
+    CHECK_THROWS(lists.setSkin(-1));
+    lists.setSkin(0);
+    lists.updateFlock(0.01);
+    CHECK(lists.verletLists().builds() == builds);
+  }
+
+  SUBCASE("A new world throws the lists away, a restore builds them again") {
+    bd::Flock lists = flock;
+    lists.setSkin(40);
+    bd::Flock brute = flock;
+    auto differ = [&] {
+      int count = 0;
+      for (int i = 0; i < flock.size(); ++i) {
+        const auto& l = lists.arrays();
+        const auto& b = brute.arrays();
+        count += !(l.x[i] == doctest::Approx(b.x[i]) &&
+                   l.vy[i] == doctest::Approx(b.vy[i]));
+      }
+      return count;
+    };
+    for (int t = 0; t < 3; ++t) {
+      lists.updateFlock(0.05);
+      brute.updateFlockBruteForce(0.05);
+    }
+    long builds = lists.verletLists().builds();
+    lists.restore(lists.state());
+    lists.updateFlock(0.05);
+    brute.updateFlockBruteForce(0.05);
+    CHECK(lists.verletLists().builds() == ++builds);
+    CHECK(differ() == 0);
+    // only the margin changes, the grid is made again all the same
+    bd::World world = lists.world();
+    world.margin += 10;
+    lists.setWorld(world);
+    brute.setWorld(world);
+    lists.updateFlock(0.05);
+    brute.updateFlockBruteForce(0.05);
+    CHECK(lists.verletLists().builds() == ++builds);
+    CHECK(differ() == 0);
+  }
+
+  SUBCASE("A restored flock runs as the one saved") {
+    // the lists are built from the saved positions, so the neighbors are
+    // searched on the same ticks and summed in the same order
+    for (auto mode :
+         {bd::UpdateMode::inPlace, bd::UpdateMode::doubleBuffered}) {
+      bd::Flock lists = flock;
+      lists.setUpdateMode(mode);
+      lists.setSkin(20);
+      for (int t = 0; t < 7; ++t) {
+        lists.updateFlock(0.05);
+      }
+      std::stringstream file;
+      bd::saveState(lists.state(), file);
+      bd::Flock restored;
+      restored.restore(bd::loadState(file));
+      CHECK(restored.skin() == 20);
+      long builds = lists.verletLists().builds();
+      for (int t = 0; t < 30; ++t) {
+        lists.updateFlock(0.05);
+        restored.updateFlock(0.05);
+      }
+      CHECK(restored.verletLists().builds() - 1 ==
+            lists.verletLists().builds() - builds);
+      int differ = 0;
+      for (int i = 0; i < flock.size(); ++i) {
+        differ += lists.arrays().x[i] != restored.arrays().x[i] ||
+                  lists.arrays().vy[i] != restored.arrays().vy[i];
+      }
+      CHECK(differ == 0);
+    }
+    bd::FlockState damaged = flock.state();
+    damaged.skin = 20;
+    damaged.listX.assign(3, 0.);
+    bd::Flock restored;
+    CHECK_THROWS(restored.restore(damaged));
+  }
+}
+
+TEST_CASE("Testing the Morton reordering") {
+  std::default_random_engine eng(41);
+  std::uniform_real_distribution<double> xDist(0, 400);
+  std::uniform_real_distribution<double> yDist(0, 300);
+  std::uniform_real_distribution<double> vDist(-30, 30);
+  bd::Parameters par{40, 10, 0.1, 0.1, 0.1};
+  // with Wander, which draws from the ids
+  bd::RuleFlock<bd::Separation, bd::Alignment, bd::Cohesion, bd::Wander> flock;
+  flock.setWorld({400, 300});
+  for (int i = 0; i < 300; ++i) {
+    flock.addBoid(bd::Boid({xDist(eng), yDist(eng)},
+                           {vDist(eng), vDist(eng)}, par, 60));
+  }
+
+  SUBCASE("Morton codes interleave the two coordinates") {
+    const bd::World world{400, 300};
+    CHECK(bd::mortonCode(0, 0, world) == 0);
+    // a step of x is bit 0, of y bit 1
+    CHECK(bd::mortonCode(400. / 65536, 0, world) == 1);
+    CHECK(bd::mortonCode(0, 300. / 65536, world) == 2);
+    CHECK(bd::mortonCode(200, 0, world) == 1u << 30);
+    CHECK(bd::mortonCode(0, 150, world) == 1u << 31);
+    CHECK(bd::mortonCode(400, 300, world) == 0xffffffffu);
+    // out of the world, on its edge
+    CHECK(bd::mortonCode(-5, 1000, world) == bd::mortonCode(0, 300, world));
+  }
+
+  SUBCASE("The radix sort is stable, with any number of threads") {
+    // few distinct keys, some of them with the high bits set
+    std::uniform_int_distribution<std::uint32_t> keyDist(0, 5000);
+    std::vector<std::uint32_t> keys(20000);
+    for (auto& key : keys) {
+      key = keyDist(eng);
+      key |= key % 3 == 0 ? key << 20 : 0u;
+    }
+    std::vector<int> expected(keys.size());
+    std::iota(expected.begin(), expected.end(), 0);
+    std::stable_sort(expected.begin(), expected.end(),
+                     [&](int a, int b) { return keys[a] < keys[b]; });
+    bd::Arena scratch;
+    for (int threads : {1, 3}) {
+      bd::ThreadPool pool(threads);
+      std::vector<int> order;
+      bd::radixSort(keys, order, pool, scratch);
+      CHECK(order == expected);
+    }
+    bd::ThreadPool pool(1);
+    std::vector<int> order{1, 2};
+    bd::radixSort({}, order, pool, scratch);
+    CHECK(order.empty());
+  }
+
+  SUBCASE("A reorder moves the boids, their ids keep track of them") {
+    int other = flock.addGroup({30, 10, 0.1, 0.1, 0.1}, 60);
+    for (int i = 0; i < flock.size(); i += 5) {
+      flock.setGroup(i, other);
+    }
+    bd::BoidArrays before = flock.arrays();
+    flock.reorder();
+    const bd::BoidArrays& after = flock.arrays();
+    int unsorted = 0;
+    int moved = 0;
+    int lost = 0;
+    for (int i = 0; i < flock.size(); ++i) {
+      if (i > 0) {
+        unsorted += bd::mortonCode(after.x[i - 1], after.y[i - 1],
+                                   flock.world()) >
+                    bd::mortonCode(after.x[i], after.y[i], flock.world());
+      }
+      int id = flock.id(i);
+      moved += id != i;
+      lost += flock.indexOf(id) != i || after.x[i] != before.x[id] ||
+              after.vy[i] != before.vy[id] ||
+              flock.group(i) != (id % 5 == 0 ? other : 0);
+    }
+    CHECK(unsorted == 0);
+    CHECK(moved > 0);
+    CHECK(lost == 0);
+    bd::BoidArrays byId;
+    flock.arraysById(byId);
+    CHECK(byId.x == before.x);
+    CHECK(byId.vy == before.vy);
+
+    flock.addBoid(bd::Boid({10, 10}, {0, 0}, par, 60));
+    CHECK(flock.id(300) == 300);
+    CHECK(flock.indexOf(300) == 300);
+  }
+
+  SUBCASE("Reordered every few ticks, the flock is the same by id") {
+    flock.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    auto reordered = flock;
+    reordered.setReorderEvery(4);
+    reordered.setThreads(3);
+    // the lists are built again after every reorder
+    reordered.setSkin(20);
+    for (int t = 0; t < 10; ++t) {
+      flock.updateFlock(0.05);
+      reordered.updateFlock(0.05);
+    }
+    bd::BoidArrays expected;
+    flock.arraysById(expected);
+    bd::BoidArrays byId;
+    reordered.arraysById(byId);
+    int differ = 0;
+    for (int i = 0; i < flock.size(); ++i) {
+      differ += !(byId.x[i] == doctest::Approx(expected.x[i]) &&
+                  byId.vy[i] == doctest::Approx(expected.vy[i]));
+    }
+    CHECK(differ == 0);
+    CHECK(reordered.verletLists().builds() >= 3);
+    CHECK_THROWS(reordered.setReorderEvery(-1));
+  }
+
+  SUBCASE("The ids are part of the state and of the checkpoints") {
+    flock.setReorderEvery(3);
+    for (int t = 0; t < 5; ++t) {
+      flock.updateFlock(0.05);
+    }
+    std::stringstream file;
+    bd::saveState(flock.state(), file);
+    bd::FlockState loaded = bd::loadState(file);
+    CHECK(loaded.reorderEvery == 3);
+    CHECK(loaded.id == flock.state().id);
+
+    decltype(flock) restored;
+    restored.restore(loaded);
+    for (int t = 0; t < 10; ++t) {
+      flock.updateFlock(0.05);
+      restored.updateFlock(0.05);
+    }
+    CHECK(restored.arrays().x == flock.arrays().x);
+    CHECK(restored.arrays().vy == flock.arrays().vy);
+    CHECK(restored.state().id == flock.state().id);
+
+    loaded.id[0] = loaded.id[1];
+    CHECK_THROWS(restored.restore(loaded));
+  }
+}
+
+TEST_CASE("Testing Barnes-Hut") {
+  std::default_random_engine eng(43);
+  std::uniform_real_distribution<double> xDist(0, 400);
+  std::uniform_real_distribution<double> yDist(0, 300);
+  std::uniform_real_distribution<double> vDist(-30, 30);
+  // a d larger than half the height: the whole flock is in range in y
+  bd::Parameters par{200, 10, 0.1, 0.1, 0.1};
+  bd::Flock flock;
+  flock.setWorld({400, 300});
+  flock.setUpdateMode(bd::UpdateMode::doubleBuffered);
+  for (int i = 0; i < 500; ++i) {
+    flock.addBoid(bd::Boid({xDist(eng), yDist(eng)},
+                           {vDist(eng), vDist(eng)}, par, 60));
+  }
+
+  SUBCASE("The tree splits the boids in nodes") {
+    bd::Flock tree = flock;
+    tree.setBarnesHut(true);
+    tree.updateFlock(0.05);
+    const auto& nodes = tree.quadtree().nodes();
+    const auto& sorted = tree.quadtree().sorted();
+    CHECK(nodes[tree.quadtree().root(0)].count == 500);
+    int wrong = 0;
+    for (const auto& node : nodes) {
+      if (node.child < 0) {
+        wrong += node.count > bd::Quadtree::leafSize;
+        for (int k = node.begin; k < node.end; ++k) {
+          wrong += sorted.x[k] < node.x0 || sorted.x[k] > node.x1 ||
+                   sorted.y[k] < node.y0 || sorted.y[k] > node.y1;
+        }
+      } else {
+        int count = 0;
+        for (int c = node.child; c < node.child + node.children; ++c) {
+          count += nodes[c].count;
+        }
+        wrong += count != node.count;
+      }
+    }
+    CHECK(wrong == 0);
+  }
+
+  SUBCASE("With theta 0 the sums are exact") {
+    for (auto boundary : {bd::Boundary::periodic, bd::Boundary::reflective}) {
+      flock.setWorld({400, 300, boundary});
+      bd::BarnesHutError error = flock.barnesHutError(0., flock.size());
+      CHECK(error.center == doctest::Approx(0.).epsilon(1e-9));
+      CHECK(error.velocity == doctest::Approx(0.).epsilon(1e-9));
+      CHECK(error.neighbors == 0.);
+
+      bd::Flock tree = flock;
+      tree.setBarnesHut(true, 0.);
+      for (int t = 0; t < 5; ++t) {
+        flock.updateFlock(0.05);
+        tree.updateFlock(0.05);
+      }
+      const bd::BoidArrays& exact = flock.arrays();
+      int differ = 0;
+      for (int i = 0; i < flock.size(); ++i) {
+        differ += !(tree.arrays().x[i] == doctest::Approx(exact.x[i]) &&
+                    tree.arrays().vy[i] == doctest::Approx(exact.vy[i]));
+      }
+      CHECK(differ == 0);
+    }
+  }
+
+  SUBCASE("The error grows with theta") {
+    bd::BarnesHutError small = flock.barnesHutError(0.25, 200);
+    bd::BarnesHutError middle = flock.barnesHutError(0.5, 200);
+    bd::BarnesHutError large = flock.barnesHutError(1., 200);
+    CHECK(small.theta == 0.25);
+    CHECK(large.center > 0.);
+    CHECK(small.center <= middle.center);
+    CHECK(middle.center <= large.center);
+    CHECK(small.maxCenter >= small.center);
+    // the centers of mass of hundreds of boids in a 400 x 300 world, off
+    // by a few units at the default opening angle
+    CHECK(middle.center < 20.);
+    CHECK(middle.neighbors < 0.1);
+    CHECK(large.neighbors < 0.3);
+  }
+
+  SUBCASE("Barnes-Hut follows the groups and their weights") {
+    bd::Flock grid = flock;
+    int other = grid.addGroup({150, 10, 0.05, 0.05, 0.1}, 90);
+    for (int i = 0; i < grid.size(); i += 7) {
+      grid.setGroup(i, other);
+    }
+    grid.setInteraction(0, other, {2, 0, -1});
+    grid.setInteraction(other, other, {0, 0, 0});
+    bd::Flock tree = grid;
+    tree.setBarnesHut(true, 0.);
+    for (int t = 0; t < 3; ++t) {
+      grid.updateFlock(0.05);
+      tree.updateFlock(0.05);
+    }
+    int differ = 0;
+    for (int i = 0; i < flock.size(); ++i) {
+      differ += !(tree.arrays().x[i] == doctest::Approx(grid.arrays().x[i]) &&
+                  tree.arrays().vx[i] == doctest::Approx(grid.arrays().vx[i]));
+    }
+    CHECK(differ == 0);
+  }
+
+  SUBCASE("The lists are built again after Barnes-Hut") {
+    // the tree comes with a grid of its own, that the lists don't fit
+    bd::Flock lists = flock;
+    lists.setUpdateMode(bd::UpdateMode::inPlace);
+    lists.setSkin(40);
+    bd::Flock brute = lists;
+    lists.updateFlock(0.05);
+    lists.setBarnesHut(true, 0.);
+    lists.updateFlock(0.05);
+    lists.setBarnesHut(false);
+    brute.restore(lists.state());
+    for (int t = 0; t < 2; ++t) {
+      lists.updateFlock(0.05);
+      brute.updateFlockBruteForce(0.05);
+    }
+    int differ = 0;
+    for (int i = 0; i < flock.size(); ++i) {
+      const auto& l = lists.arrays();
+      const auto& b = brute.arrays();
+      differ += !(l.x[i] == doctest::Approx(b.x[i]) &&
+                  l.vx[i] == doctest::Approx(b.vx[i]));
+    }
+    CHECK(differ == 0);
+  }
+
+  SUBCASE("Without separation no boid searches the whole grid") {
+    bd::Flock grid = flock;
+    grid.setGroupPar(0, {200, 0, 0.1, 0.1, 0.1});
+    bd::Flock tree = grid;
+    tree.setBarnesHut(true, 0.);
+    for (int t = 0; t < 3; ++t) {
+      grid.updateFlock(0.05);
+      tree.updateFlock(0.05);
+    }
+    // cells of ds 0 would be a single one of the whole world
+    CHECK(tree.grid().cols() * tree.grid().rows() > 1);
+    int differ = 0;
+    for (int i = 0; i < flock.size(); ++i) {
+      differ += !(tree.arrays().x[i] == doctest::Approx(grid.arrays().x[i]) &&
+                  tree.arrays().vx[i] == doctest::Approx(grid.arrays().vx[i]));
+    }
+    CHECK(differ == 0);
+  }
+
+  SUBCASE("The opening angle is checked") {
+    CHECK_THROWS(flock.setBarnesHut(true, -0.5));
+    CHECK_THROWS(flock.setBarnesHut(true, std::nan("")));
+    CHECK_FALSE(flock.barnesHut());
+    flock.setBarnesHut(true, 0.7);
+    CHECK(flock.barnesHut());
+    CHECK(flock.theta() == 0.7);
+  }
+}
+
+TEST_CASE("Testing the scratch memory") {
+  SUBCASE("Buffers are given back when their scope ends") {
+    bd::Arena arena;
+    CHECK_THROWS_AS(arena.allocate<int>(1), std::runtime_error);
+    {
+      bd::Arena::Scope scope(arena);
+      int* a = arena.allocate<int>(10);
+      double* b = arena.allocate<double>(3);
+      CHECK(reinterpret_cast<std::uintptr_t>(a) % bd::Arena::alignment == 0);
+      CHECK(reinterpret_cast<std::uintptr_t>(b) % bd::Arena::alignment == 0);
+      CHECK(static_cast<void*>(b) != static_cast<void*>(a));
+      {
+        bd::Arena::Scope inner(arena);
+        CHECK(static_cast<void*>(arena.allocate<char>(1)) !=
+              static_cast<void*>(b));
+      }
+      // the inner buffer was given back, the next one takes its place
+      bd::Arena::Scope again(arena);
+      CHECK(static_cast<void*>(arena.allocate<char>(1)) ==
+            static_cast<void*>(b + 8));
+    }
+    CHECK(arena.grows() == 1);
+  }
+
+  SUBCASE("Blocks are merged once nothing is in use") {
+    bd::Arena arena;
+    {
+      bd::Arena::Scope scope(arena);
+      for (int k = 0; k < 8; ++k) {
+        arena.allocate<double>(100000);
+      }
+    }
+    long grows = arena.grows();
+    std::size_t capacity = arena.capacity();
+    CHECK(capacity >= 8 * 100000 * sizeof(double));
+    for (int t = 0; t < 3; ++t) {
+      bd::Arena::Scope scope(arena);
+      for (int k = 0; k < 8; ++k) {
+        arena.allocate<double>(100000);
+      }
+    }
+    CHECK(arena.grows() == grows);
+    CHECK(arena.capacity() == capacity);
+    // a copy has its own, empty
+    bd::Arena copy = arena;
+    CHECK(copy.capacity() == 0);
+  }
+
+  SUBCASE("A warm tick takes no memory from the heap") {
+    std::default_random_engine eng(17);
+    std::uniform_real_distribution<double> xDist(0, 640);
+    std::uniform_real_distribution<double> yDist(0, 360);
+    std::uniform_real_distribution<double> vDist(-40, 40);
+    bd::Parameters par{40, 8, 0.1, 0.05, 0.05};
+    bd::Flock start;
+    start.setWorld({640, 360});
+    for (int i = 0; i < 1000; ++i) {
+      start.addBoid(bd::Boid({xDist(eng), yDist(eng)},
+                             {vDist(eng), vDist(eng)}, par, 80));
+    }
+    // the series grows until it holds capacity() ticks
+    start.statistics().setCapacity(4);
+    int other = start.addGroup({60, 8, 0.1, 0.1, 0.1}, 60);
+
+    // every mode, each after a few ticks to warm up
+    auto heapTicks = [](bd::Flock& flock) {
+      for (int t = 0; t < 10; ++t) {
+        flock.updateFlock(1. / 60.);
+      }
+      long before = allocations;
+      for (int t = 0; t < 10; ++t) {
+        flock.updateFlock(1. / 60.);
+      }
+      return allocations - before;
+    };
+    bd::Flock inPlace = start;
+    CHECK(heapTicks(inPlace) == 0);
+    bd::Flock threaded = start;
+    threaded.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    threaded.setThreads(3);
+    CHECK(heapTicks(threaded) == 0);
+    bd::Flock lists = start;
+    lists.setSkin(20);
+    CHECK(heapTicks(lists) == 0);
+    bd::Flock reordered = start;
+    reordered.setUpdateMode(bd::UpdateMode::doubleBuffered);
+    reordered.setReorderEvery(3);
+    CHECK(heapTicks(reordered) == 0);
+    bd::Flock tree = start;
+    tree.setBarnesHut(true);
+    CHECK(heapTicks(tree) == 0);
+    bd::Flock species = start;
+    for (int i = 0; i < species.size(); i += 3) {
+      species.setGroup(i, other);
+    }
+    species.setInteraction(0, other, {0.5, 0, 1});
+    species.setWorld({640, 360, bd::Boundary::reflective});
+    CHECK(heapTicks(species) == 0);
+    species.setBarnesHut(true);
+    CHECK(heapTicks(species) == 0);
+  }
+}
@@ -0,0 +1,373 @@
+#include "checkpoint.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace bd {
+
+namespace {
+
+constexpr char magic[8]{'B', 'O', 'I', 'D', 'C', 'K', 'P', 'T'};
+// 1 had Parameters and maxspeed per boid, and no groups, 2 no boundary of
+// the world, 3 no ids nor reorders, 4 no Verlet lists: all still read
+constexpr std::uint32_t version{5};
+// ids are written as they are in memory
+static_assert(sizeof(int) == sizeof(std::int32_t), "ids are 32 bit");
+
+// FNV-1a over everything written or read through it
+class Checksum {
+  std::uint64_t m_hash{14695981039346656037ull};
+
+ public:
+  void add(const char* data, std::size_t size) {
+    for (std::size_t k = 0; k < size; ++k) {
+      m_hash ^= static_cast<unsigned char>(data[k]);
+      m_hash *= 1099511628211ull;
+    }
+  }
+  std::uint64_t value() const { return m_hash; }
+};
+
+class Writer {
+  std::ostream& m_out;
+  Checksum m_checksum;
+
+ public:
+  explicit Writer(std::ostream& out) : m_out{out} {}
+
+  void bytes(const void* data, std::size_t size) {
+    m_checksum.add(static_cast<const char*>(data), size);
+    m_out.write(static_cast<const char*>(data), size);
+  }
+  template <class T>
+  void value(T v) {
+    bytes(&v, sizeof v);
+  }
+  void doubles(const std::vector<double>& v) {
+    bytes(v.data(), v.size() * sizeof(double));
+  }
+  std::uint64_t checksum() const { return m_checksum.value(); }
+};
+
+class Reader {
+  std::istream& m_in;
+  Checksum m_checksum;
+
+ public:
+  explicit Reader(std::istream& in) : m_in{in} {}
+
+  void bytes(void* data, std::size_t size) {
+    if (!m_in.read(static_cast<char*>(data), size)) {
+      throw std::runtime_error{"The checkpoint is cut short"};
+    }
+    m_checksum.add(static_cast<const char*>(data), size);
+  }
+  template <class T>
+  T value() {
+    T v;
+    bytes(&v, sizeof v);
+    return v;
+  }
+  void doubles(std::vector<double>& v, std::size_t n) {
+    v.resize(n);
+    bytes(v.data(), n * sizeof(double));
+  }
+  std::uint64_t checksum() const { return m_checksum.value(); }
+};
+
+}  // namespace
+
+void saveState(const FlockState& state, std::ostream& out) {
+  Writer w(out);
+  w.bytes(magic, sizeof magic);
+  w.value(version);
+  w.value(static_cast<std::uint32_t>(state.updateMode));
+  w.value(static_cast<std::int64_t>(state.tick));
+  w.value(state.world.width);
+  w.value(state.world.height);
+  w.value(static_cast<std::uint32_t>(state.world.boundary));
+  w.value(state.world.margin);
+  w.value(state.world.turn);
+  w.value(static_cast<std::uint64_t>(state.boids.size()));
+  w.doubles(state.boids.x);
+  w.doubles(state.boids.y);
+  w.doubles(state.boids.vx);
+  w.doubles(state.boids.vy);
+  w.value(static_cast<std::uint64_t>(state.par.size()));
+  for (std::size_t g = 0; g < state.par.size(); ++g) {
+    const Parameters& par = state.par[g];
+    for (double p : {par.d, par.ds, par.s, par.a, par.c, state.maxspeed[g]}) {
+      w.value(p);
+    }
+  }
+  w.value(static_cast<std::uint64_t>(state.group.size()));
+  w.bytes(state.group.data(), state.group.size() * sizeof(std::uint16_t));
+  w.value(static_cast<std::uint64_t>(state.interactions.size()));
+  for (auto const& i : state.interactions) {
+    for (double p : {i.s, i.a, i.c}) {
+      w.value(p);
+    }
+  }
+  w.value(static_cast<std::int32_t>(state.reorderEvery));
+  w.value(static_cast<std::uint64_t>(state.id.size()));
+  w.bytes(state.id.data(), state.id.size() * sizeof(std::int32_t));
+  w.value(state.skin);
+  w.value(static_cast<std::int32_t>(state.listLayers));
+  w.value(static_cast<std::uint64_t>(state.listX.size()));
+  w.doubles(state.listX);
+  w.doubles(state.listY);
+  w.bytes(state.listGroup.data(),
+          state.listGroup.size() * sizeof(std::uint16_t));
+  w.value(static_cast<std::uint64_t>(state.listD.size()));
+  w.doubles(state.listD);
+  w.value(static_cast<std::uint64_t>(state.rng.size()));
+  w.bytes(state.rng.data(), state.rng.size());
+  std::uint64_t checksum = w.checksum();
+  out.write(reinterpret_cast<const char*>(&checksum), sizeof checksum);
+  if (!out) {
+    throw std::runtime_error{"Cannot write the checkpoint"};
+  }
+}
+
+FlockState loadState(std::istream& in) {
+  Reader r(in);
+  char m[sizeof magic];
+  r.bytes(m, sizeof m);
+  if (std::memcmp(m, magic, sizeof magic) != 0) {
+    throw std::runtime_error{"Not a checkpoint"};
+  }
+  std::uint32_t fileVersion = r.value<std::uint32_t>();
+  if (fileVersion < 1 || fileVersion > version) {
+    throw std::runtime_error{"Unknown checkpoint version"};
+  }
+
+  FlockState state;
+  std::uint32_t mode = r.value<std::uint32_t>();
+  if (mode > static_cast<std::uint32_t>(UpdateMode::doubleBuffered)) {
+    throw std::runtime_error{"Unknown update mode in the checkpoint"};
+  }
+  state.updateMode = static_cast<UpdateMode>(mode);
+  state.tick = r.value<std::int64_t>();
+  state.world.width = r.value<double>();
+  state.world.height = r.value<double>();
+  if (fileVersion >= 3) {
+    std::uint32_t boundary = r.value<std::uint32_t>();
+    if (boundary > static_cast<std::uint32_t>(Boundary::open)) {
+      throw std::runtime_error{"Unknown boundary in the checkpoint"};
+    }
+    state.world.boundary = static_cast<Boundary>(boundary);
+    state.world.margin = r.value<double>();
+    state.world.turn = r.value<double>();
+  }
+  std::uint64_t n = r.value<std::uint64_t>();
+  // a damaged size would ask for any amount of memory: check that the
+  // stream can hold it before reading
+  auto here = in.tellg();
+  in.seekg(0, std::ios::end);
+  auto left = static_cast<std::uint64_t>(in.tellg() - here);
+  in.seekg(here);
+  auto fits = [&](std::uint64_t count, std::size_t size) {
+    if (count > left / size) {
+      throw std::runtime_error{"The checkpoint is cut short"};
+    }
+  };
+  fits(n, 4 * sizeof(double));
+
+  r.doubles(state.boids.x, n);
+  r.doubles(state.boids.y, n);
+  r.doubles(state.boids.vx, n);
+  r.doubles(state.boids.vy, n);
+  auto readPar = [&](Parameters& par) {
+    par.d = r.value<double>();
+    par.ds = r.value<double>();
+    par.s = r.value<double>();
+    par.a = r.value<double>();
+    par.c = r.value<double>();
+  };
+  if (fileVersion == 1) {
+    // one entry per boid, grouped by Flock::restore()
+    fits(n, 6 * sizeof(double));
+    state.par.resize(n);
+    for (auto& par : state.par) {
+      readPar(par);
+    }
+    r.doubles(state.maxspeed, n);
+  } else {
+    std::uint64_t groups = r.value<std::uint64_t>();
+    fits(groups, 6 * sizeof(double));
+    state.par.resize(groups);
+    state.maxspeed.resize(groups);
+    for (std::uint64_t g = 0; g < groups; ++g) {
+      readPar(state.par[g]);
+      state.maxspeed[g] = r.value<double>();
+    }
+    std::uint64_t grouped = r.value<std::uint64_t>();
+    if (grouped != 0 && grouped != n) {
+      throw std::runtime_error{"The checkpoint is damaged"};
+    }
+    state.group.resize(grouped);
+    r.bytes(state.group.data(), grouped * sizeof(std::uint16_t));
+    std::uint64_t interactions = r.value<std::uint64_t>();
+    fits(interactions, 3 * sizeof(double));
+    state.interactions.resize(interactions);
+    for (auto& i : state.interactions) {
+      i.s = r.value<double>();
+      i.a = r.value<double>();
+      i.c = r.value<double>();
+    }
+  }
+  if (fileVersion >= 4) {
+    state.reorderEvery = r.value<std::int32_t>();
+    std::uint64_t ids = r.value<std::uint64_t>();
+    if (ids != 0 && ids != n) {
+      throw std::runtime_error{"The checkpoint is damaged"};
+    }
+    state.id.resize(ids);
+    r.bytes(state.id.data(), ids * sizeof(std::int32_t));
+  }
+  if (fileVersion >= 5) {
+    state.skin = r.value<double>();
+    state.listLayers = r.value<std::int32_t>();
+    std::uint64_t listed = r.value<std::uint64_t>();
+    if (listed != 0 && listed != n) {
+      throw std::runtime_error{"The checkpoint is damaged"};
+    }
+    r.doubles(state.listX, listed);
+    r.doubles(state.listY, listed);
+    state.listGroup.resize(listed);
+    r.bytes(state.listGroup.data(), listed * sizeof(std::uint16_t));
+    std::uint64_t groups = r.value<std::uint64_t>();
+    fits(groups, sizeof(double));
+    r.doubles(state.listD, groups);
+  }
+  std::uint64_t rngSize = r.value<std::uint64_t>();
+  if (rngSize > left) {
+    throw std::runtime_error{"The checkpoint is cut short"};
+  }
+  state.rng.resize(rngSize);
+  r.bytes(state.rng.data(), rngSize);
+
+  std::uint64_t expected = r.checksum();
+  std::uint64_t checksum;
+  if (!in.read(reinterpret_cast<char*>(&checksum), sizeof checksum) ||
+      checksum != expected) {
+    throw std::runtime_error{"The checkpoint is damaged"};
+  }
+  return state;
+}
+
+void saveState(const FlockState& state, const std::string& path) {
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error{"Cannot write " + temporary};
+    }
+    saveState(state, out);
+    out.flush();
+    if (!out) {
+      throw std::runtime_error{"Cannot write " + temporary};
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error{"Cannot replace " + path};
+  }
+}
+
+FlockState loadState(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error{"Cannot open " + path};
+  }
+  return loadState(in);
+}
+
+Checkpointer::Checkpointer(const std::string& path, long every)
+    : m_path{path}, m_every{every} {
+  if (every < 1) {
+    throw std::runtime_error{"Checkpoints must be at least one tick apart"};
+  }
+  m_thread = std::thread(&Checkpointer::run, this);
+}
+
+Checkpointer::~Checkpointer() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_changed.notify_all();
+  m_thread.join();
+}
+
+void Checkpointer::rethrow() {
+  if (m_error) {
+    std::exception_ptr error = m_error;
+    m_error = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+template <class T>
+bool Checkpointer::tick(const BasicFlock<T>& flock, long tick,
+                        const std::string& rng) {
+  if (!due(tick)) {
+    return false;
+  }
+  // the tick saved is the flock's own, that the rules read back
+  auto state = std::make_unique<FlockState>(flock.state());
+  state->rng = rng;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    rethrow();
+    m_pending = std::move(state);
+  }
+  m_changed.notify_all();
+  return true;
+}
+
+void Checkpointer::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    // whatever is pending is saved before stopping
+    m_changed.wait(lock, [&] { return m_stop || m_pending; });
+    if (!m_pending) {
+      return;
+    }
+    std::unique_ptr<FlockState> state = std::move(m_pending);
+    m_saving = true;
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      saveState(*state, m_path);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    m_saving = false;
+    if (error) {
+      m_error = error;
+    } else {
+      ++m_saved;
+    }
+    m_changed.notify_all();
+  }
+}
+
+void Checkpointer::flush() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_changed.wait(lock, [&] { return !m_pending && !m_saving; });
+  rethrow();
+}
+
+long Checkpointer::saved() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_saved;
+}
+
+template bool Checkpointer::tick(const Flock&, long, const std::string&);
+template bool Checkpointer::tick(const FlockF&, long, const std::string&);
+
+}  // namespace bd
@@ -0,0 +1,77 @@
+#pragma once
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "flock.hpp"
+
+namespace bd {
+
+// Versioned binary snapshot of a FlockState: the magic "BOIDCKPT", a format
+// version, the update mode, tick, world size and boundary, N, the arrays x,
+// y, vx, vy, the Parameters and maxspeed of every group, the group of every
+// boid, the interaction weights, the reorder period and the id of every
+// boid, the skin and what the Verlet lists were built from, the rng state,
+// and a 64 bit FNV-1a checksum of everything before it, so a file cut short
+// or damaged is refused instead of restored. Files of version 1, with no
+// groups, of version 2, with no boundary, of version 3, with no ids, and of
+// version 4, with no lists, are still read.
+void saveState(const FlockState& state, std::ostream& out);
+FlockState loadState(std::istream& in);
+
+// to a file next to path first, then renamed over it, so a crash while
+// saving leaves the previous checkpoint in place
+void saveState(const FlockState& state, const std::string& path);
+FlockState loadState(const std::string& path);
+
+// Checkpoints a running flock every few ticks without holding it up: the
+// state is copied (Flock::state(), a copy of its arrays) and saved to disk
+// by a thread of its own while the simulation goes on. If the disk is
+// slower than the checkpoints, a state still waiting to be saved is
+// replaced by the newer one.
+class Checkpointer {
+  std::string m_path;
+  long m_every;
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_changed;
+  std::unique_ptr<FlockState> m_pending;
+  bool m_saving{false};
+  bool m_stop{false};
+  std::exception_ptr m_error;
+  long m_saved{};
+
+  void run();
+  void rethrow();
+
+ public:
+  Checkpointer(const std::string& path, long every);
+  ~Checkpointer();
+
+  Checkpointer(const Checkpointer&) = delete;
+  Checkpointer& operator=(const Checkpointer&) = delete;
+
+  // whether a checkpoint is due after tick, on the multiples of every
+  bool due(long tick) const { return tick % m_every == 0; }
+  // to be called after every tick: when due after tick, as counted by the
+  // caller, it hands the state of flock over to be saved and returns true.
+  // The state keeps the flock's own tick, whatever the caller counts.
+  template <class T>
+  bool tick(const BasicFlock<T>& flock, long tick,
+            const std::string& rng = "");
+  // returns when everything handed over is saved
+  void flush();
+  // checkpoints saved so far
+  long saved();
+};
+
+}  // namespace bd
+
+#endif
@@ -1,36 +1,773 @@
 #include "flock.hpp"
+#include "morton.hpp"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 //#include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
 //#include <limits>
 #include <random>
+#include <stdexcept>
 #include <iomanip>
 
 namespace bd {
-void Flock::addBoid(const Boid& b) { m_flock.push_back(b); }
 
-Boid Flock::getBoid(int i) const { return m_flock[i]; }
+namespace {
+// boids per task of a double buffered update
+constexpr int boidsPerTask{128};
 
-Boid& Flock::getBoid(int i) { return m_flock[i]; }
+// columns of a block of average_distance_blocked(), 2 x 32 kB of positions
+constexpr int distanceBlock{4096};
+// rows of the pair triangle per task, each one folded with its mirror row
+constexpr int distanceRowsPerTask{16};
 
-void Flock::updateFlock(const double delta_t) { 
-  for (auto& boid : m_flock) {
-    boid.update(m_flock, delta_t);
+Statistics distanceStatistics(double sum_d, double sum_d2, double count) {
+  if (count < 2) {
+    throw std::runtime_error{"Not enough entries to run a statistics"};
+  }
+  double average_distance = sum_d / count;
+  const double sigma_d =
+      std::sqrt((sum_d2 - count * average_distance * average_distance) /
+                (count - 1));
+  return {average_distance, sigma_d};
+}
+
+// what updateFlock() gathers for FlockStatistics
+struct TickAccumulators {
+  Accumulator speed;
+  Accumulator neighbors;
+
+  template <class T>
+  void add(const BasicBoid<T>& boid, int n) {
+    speed.add(magnitude(boid.getVelocity()));
+    neighbors.add(n);
+  }
+  void merge(const TickAccumulators& other) {
+    speed.merge(other.speed);
+    neighbors.merge(other.neighbors);
+  }
+};
+
+// the group with par and maxspeed in pars and maxspeeds, appended if there
+// is none; boids are mostly added one group after the other, so the group
+// last is looked at first
+template <class T>
+int findGroup(std::vector<Parameters>& pars, std::vector<T>& maxspeeds,
+              int last, const Parameters& par, T maxspeed) {
+  int groups = pars.size();
+  auto same = [&](int g) {
+    const Parameters& p = pars[g];
+    return p.d == par.d && p.ds == par.ds && p.s == par.s && p.a == par.a &&
+           p.c == par.c && maxspeeds[g] == maxspeed;
+  };
+  if (last < groups && same(last)) {
+    return last;
+  }
+  for (int g = 0; g < groups; ++g) {
+    if (same(g)) {
+      return g;
+    }
+  }
+  if (groups > std::numeric_limits<std::uint16_t>::max()) {
+    throw std::runtime_error{"Too many groups of parameters"};
+  }
+  pars.push_back(par);
+  maxspeeds.push_back(maxspeed);
+  return groups;
+}
+
+// the sums worth gathering over a group with weights w: none when they are
+// all 0, so that the group is not searched
+unsigned interactionTerms(const Interaction& w) {
+  if (w.s == 0. && w.a == 0. && w.c == 0.) {
+    return 0;
+  }
+  return (w.s != 0. ? displacementsTerm : 0u) |
+         (w.a != 0. ? velocitiesTerm : 0u) |
+         (w.c != 0. ? positionsTerm : 0u) | neighborsTerm;
+}
+
+// part, gathered over the boids of one group, added to sums with weights w
+template <class T>
+void addWeighted(BasicSteeringSums<T>& sums, const BasicSteeringSums<T>& part,
+                 const Interaction& w) {
+  sums.displacements += T(w.s) * part.displacements;
+  sums.velocities += T(w.a) * part.velocities;
+  sums.positions += T(w.c) * part.positions;
+  sums.neighbors += part.neighbors;
+}
+
+// the same for a part gathered over the own group, which has the boid at
+// position in it: the boid is taken out, and added back by addSelf(), with
+// no weight
+template <class T>
+void addOwnWeighted(BasicSteeringSums<T>& sums, BasicSteeringSums<T> part,
+                    unsigned terms, const Vec2<T>& position,
+                    const Interaction& w) {
+  if (terms & positionsTerm) {
+    part.positions -= position;
+  }
+  if (terms & neighborsTerm) {
+    --part.neighbors;
+  }
+  addWeighted(sums, part, w);
+}
+
+template <class T>
+void addSelf(BasicSteeringSums<T>& sums, unsigned terms,
+             const Vec2<T>& position) {
+  if (terms & positionsTerm) {
+    sums.positions += position;
+  }
+  if (terms & neighborsTerm) {
+    ++sums.neighbors;
+  }
+}
+
+// laps of advance() and of the store after it
+enum Lap { steeringLap, integrationLap, bordersLap, storeLap };
+void recordLaps(const Laps& laps) {
+  laps.record({"steering", "integration", "borders", "store"});
+}
+}  // namespace
+
+template <class T>
+Vec2<T> BasicBoidRef<T>::getPosition() const {
+  return {m_flock->m_boids.x[m_i], m_flock->m_boids.y[m_i]};
+}
+template <class T>
+void BasicBoidRef<T>::setPosition(const Vec2<T>& newPos) {
+  m_flock->m_boids.x[m_i] = newPos.x;
+  m_flock->m_boids.y[m_i] = newPos.y;
+}
+
+template <class T>
+Vec2<T> BasicBoidRef<T>::getVelocity() const {
+  return {m_flock->m_boids.vx[m_i], m_flock->m_boids.vy[m_i]};
+}
+template <class T>
+void BasicBoidRef<T>::setVelocity(const Vec2<T>& newVel) {
+  m_flock->m_boids.vx[m_i] = newVel.x;
+  m_flock->m_boids.vy[m_i] = newVel.y;
+}
+
+// a single boid with other parameters moves to the group that has them
+template <class T>
+Parameters BasicBoidRef<T>::getPar() const {
+  return m_flock->m_par[m_flock->m_group[m_i]];
+}
+template <class T>
+void BasicBoidRef<T>::setPar(const Parameters& newPar) {
+  checkParameters(newPar);
+  m_flock->m_group[m_i] = m_flock->groupOf(newPar, getMaxspeed());
+}
+
+template <class T>
+T BasicBoidRef<T>::getMaxspeed() const {
+  return m_flock->m_maxspeed[m_flock->m_group[m_i]];
+}
+template <class T>
+void BasicBoidRef<T>::setMaxspeed(T new_Maxspeed) {
+  checkMaxspeed(new_Maxspeed);
+  m_flock->m_group[m_i] = m_flock->groupOf(getPar(), new_Maxspeed);
+}
+
+template <class T>
+BasicBoidRef<T>::operator BasicBoid<T>() const {
+  return m_flock->load(m_i);
+}
+
+template <class T>
+int BasicFlock<T>::groupOf(const Parameters& par, T maxspeed) {
+  return findGroup(m_par, m_maxspeed, m_group.empty() ? 0 : m_group.back(),
+                   par, maxspeed);
+}
+
+template <class T>
+BasicBoid<T> BasicFlock<T>::load(int i) const {
+  int g = m_group[i];
+  return BasicBoid<T>({m_boids.x[i], m_boids.y[i]},
+                      {m_boids.vx[i], m_boids.vy[i]}, m_par[g], m_maxspeed[g]);
+}
+
+template <class T>
+void BasicFlock<T>::store(BasicBoidArrays<T>& arrays, int i,
+                          const BasicBoid<T>& b) {
+  arrays.x[i] = b.getPosition().x;
+  arrays.y[i] = b.getPosition().y;
+  arrays.vx[i] = b.getVelocity().x;
+  arrays.vy[i] = b.getVelocity().y;
+}
+
+template <class T>
+void BasicFlock<T>::groupSums(int i, const BasicBoid<T>& boid, unsigned terms,
+                              BasicSteeringSums<T>& sums) const {
+  // updateFlock() has grown the weights to all the groups
+  int groups = m_interactionGroups;
+  int g = m_group[i];
+  const Interaction* row = &m_interactions[g * groups];
+  Vec2<T> position = boid.getPosition();
+  typename BasicGrid<T>::Spans spans;
+  for (int h = 0; h < groups; ++h) {
+    const Interaction& w = row[h];
+    unsigned groupTerms = terms & interactionTerms(w);
+    if (groupTerms == 0) {
+      continue;
+    }
+    BasicSteeringSums<T> part;
+    int n = m_grid.neighbors(m_boids.x[i], m_boids.y[i], spans, h);
+    steeringSums(part, position, boid.getVelocity(), boid.getPar(),
+                 m_grid.sorted(), spans.data(), n, groupTerms, &m_world);
+    if (h == g) {
+      addOwnWeighted(sums, part, groupTerms, position, w);
+    } else {
+      addWeighted(sums, part, w);
+    }
+  }
+  addSelf(sums, terms, position);
+}
+
+template <class T>
+void BasicFlock<T>::listSums(int i, const BasicBoid<T>& boid, unsigned terms,
+                             BasicSteeringSums<T>& sums) const {
+  const Range* runs = m_lists.runs().data() + m_lists.start(i);
+  int n = m_lists.start(i + 1) - m_lists.start(i);
+  Vec2<T> position = boid.getPosition();
+  if (m_interactions.empty()) {
+    steeringSums(sums, position, boid.getVelocity(), boid.getPar(),
+                 m_grid.sorted(), runs, n, terms, &m_world);
+    return;
+  }
+
+  // built with the groups as layers, the runs come group by group
+  int groups = m_interactionGroups;
+  int g = m_group[i];
+  const Interaction* row = &m_interactions[g * groups];
+  const std::vector<int>& index = m_grid.indices();
+  for (int begin = 0, end = 0; begin < n; begin = end) {
+    int h = m_group[index[runs[begin].begin]];
+    while (end < n && m_group[index[runs[end].begin]] == h) {
+      ++end;
+    }
+    const Interaction& w = row[h];
+    unsigned groupTerms = terms & interactionTerms(w);
+    if (groupTerms == 0) {
+      continue;
+    }
+    BasicSteeringSums<T> part;
+    steeringSums(part, position, boid.getVelocity(), boid.getPar(),
+                 m_grid.sorted(), runs + begin, end - begin, groupTerms,
+                 &m_world);
+    if (h == g) {
+      addOwnWeighted(sums, part, groupTerms, position, w);
+    } else {
+      addWeighted(sums, part, w);
+    }
+  }
+  addSelf(sums, terms, position);
+}
+
+template <class T>
+void BasicFlock<T>::treeSums(int i, const BasicBoid<T>& boid, unsigned terms,
+                             BasicSteeringSums<T>& sums) const {
+  Vec2<T> position = boid.getPosition();
+  const Parameters& par = boid.getPar();
+  typename BasicGrid<T>::Spans spans;
+  // over one layer: the displacements exact, the rest from the tree
+  auto gather = [&](int layer, unsigned layerTerms,
+                    BasicSteeringSums<T>& part) {
+    if ((layerTerms & displacementsTerm) && par.ds > 0.) {
+      int n = m_grid.neighbors(m_boids.x[i], m_boids.y[i], spans, layer);
+      steeringSums(part, position, boid.getVelocity(), par, m_grid.sorted(),
+                   spans.data(), n, displacementsTerm, &m_world);
+    }
+    m_tree.sums(part, position, boid.getVelocity(), par.d, m_theta,
+                layerTerms, layer);
+  };
+  if (m_interactions.empty()) {
+    gather(0, terms, sums);
+    return;
+  }
+
+  int groups = m_interactionGroups;
+  int g = m_group[i];
+  const Interaction* row = &m_interactions[g * groups];
+  for (int h = 0; h < groups; ++h) {
+    const Interaction& w = row[h];
+    unsigned groupTerms = terms & interactionTerms(w);
+    if (groupTerms == 0) {
+      continue;
+    }
+    BasicSteeringSums<T> part;
+    gather(h, groupTerms, part);
+    if (h == g) {
+      addOwnWeighted(sums, part, groupTerms, position, w);
+    } else {
+      addWeighted(sums, part, w);
+    }
+  }
+  addSelf(sums, terms, position);
+}
+
+template <class T>
+BasicBoid<T> BasicFlock<T>::advance(int i, double delta_t, Laps& laps,
+                                    int& neighbors) const {
+  BasicBoid<T> boid = load(i);
+  BasicSteeringSums<T> sums;
+  // rules that read no sums, with no statistics, need no neighbors at all
+  unsigned terms = m_terms | (m_collectStatistics ? neighborsTerm : 0u);
+  if (terms != 0 && m_barnesHut) {
+    treeSums(i, boid, terms, sums);
+  } else if (terms != 0 && m_lists.skin() > 0.) {
+    listSums(i, boid, terms, sums);
+  } else if (terms != 0 && !m_interactions.empty()) {
+    groupSums(i, boid, terms, sums);
+  } else if (terms != 0) {
+    typename BasicGrid<T>::Spans spans;
+    int n = m_grid.neighbors(m_boids.x[i], m_boids.y[i], spans);
+    steeringSums(sums, boid.getPosition(), boid.getVelocity(), boid.getPar(),
+                 m_grid.sorted(), spans.data(), n, terms, &m_world);
+  }
+  boid.updateVelocity(m_steer(boid, sums, {size(), i, id(i), m_tick}));
+  neighbors = sums.neighbors - 1;
+  laps.lap(steeringLap);
+  boid.updatePosition(delta_t);
+  laps.lap(integrationLap);
+  boid.borders(m_world);
+  laps.lap(bordersLap);
+  return boid;
+}
+
+template <class T>
+void BasicFlock<T>::addBoid(const BasicBoid<T>& b) {
+  int group = groupOf(b.getPar(), b.getMaxspeed());
+  m_boids.push_back(b.getPosition(), b.getVelocity());
+  m_group.push_back(group);
+  addId();
+}
+
+template <class T>
+void BasicFlock<T>::addBoid(const Vec2<T>& position, const Vec2<T>& velocity,
+                            int group) {
+  checkGroup(group);
+  m_boids.push_back(position, velocity);
+  m_group.push_back(group);
+  addId();
+}
+
+template <class T>
+void BasicFlock<T>::checkGroup(int group) const {
+  if (group < 0 || group >= groups()) {
+    throw std::runtime_error{"No such group"};
+  }
+}
+
+template <class T>
+int BasicFlock<T>::addGroup(const Parameters& par, T maxspeed) {
+  checkParameters(par);
+  checkMaxspeed(maxspeed);
+  if (groups() > std::numeric_limits<std::uint16_t>::max()) {
+    throw std::runtime_error{"Too many groups of parameters"};
+  }
+  m_par.push_back(par);
+  m_maxspeed.push_back(maxspeed);
+  return groups() - 1;
+}
+
+template <class T>
+void BasicFlock<T>::setGroupPar(int group, const Parameters& par) {
+  checkGroup(group);
+  checkParameters(par);
+  m_par[group] = par;
+}
+
+template <class T>
+void BasicFlock<T>::setGroupMaxspeed(int group, T maxspeed) {
+  checkGroup(group);
+  checkMaxspeed(maxspeed);
+  m_maxspeed[group] = maxspeed;
+}
+
+template <class T>
+Interaction BasicFlock<T>::interaction(int from, int to) const {
+  if (from < m_interactionGroups && to < m_interactionGroups) {
+    return m_interactions[from * m_interactionGroups + to];
+  }
+  return {};
+}
+
+template <class T>
+void BasicFlock<T>::growInteractions() {
+  int n = groups();
+  if (m_interactionGroups == n) {
+    return;
+  }
+  std::vector<Interaction> grown(n * n);
+  for (int g = 0; g < n; ++g) {
+    for (int h = 0; h < n; ++h) {
+      grown[g * n + h] = interaction(g, h);
+    }
+  }
+  m_interactions = std::move(grown);
+  m_interactionGroups = n;
+}
+
+template <class T>
+void BasicFlock<T>::setInteraction(int from, int to,
+                                   const Interaction& weights) {
+  checkGroup(from);
+  checkGroup(to);
+  if (!std::isfinite(weights.s) || !std::isfinite(weights.a) ||
+      !std::isfinite(weights.c)) {
+    throw std::runtime_error{"Interaction weights must be finite"};
+  }
+  growInteractions();
+  m_interactions[from * m_interactionGroups + to] = weights;
+  // back to the plain grid when the weights are all 1 again
+  if (std::all_of(m_interactions.begin(), m_interactions.end(),
+                  [](const Interaction& w) {
+                    return w.s == 1. && w.a == 1. && w.c == 1.;
+                  })) {
+    m_interactions.clear();
+    m_interactionGroups = 0;
+  }
+}
+
+template <class T>
+void BasicFlock<T>::setGroup(int i, int group) {
+  checkGroup(group);
+  m_group[i] = group;
+}
+
+template <class T>
+BasicBoid<T> BasicFlock<T>::getBoid(int i) const {
+  return load(i);
+}
+
+template <class T>
+BasicBoidRef<T> BasicFlock<T>::getBoid(int i) {
+  return BasicBoidRef<T>(*this, i);
+}
+
+template <class T>
+void BasicFlock<T>::setWorld(const World& world) {
+  if (!(world.margin >= 0. && world.turn >= 0.)) {
+    throw std::runtime_error{
+        "The margin and turn of the world must be positive"};
+  }
+  m_grid = BasicGrid<T>(world.width, world.height,
+                        world.boundary == Boundary::periodic);
+  // the lists hold slots of the grid just thrown away
+  m_lists.invalidate();
+  m_world = world;
+}
+
+template <class T>
+void BasicFlock<T>::setReorderEvery(int ticks) {
+  if (ticks < 0) {
+    throw std::runtime_error{"The ticks between reorders must be positive"};
   }
+  m_reorderEvery = ticks;
 }
 
-Statistics Flock::average_distance() {
+template <class T>
+void BasicFlock<T>::reorder() {
+  ScopedTimer timer("reorder");
+  int N = size();
+  m_keys.resize(N);
+  for (int i = 0; i < N; ++i) {
+    m_keys[i] = mortonCode(m_boids.x[i], m_boids.y[i], m_world);
+  }
+  radixSort(m_keys, m_order, *m_pool, m_scratch);
+
+  if (m_id.empty()) {
+    m_id.resize(N);
+    for (int i = 0; i < N; ++i) {
+      m_id[i] = i;
+    }
+  }
+  // m_next is only written during a double buffered tick
+  m_next.resize(N);
+  Arena::Scope scope(m_scratch);
+  std::uint16_t* group = m_scratch.allocate<std::uint16_t>(N);
+  int* id = m_scratch.allocate<int>(N);
+  for (int k = 0; k < N; ++k) {
+    int i = m_order[k];
+    m_next.x[k] = m_boids.x[i];
+    m_next.y[k] = m_boids.y[i];
+    m_next.vx[k] = m_boids.vx[i];
+    m_next.vy[k] = m_boids.vy[i];
+    group[k] = m_group[i];
+    id[k] = m_id[i];
+  }
+  std::swap(m_boids, m_next);
+  std::copy(group, group + N, m_group.begin());
+  std::copy(id, id + N, m_id.begin());
+  m_index.resize(N);
+  for (int k = 0; k < N; ++k) {
+    m_index[m_id[k]] = k;
+  }
+  // the lists hold slots of the grid, bucketed by the old indices
+  m_lists.invalidate();
+}
+
+template <class T>
+void BasicFlock<T>::addId() {
+  if (!m_id.empty()) {
+    m_index.push_back(m_id.size());
+    m_id.push_back(m_id.size());
+  }
+}
+
+template <class T>
+void BasicFlock<T>::arraysById(BasicBoidArrays<T>& boids) const {
+  if (m_id.empty()) {
+    boids = m_boids;
+    return;
+  }
+  int N = size();
+  boids.resize(N);
+  for (int i = 0; i < N; ++i) {
+    int k = m_id[i];
+    boids.x[k] = m_boids.x[i];
+    boids.y[k] = m_boids.y[i];
+    boids.vx[k] = m_boids.vx[i];
+    boids.vy[k] = m_boids.vy[i];
+  }
+}
+
+template <class T>
+void BasicFlock<T>::setBarnesHut(bool on, double theta) {
+  if (!(theta >= 0.) || !std::isfinite(theta)) {
+    throw std::runtime_error{"The opening angle must be positive"};
+  }
+  m_barnesHut = on;
+  m_theta = theta;
+}
+
+template <class T>
+BarnesHutError BasicFlock<T>::barnesHutError(double theta, int samples,
+                                              unsigned seed) const {
+  int N = size();
+  if (N < 2 || samples < 1) {
+    throw std::runtime_error{"Not enough boids"};
+  }
+  // over the whole flock, as if all the weights were 1
+  BasicQuadtree<T> tree;
+  Arena scratch;
+  tree.build(m_boids, m_group, 1, m_world, *m_pool, scratch);
+  std::default_random_engine eng(seed);
+  std::uniform_int_distribution<int> pick(0, N - 1);
+  unsigned terms = velocitiesTerm | positionsTerm | neighborsTerm;
+  int count = std::min(samples, N);
+  BarnesHutError error{theta};
+  for (int s = 0; s < count; ++s) {
+    // all of them if there are no more than samples
+    int i = samples >= N ? s : pick(eng);
+    BasicBoid<T> boid = load(i);
+    BasicSteeringSums<T> exact;
+    BasicSteeringSums<T> approx;
+    steeringSums(exact, boid.getPosition(), boid.getVelocity(),
+                 boid.getPar(), m_boids, 0, N, terms, &m_world);
+    tree.sums(approx, boid.getPosition(), boid.getVelocity(),
+              boid.getPar().d, theta, terms);
+    // the boid itself is always among them
+    double n = exact.neighbors;
+    double m = approx.neighbors;
+    double center = std::hypot(approx.positions.x / m - exact.positions.x / n,
+                               approx.positions.y / m - exact.positions.y / n);
+    double velocity =
+        std::hypot(approx.velocities.x / m - exact.velocities.x / n,
+                   approx.velocities.y / m - exact.velocities.y / n);
+    error.center += center / count;
+    error.maxCenter = std::max(error.maxCenter, center);
+    error.velocity += velocity / count;
+    error.maxVelocity = std::max(error.maxVelocity, velocity);
+    error.neighbors += std::abs(m - n) / n / count;
+  }
+  return error;
+}
+
+template <class T>
+void BasicFlock<T>::setThreads(int threads) {
+  m_pool = std::make_shared<ThreadPool>(threads);
+}
+
+template <class T>
+void BasicFlock<T>::updateFlock(const double delta_t) {
+  ScopedTimer tick("updateFlock");
+  int N = size();
+  if (N == 1) {
+    throw std::runtime_error{"Not enough boids"};
+  }
+  if (m_reorderEvery > 0 && m_tick % m_reorderEvery == 0) {
+    reorder();
+  }
+  double d = 0.;
+  for (auto const& par : m_par) {
+    d = std::max(d, par.d);
+  }
+  if (!m_interactions.empty()) {
+    growInteractions();
+  }
+  int layers = m_interactions.empty() ? 1 : groups();
+  // in place, a boid may take one more step before the others read it, and
+  // stays in the cell it started from: the grid and the lists reach that
+  // much further
+  double slack = 0.;
+  if (m_updateMode == UpdateMode::inPlace) {
+    for (T maxspeed : m_maxspeed) {
+      slack = std::max(slack, maxspeed * delta_t);
+    }
+  }
+  if (m_barnesHut) {
+    ScopedTimer tree("quadtree");
+    m_tree.build(m_boids, m_group, layers, m_world, *m_pool, m_scratch);
+    // for separation, which only needs the boids closer than ds
+    double ds = 0.;
+    for (auto const& par : m_par) {
+      ds = std::max(ds, par.ds);
+    }
+    // with ds 0 no boid has any, and cells of 0 would make a single one
+    // that every boid searched through: cells of d then, never searched
+    m_grid.build(m_boids, m_group, layers, ds > 0. ? ds + slack : d);
+    // the lists hold slots of the grid as it was, of cells of d + skin
+    m_lists.invalidate();
+  } else if (m_lists.skin() > 0.) {
+    ScopedTimer lists("lists");
+    if (m_lists.stale(m_boids, m_group, m_par, layers, m_world, slack)) {
+      m_grid.build(m_boids, m_group, layers,
+                   (d + m_lists.skin()) / m_lists.cellsPerReach);
+      m_lists.build(m_grid, m_boids, m_group, m_par, m_world);
+    } else {
+      // the lists hold slots of the grid, which must see the boids as
+      // they are now
+      m_grid.refresh(m_boids);
+    }
+    m_lists.use();
+  } else {
+    ScopedTimer grid("grid");
+    m_grid.build(m_boids, m_group, layers, d + slack);
+  }
+
+  if (m_updateMode == UpdateMode::inPlace) {
+    // one that crosses into another cell during the tick is looked up in the
+    // cell it started from
+    Laps laps;
+    TickAccumulators acc;
+    for (int i = 0; i < N; ++i) {
+      int neighbors;
+      BasicBoid<T> boid = advance(i, delta_t, laps, neighbors);
+      store(m_boids, i, boid);
+      m_grid.update(i, boid.getPosition(), boid.getVelocity());
+      if (m_collectStatistics) {
+        acc.add(boid, neighbors);
+      }
+      laps.lap(storeLap);
+    }
+    recordLaps(laps);
+    if (m_collectStatistics) {
+      m_statistics.record(m_tick + 1, acc.speed, acc.neighbors, delta_t);
+    }
+    ++m_tick;
+    return;
+  }
+
+  // m_boids and the grid are only read until the swap, and every boid is
+  // written by one task only. Tasks walk the boids in cell order, so that
+  // the boids of a task share their neighbors; a task in a crowded cell
+  // costs much more than one in an empty area, and idle threads steal.
+  // The laps are summed over the threads, so they are CPU time. Statistics
+  // are gathered per task and merged in task order, so they don't depend
+  // on the threads either.
+  m_next.resize(N);
+  const std::vector<int>& order = m_grid.indices();
+  Laps laps;
+  std::mutex lapsMutex;
+  Arena::Scope scope(m_scratch);
+  int tasks = m_collectStatistics ? (N + boidsPerTask - 1) / boidsPerTask : 0;
+  TickAccumulators* taskAcc = m_scratch.allocate<TickAccumulators>(tasks);
+  m_pool->parallelFor(N, boidsPerTask, [&](int begin, int end) {
+    Laps taskLaps;
+    for (int k = begin; k < end; ++k) {
+      int i = order[k];
+      int neighbors;
+      BasicBoid<T> boid = advance(i, delta_t, taskLaps, neighbors);
+      store(m_next, i, boid);
+      if (m_collectStatistics) {
+        taskAcc[begin / boidsPerTask].add(boid, neighbors);
+      }
+      taskLaps.lap(storeLap);
+    }
+    if constexpr (profiling) {
+      std::lock_guard<std::mutex> lock(lapsMutex);
+      laps.merge(taskLaps);
+    }
+  });
+  recordLaps(laps);
+  if (m_collectStatistics) {
+    TickAccumulators acc;
+    for (int k = 0; k < tasks; ++k) {
+      acc.merge(taskAcc[k]);
+    }
+    m_statistics.record(m_tick + 1, acc.speed, acc.neighbors, delta_t);
+  }
+  std::swap(m_boids, m_next);
+  ++m_tick;
+}
+
+template <class T>
+void BasicFlock<T>::updateFlockBruteForce(const double delta_t) {
+  int N = size();
+  if (N == 1) {
+    throw std::runtime_error{"Not enough boids"};
+  }
+  for (int i = 0; i < N; ++i) {
+    BasicBoid<T> boid = load(i);
+    BasicSteeringSums<T> sums;
+    if (m_interactions.empty()) {
+      steeringSums(sums, boid.getPosition(), boid.getVelocity(),
+                   boid.getPar(), m_boids, 0, N, m_terms, &m_world);
+    } else {
+      // one boid at a time, each with the weights of its group
+      for (int j = 0; j < N; ++j) {
+        Interaction w = interaction(m_group[i], m_group[j]);
+        unsigned terms = m_terms & interactionTerms(w);
+        if (j == i || terms == 0) {
+          continue;
+        }
+        BasicSteeringSums<T> part;
+        steeringSums(part, boid.getPosition(), boid.getVelocity(),
+                     boid.getPar(), m_boids, j, j + 1, terms, &m_world);
+        addWeighted(sums, part, w);
+      }
+      if (m_terms & positionsTerm) {
+        sums.positions += boid.getPosition();
+      }
+    }
+    boid.updateVelocity(m_steer(boid, sums, {N, i, id(i), m_tick}));
+    boid.updatePosition(delta_t);
+    boid.borders(m_world);
+    store(m_boids, i, boid);
+  }
+  ++m_tick;
+}
+
+template <class T>
+Statistics BasicFlock<T>::average_distance() {
+  ScopedTimer timer("statistics");
   int N = (*this).size();
   double sum_d = 0.0;
   double sum_d2 = 0.0;
-  int pair_count = 0;
+  long pair_count = 0;
   assert(N >= 2); 
 
   for (int i = 0; i < N; i++) {
     for (int j = i + 1; j < N; j++) {
-      const sf::Vector2<double>& pos1 = (*this).getBoid(i).getPosition();
-      const sf::Vector2<double>& pos2 = (*this).getBoid(j).getPosition();
+      Vec2<double> pos1{m_boids.x[i], m_boids.y[i]};
+      Vec2<double> pos2{m_boids.x[j], m_boids.y[j]};
 
       double distance1 = bd::distance(pos1, pos2);
       sum_d += distance1;
@@ -51,36 +788,270 @@ Statistics Flock::average_distance() {
   return {average_distance, sigma_d};
 }
 
-Statistics Flock::average_speed() {
-  int N = (*this).size();
-  double sum_v = 0.0;
-  double sum_v2 = 0.0;
-  assert(N >= 2); 
+template <class T>
+Statistics BasicFlock<T>::average_distance_blocked() {
+  ScopedTimer timer("statistics");
+  int N = size();
+  if (N < 2) {
+    throw std::runtime_error{"Not enough entries to run a statistics"};
+  }
+
+  // row i pairs with the columns after it, so rows get shorter and shorter;
+  // row r and row N - 1 - r together always have N - 1 pairs
+  int folded = N / 2;
+  int tasks = (folded + distanceRowsPerTask - 1) / distanceRowsPerTask;
+  std::vector<double> sums(tasks);
+  std::vector<double> sums2(tasks);
+  const T* x = m_boids.x.data();
+  const T* y = m_boids.y.data();
+
+  m_pool->parallelFor(folded, distanceRowsPerTask, [&](int begin, int end) {
+    double sum_d = 0.;
+    double sum_d2 = 0.;
+    for (int j0 = 0; j0 < N; j0 += distanceBlock) {
+      int j1 = std::min(j0 + distanceBlock, N);
+      for (int r = begin; r < end; ++r) {
+        for (int i : {r, N - 1 - r}) {
+          double xi = x[i];
+          double yi = y[i];
+#pragma omp simd reduction(+ : sum_d, sum_d2)
+          for (int j = std::max(j0, i + 1); j < j1; ++j) {
+            double dx = x[j] - xi;
+            double dy = y[j] - yi;
+            double d2 = dx * dx + dy * dy;
+            sum_d += std::sqrt(d2);
+            sum_d2 += d2;
+          }
+        }
+      }
+    }
+    sums[begin / distanceRowsPerTask] = sum_d;
+    sums2[begin / distanceRowsPerTask] = sum_d2;
+  });
 
-  for (auto const& boid : m_flock) {
-    const sf::Vector2<double>& v = boid.getVelocity();
+  double sum_d = 0.;
+  double sum_d2 = 0.;
+  for (int k = 0; k < tasks; ++k) {
+    sum_d += sums[k];
+    sum_d2 += sums2[k];
+  }
+  // with N odd the middle row is left, and it has no mirror
+  if (N % 2 == 1) {
+    int i = N / 2;
+    double xi = x[i];
+    double yi = y[i];
+    for (int j = i + 1; j < N; ++j) {
+      double dx = x[j] - xi;
+      double dy = y[j] - yi;
+      double d2 = dx * dx + dy * dy;
+      sum_d += std::sqrt(d2);
+      sum_d2 += d2;
+    }
+  }
+  return distanceStatistics(sum_d, sum_d2, 0.5 * N * (N - 1.));
+}
 
-    double speed1 = bd::magnitude(v);
-    sum_v += speed1;
-    sum_v2 += speed1 * speed1;
+template <class T>
+Statistics BasicFlock<T>::average_distance_sampled(int samples,
+                                                   unsigned seed) {
+  ScopedTimer timer("statistics");
+  int N = size();
+  if (N < 2 || samples < 2) {
+    throw std::runtime_error{"Not enough entries to run a statistics"};
+  }
+  std::mt19937 eng(seed);
+  std::uniform_int_distribution<int> first(0, N - 1);
+  std::uniform_int_distribution<int> other(0, N - 2);
+  Accumulator distance;
+  for (int k = 0; k < samples; ++k) {
+    int i = first(eng);
+    int j = other(eng);
+    j += j >= i;  // any boid but i
+    // in double whatever T is, like the two above
+    double dx = double{m_boids.x[j]} - m_boids.x[i];
+    double dy = double{m_boids.y[j]} - m_boids.y[i];
+    distance.add(std::sqrt(dx * dx + dy * dy));
   }
+  return {distance.mean(), distance.sigma()};
+}
 
+template <class T>
+Statistics BasicFlock<T>::average_speed() {
+  ScopedTimer timer("statistics");
+  int N = (*this).size();
+  assert(N >= 2);
   if (N < 2) {
     throw std::runtime_error{"Not enough entries to run a statistics"};
   }
 
-  double average_speed = sum_v / N;
+  Accumulator speed;
+  for (int i = 0; i < N; i++) {
+    speed.add(bd::magnitude(Vec2<T>{m_boids.vx[i], m_boids.vy[i]}));
+  }
+  return {speed.mean(), speed.sigma()};
+}
 
-  const double sigma_v =
-      std::sqrt((sum_v2 - N * average_speed * average_speed) / (N - 1));
+template <class T>
+void BasicFlock<T>::setParameters(const Parameters& par1) {
+  checkParameters(par1);  // once for the whole flock
+  m_par.assign(m_par.size(), par1);  // one entry per group, not per boid
+}
 
-  return {average_speed, sigma_v};
+template <class T>
+FlockState BasicFlock<T>::state() const {
+  FlockState state;
+  state.boids = BoidArrays(m_boids);
+  state.par = m_par;
+  state.maxspeed.assign(m_maxspeed.begin(), m_maxspeed.end());
+  state.group = m_group;
+  if (!m_interactions.empty()) {
+    int n = groups();
+    state.interactions.resize(n * n);
+    for (int g = 0; g < n; ++g) {
+      for (int h = 0; h < n; ++h) {
+        state.interactions[g * n + h] = interaction(g, h);
+      }
+    }
+  }
+  state.id = m_id;
+  state.world = m_world;
+  state.updateMode = m_updateMode;
+  state.reorderEvery = m_reorderEvery;
+  state.skin = m_lists.skin();
+  if (m_lists.skin() > 0. && m_lists.built()) {
+    state.listX.assign(m_lists.builtX().begin(), m_lists.builtX().end());
+    state.listY.assign(m_lists.builtY().begin(), m_lists.builtY().end());
+    state.listGroup = m_lists.builtGroup();
+    state.listD = m_lists.builtD();
+    state.listLayers = m_lists.builtLayers();
+  }
+  state.tick = m_tick;
+  return state;
 }
 
-void Flock::setParameters(const Parameters& par1) { 
-  for (auto& boid : m_flock) {
-    boid.setPar(par1); //assert statements included in call to setPar
-  };
+template <class T>
+void BasicFlock<T>::restore(const FlockState& state) {
+  int N = state.boids.size();
+  if (state.boids.y.size() != state.boids.x.size() ||
+      state.boids.vx.size() != state.boids.x.size() ||
+      state.boids.vy.size() != state.boids.x.size() ||
+      state.maxspeed.size() != state.par.size()) {
+    throw std::runtime_error{"The arrays of the flock state differ in size"};
+  }
+  std::vector<Parameters> pars;
+  std::vector<T> maxspeeds;
+  std::vector<std::uint16_t> group;
+  if (state.group.empty()) {
+    // one entry per boid
+    if (static_cast<int>(state.par.size()) != N) {
+      throw std::runtime_error{"The arrays of the flock state differ in size"};
+    }
+    group.resize(N);
+    for (int i = 0; i < N; ++i) {
+      group[i] = findGroup(pars, maxspeeds, i > 0 ? group[i - 1] : 0,
+                           state.par[i], static_cast<T>(state.maxspeed[i]));
+    }
+  } else {
+    if (static_cast<int>(state.group.size()) != N ||
+        state.par.size() > std::numeric_limits<std::uint16_t>::max() + 1u) {
+      throw std::runtime_error{"The arrays of the flock state differ in size"};
+    }
+    for (auto g : state.group) {
+      if (g >= state.par.size()) {
+        throw std::runtime_error{"No such group"};
+      }
+    }
+    pars = state.par;
+    maxspeeds.assign(state.maxspeed.begin(), state.maxspeed.end());
+    group = state.group;
+  }
+  std::size_t n = pars.size();
+  if (!state.interactions.empty() && state.interactions.size() != n * n) {
+    throw std::runtime_error{"The interactions do not match the groups"};
+  }
+  bool ones = true;
+  for (auto const& w : state.interactions) {
+    if (!std::isfinite(w.s) || !std::isfinite(w.a) || !std::isfinite(w.c)) {
+      throw std::runtime_error{"Interaction weights must be finite"};
+    }
+    ones = ones && w.s == 1. && w.a == 1. && w.c == 1.;
+  }
+  for (auto const& par : pars) {
+    checkParameters(par);
+  }
+  std::vector<int> index;
+  if (!state.id.empty()) {
+    if (static_cast<int>(state.id.size()) != N) {
+      throw std::runtime_error{"The arrays of the flock state differ in size"};
+    }
+    index.assign(N, -1);
+    for (int i = 0; i < N; ++i) {
+      int id = state.id[i];
+      if (id < 0 || id >= N || index[id] != -1) {
+        throw std::runtime_error{"The ids of the boids are not unique"};
+      }
+      index[id] = i;
+    }
+  }
+  if (state.reorderEvery < 0) {
+    throw std::runtime_error{"The ticks between reorders must be positive"};
+  }
+  if (!(state.skin >= 0.)) {
+    throw std::runtime_error{"The skin must be positive"};
+  }
+  if (!state.listX.empty()) {
+    bool valid = static_cast<int>(state.listX.size()) == N &&
+                 static_cast<int>(state.listY.size()) == N &&
+                 static_cast<int>(state.listGroup.size()) == N &&
+                 !state.listD.empty() && state.listLayers >= 1;
+    for (int i = 0; valid && i < N; ++i) {
+      valid = state.listGroup[i] < state.listD.size() &&
+              (state.listLayers == 1 || state.listGroup[i] < state.listLayers);
+    }
+    for (double d : state.listD) {
+      valid = valid && d >= 0.;
+    }
+    if (!valid) {
+      throw std::runtime_error{
+          "The Verlet lists of the flock state are damaged"};
+    }
+  }
+  setWorld(state.world);
+  m_boids = BasicBoidArrays<T>(state.boids);
+  m_par = std::move(pars);
+  m_maxspeed = std::move(maxspeeds);
+  m_group = std::move(group);
+  m_interactions.clear();
+  m_interactionGroups = 0;
+  if (!ones) {
+    m_interactions = state.interactions;
+    m_interactionGroups = n;
+  }
+  m_id = state.id;
+  m_index = std::move(index);
+  m_updateMode = state.updateMode;
+  m_reorderEvery = state.reorderEvery;
+  m_tick = state.tick;
+  // the lists as they were saved, from the grid they were built with; the
+  // next tick refreshes it to the boids as they are now
+  m_lists.setSkin(state.skin);
+  if (!state.listX.empty()) {
+    BasicBoidArrays<T> from;
+    from.resize(N);
+    for (int i = 0; i < N; ++i) {
+      from.x[i] = state.listX[i];
+      from.y[i] = state.listY[i];
+    }
+    std::vector<Parameters> par(state.listD.size());
+    double d = 0.;
+    for (std::size_t g = 0; g < par.size(); ++g) {
+      par[g].d = state.listD[g];
+      d = std::max(d, par[g].d);
+    }
+    m_grid.build(from, state.listGroup, state.listLayers,
+                 (d + state.skin) / m_lists.cellsPerReach);
+    m_lists.build(m_grid, from, state.listGroup, par, m_world);
+  }
 }
 
 void histogram(std::vector<double> entries, std::vector<double> errors,  double norm) {
@@ -101,4 +1072,10 @@ void histogram(std::vector<double> entries, std::vector<double> errors,  double
     
   }
 }
+
+template class BasicBoidRef<double>;
+template class BasicBoidRef<float>;
+template class BasicFlock<double>;
+template class BasicFlock<float>;
+
 } 
\ No newline at end of file
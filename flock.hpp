@@ -2,7 +2,19 @@
 #ifndef FLOCK_HPP
 #define FLOCK_HPP
 
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "arena.hpp"
 #include "boid.hpp"
+#include "grid.hpp"
+#include "profiler.hpp"
+#include "quadtree.hpp"
+#include "rules.hpp"
+#include "statistics.hpp"
+#include "threadpool.hpp"
+#include "verlet.hpp"
 
 namespace bd {
 
@@ -13,32 +25,338 @@ namespace bd {
     double sigma{};
   };
 
-class Flock {
-  std::vector<Boid> m_flock;
+// how far the sums of Barnes-Hut with theta are from the exact ones, on
+// average over the boids sampled: the center of mass of the neighbors, in
+// units of the world, their velocity relative to the boid, and how many
+// they are, relative to the exact number
+struct BarnesHutError {
+  double theta{};
+  double center{};
+  double maxCenter{};
+  double velocity{};
+  double maxVelocity{};
+  double neighbors{};
+};
+
+template <class T>
+class BasicFlock;
+
+// proxy for the i-th boid of a Flock, with the accessors of Boid
+template <class T>
+class BasicBoidRef {
+  BasicFlock<T>* m_flock;
+  int m_i;
+
+ public:
+  BasicBoidRef(BasicFlock<T>& flock, int i) : m_flock(&flock), m_i(i) {}
+
+  Vec2<T> getPosition() const;
+  void setPosition(const Vec2<T>& newPos);
+
+  Vec2<T> getVelocity() const;
+  void setVelocity(const Vec2<T>& newVel);
+
+  Parameters getPar() const;
+  void setPar(const Parameters& newPar);
+
+  T getMaxspeed() const;
+  void setMaxspeed(T new_Maxspeed);
+
+  operator BasicBoid<T>() const;
+};
+
+// inPlace: boids are updated one after the other, and each one sees the
+// boids before it already moved (the original behaviour). The grid and the
+// Verlet lists look one step of the fastest boid further, so none that
+// moved into reach is missed.
+// doubleBuffered: every boid reads the state at the start of the tick and
+// the new state is written to a second buffer, so the result does not
+// depend on the order of the updates and the work can be split in threads.
+enum class UpdateMode { inPlace, doubleBuffered };
+
+// weights of separation, alignment and cohesion for the boids of one group
+// steering with respect to the boids of another; negative ones turn a rule
+// around, e.g. prey with a negative cohesion towards predators flee them
+struct Interaction {
+  double s{1};
+  double a{1};
+  double c{1};
+};
+
+// everything a run depends on, to save it and continue it later: see
+// Flock::state() and checkpoint.hpp. Kept in double for flocks of any
+// scalar, since a float converts to double and back without loss.
+struct FlockState {
+  BoidArrays boids;
+  // Parameters and maxspeed of every group and the group of every boid;
+  // with group empty, par and maxspeed hold one entry per boid instead, and
+  // boids with the same ones are put in a group
+  std::vector<Parameters> par;
+  std::vector<double> maxspeed;
+  std::vector<std::uint16_t> group;
+  // groups x groups weights, row by row; empty when they are all 1
+  std::vector<Interaction> interactions;
+  // the id of every boid, empty when boid i has id i
+  std::vector<int> id;
+  World world;
+  UpdateMode updateMode{UpdateMode::inPlace};
+  int reorderEvery{};
+  // the skin of the Verlet lists, and what they were last built from (see
+  // BasicVerletLists::stale()): listX, listY and listGroup per boid, listD
+  // per group, all empty when they are to be built anew. A restored flock
+  // builds them again from these, so it searches for neighbors on the same
+  // ticks and sums them in the same order as the one saved.
+  double skin{};
+  std::vector<double> listX;
+  std::vector<double> listY;
+  std::vector<std::uint16_t> listGroup;
+  std::vector<double> listD;
+  int listLayers{};
+  long tick{};      // updates done, the tick seen by the rules
+  std::string rng;  // state of the caller's random engine, if any
+};
+
+template <class T>
+class BasicFlock {
+  // positions and velocities are the only data read in the neighbor loop,
+  // parameters and maxspeed are looked up once per boid, through its group
+  BasicBoidArrays<T> m_boids;
+  BasicBoidArrays<T> m_next;  // written during a double buffered tick
+  std::vector<Parameters> m_par;        // per group
+  std::vector<T> m_maxspeed;            // per group
+  std::vector<std::uint16_t> m_group;   // per boid
+  // id of every boid and index of every id, empty until a reorder()
+  std::vector<int> m_id;
+  std::vector<int> m_index;
+  int m_reorderEvery{};
+  std::vector<std::uint32_t> m_keys;  // scratch of reorder()
+  std::vector<int> m_order;
+  // m_interactionGroups x m_interactionGroups, row by row, empty when all
+  // the weights are 1; groups added later weigh 1 with all the others
+  std::vector<Interaction> m_interactions;
+  int m_interactionGroups{};
+  World m_world;
+  BasicGrid<T> m_grid{m_world.width, m_world.height};
+  BasicVerletLists<T> m_lists;
+  BasicQuadtree<T> m_tree;
+  bool m_barnesHut{false};
+  double m_theta{0.5};
+  UpdateMode m_updateMode{UpdateMode::inPlace};
+  // copies of a flock share the pool, which runs one update at a time
+  std::shared_ptr<ThreadPool> m_pool{std::make_shared<ThreadPool>(1)};
+  // buffers that only live for a tick, or for a reorder(): a copy of the
+  // flock gets an empty one
+  Arena m_scratch;
+  FlockStatistics m_statistics;
+  bool m_collectStatistics{true};
+  // steering of the rules set by setRules(), and the sums they read
+  Vec2<T> (*m_steer)(const BasicBoid<T>&, const BasicSteeringSums<T>&,
+                     const RuleContext&){&DefaultRules::steer<T>};
+  unsigned m_terms{DefaultRules::terms};
+  long m_tick{};
+
+  // the group with par and maxspeed, made if there is none: unchecked, as
+  // the parameters of a Boid
+  int groupOf(const Parameters& par, T maxspeed);
+  // throws unless group is one of groups()
+  void checkGroup(int group) const;
+  BasicBoid<T> load(int i) const;
+  // the id of a boid just added, once there are ids
+  void addId();
+  // m_interactions over all the groups, the new ones weighing 1
+  void growInteractions();
+  // steeringSums() of boid i over the groups it interacts with, weighted
+  void groupSums(int i, const BasicBoid<T>& boid, unsigned terms,
+                 BasicSteeringSums<T>& sums) const;
+  // the same over the Verlet list of boid i
+  void listSums(int i, const BasicBoid<T>& boid, unsigned terms,
+                BasicSteeringSums<T>& sums) const;
+  // the same with Barnes-Hut, the displacements through the grid
+  void treeSums(int i, const BasicBoid<T>& boid, unsigned terms,
+                BasicSteeringSums<T>& sums) const;
+  static void store(BasicBoidArrays<T>& arrays, int i, const BasicBoid<T>& b);
+  // steering, integration and borders() of boid i, with the grid or the
+  // lists built; laps gets the time of each of them, neighbors the other
+  // boids in range
+  BasicBoid<T> advance(int i, double delta_t, Laps& laps,
+                       int& neighbors) const;
+
+  friend class BasicBoidRef<T>;
 
  public:
 
-  int size() const { return m_flock.size(); }
+  int size() const { return m_boids.size(); }
+
+  const BasicBoidArrays<T>& arrays() const { return m_boids; }
+
+  BasicBoid<T> getBoid(int i) const;
+  BasicBoidRef<T> getBoid(int i);
+
+  // appends b to the group with its parameters and maxspeed
+  void addBoid(const BasicBoid<T>& b);
+  void addBoid(const Vec2<T>& position, const Vec2<T>& velocity, int group);
+
+  // Boids with the same Parameters and maxspeed share them in a group, and
+  // hold its index only; the parameters of a group are checked once, when
+  // they are set, and changing them changes all of its boids at once.
+  int groups() const { return m_par.size(); }
+  // a new group, empty, after checking par; returns its index
+  int addGroup(const Parameters& par, T maxspeed);
+  const Parameters& groupPar(int group) const { return m_par[group]; }
+  void setGroupPar(int group, const Parameters& par);
+  T groupMaxspeed(int group) const { return m_maxspeed[group]; }
+  void setGroupMaxspeed(int group, T maxspeed);
+  int group(int i) const { return m_group[i]; }
+  void setGroup(int i, int group);
+
+  // Groups as species: the sums a boid of group from gathers over the boids
+  // of group to are scaled by interaction(from, to), 1 by default. When
+  // some weight is not 1 the grid keeps the boids of each group together,
+  // and the groups whose weights are all 0 are not searched at all. The
+  // boid itself always counts once in the positions and the neighbors.
+  Interaction interaction(int from, int to) const;
+  void setInteraction(int from, int to, const Interaction& weights);
+
+  const World& world() const { return m_world; }
+  void setWorld(const World& world);
+
+  const BasicGrid<T>& grid() const { return m_grid; }
+
+  // The boids are kept in the order they were added until reorder() sorts
+  // them along a Z-order curve over the world (see morton.hpp), so that
+  // boids close in the world are close in memory too: the grid, the lists
+  // and the updates then walk the arrays in runs instead of all over them.
+  // With reorderEvery() K, not 0, updateFlock() reorders on the ticks that
+  // are multiples of K. The index of a boid changes with a reorder, its id
+  // does not: ids are 0, 1, ... in the order the boids were added, and
+  // arraysById() gives the boids in that order, as to be recorded or
+  // shown. In place, where every boid sees the ones before it already
+  // moved, a reorder changes the order of the updates and so the flock.
+  int reorderEvery() const { return m_reorderEvery; }
+  void setReorderEvery(int ticks);
+  void reorder();
+  int id(int i) const { return m_id.empty() ? i : m_id[i]; }
+  int indexOf(int id) const { return m_index.empty() ? id : m_index[id]; }
+  void arraysById(BasicBoidArrays<T>& boids) const;
+
+  // Verlet lists, off with skin 0 (the default): with a skin, the
+  // neighbors of each boid are looked for within d + skin, and only looked
+  // for again when some boid has moved more than skin / 2 since then (less
+  // a step at maxspeed in place). The sums are the same as through the
+  // grid, added up in another order; verletLists() tells how often the
+  // lists were built and how much memory they take. Worth it when the
+  // boids move a small part of skin per tick.
+  double skin() const { return m_lists.skin(); }
+  void setSkin(double skin) { m_lists.setSkin(skin); }
+  const BasicVerletLists<T>& verletLists() const { return m_lists; }
+  BasicVerletLists<T>& verletLists() { return m_lists; }
 
-  auto& flock() { return m_flock; }
-  const auto& flock() const { return m_flock; }
+  // Barnes-Hut, off by default: the sums of alignment and cohesion come
+  // from a quadtree built every tick, where the boids far enough away, as
+  // told by the opening angle theta, are taken a node at a time (see
+  // quadtree.hpp); separation stays exact, through a grid of cells of ds.
+  // Meant for a d so large that every boid has much of the flock in range,
+  // where the grid and the lists are no help; it takes the place of the
+  // lists when both are on. In place, the tree holds the boids as they
+  // were at the start of the tick. barnesHutError() measures what theta
+  // costs in accuracy against the exact sums.
+  bool barnesHut() const { return m_barnesHut; }
+  double theta() const { return m_theta; }
+  void setBarnesHut(bool on, double theta = 0.5);
+  const BasicQuadtree<T>& quadtree() const { return m_tree; }
+  BarnesHutError barnesHutError(double theta, int samples,
+                                unsigned seed = 1) const;
 
+  UpdateMode updateMode() const { return m_updateMode; }
+  void setUpdateMode(UpdateMode mode) { m_updateMode = mode; }
 
-  Boid getBoid(int i) const;
-  Boid& getBoid(int i);
+  // threads used by double buffered updates, the calling one included
+  int threads() const { return m_pool->size(); }
+  void setThreads(int threads);
+  // per thread work done by the pool, to check the load balancing
+  std::vector<ThreadStats> threadStats() const { return m_pool->stats(); }
+  void resetThreadStats() { m_pool->resetStats(); }
 
-  void addBoid(const Boid& b);
+  // Everything a tick needs is kept between ticks: the grid, the lists and
+  // the tree in members that only grow with the flock, the buffers that
+  // don't outlive the tick in an Arena. Once a few ticks have run, with the
+  // same boids and settings, a tick takes no memory from the heap; so does
+  // the statistics series once it is full (see FlockStatistics).
+  const Arena& scratch() const { return m_scratch; }
 
+  // speed and neighbors of every tick of updateFlock(), gathered during
+  // the steering pass when collectStatistics() is on
+  const FlockStatistics& statistics() const { return m_statistics; }
+  FlockStatistics& statistics() { return m_statistics; }
+  bool collectStatistics() const { return m_collectStatistics; }
+  void setCollectStatistics(bool collect) { m_collectStatistics = collect; }
+
+  // steering rules of the updates, DefaultRules to start with; e.g.
+  // setRules<Separation, Cohesion, Wander>(), see rules.hpp. The neighbor
+  // loop only gathers the sums they read.
+  template <class... R>
+  void setRules() {
+    m_steer = &Rules<R...>::template steer<T>;
+    m_terms = Rules<R...>::terms;
+  }
+  // updates done so far
+  long tick() const { return m_tick; }
+
+  // neighbor search through the grid, rebuilt every tick with cell size d,
+  // through the Verlet lists when skin() is not 0, or Barnes-Hut
   void updateFlock(double const delta_t);
+  // every boid against every other one, kept as reference for the grid
+  void updateFlockBruteForce(double const delta_t);
 
+  // mean and sigma of the distance over all the pairs of boids, one pair
+  // after the other: the reference for the two below
   Statistics average_distance();
+  // the same over all the pairs, in blocks of rows that fit the cache, split
+  // across threads(); the sums are added up in a fixed order, so the result
+  // doesn't depend on the number of threads
+  Statistics average_distance_blocked();
+  // estimate from samples pairs drawn at random: the mean is off by less
+  // than sigma / sqrt(samples) about two times out of three, and by less
+  // than three times that almost always
+  Statistics average_distance_sampled(int samples, unsigned seed = 1);
 
   Statistics average_speed();
 
+  // the same parameters for every group, checked once
   void setParameters(const Parameters& par1);
 
+  // copy of the boids and of the settings the updates depend on, rules
+  // apart; rng is left empty
+  FlockState state() const;
+  // continues from state as if it had never stopped: the updates that
+  // follow give the same flock, bit for bit
+  void restore(const FlockState& state);
+};
+
+// a flock with the rules R... from the start, as in
+// RuleFlock<Separation, Alignment, Cohesion, Wander>
+template <class T, class... R>
+class BasicRuleFlock : public BasicFlock<T> {
+ public:
+  BasicRuleFlock() { this->template setRules<R...>(); }
 };
 
+using BoidRef = BasicBoidRef<double>;
+using Flock = BasicFlock<double>;
+
+using BoidRefF = BasicBoidRef<float>;
+using FlockF = BasicFlock<float>;
+
+template <class... R>
+using RuleFlock = BasicRuleFlock<double, R...>;
+template <class... R>
+using RuleFlockF = BasicRuleFlock<float, R...>;
+
+extern template class BasicBoidRef<double>;
+extern template class BasicBoidRef<float>;
+extern template class BasicFlock<double>;
+extern template class BasicFlock<float>;
+
 }  // namespace bd
 
 #endif
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace bd {
+
+template <class T>
+BasicGrid<T>::BasicGrid(double width, double height, bool periodic)
+    : m_width(width),
+      m_height(height),
+      m_cellWidth(width),
+      m_cellHeight(height),
+      m_periodic(periodic) {
+  if (width <= 0. || height <= 0.) {
+    throw std::runtime_error{"The world size must be positive"};
+  }
+}
+
+template <class T>
+void BasicGrid<T>::build(const BasicBoidArrays<T>& boids, double cellSize) {
+  build(boids, {}, 1, cellSize);
+}
+
+template <class T>
+void BasicGrid<T>::build(const BasicBoidArrays<T>& boids,
+                         const std::vector<std::uint16_t>& layer, int layers,
+                         double cellSize) {
+  m_layers = layers;
+  m_cols = 1;
+  m_rows = 1;
+  if (cellSize > 0.) {
+    // cells never narrower than cellSize, and never more than
+    // maxCellsPerSide per side when d is tiny
+    m_cols = static_cast<int>(std::clamp(std::floor(m_width / cellSize), 1.,
+                                         double{maxCellsPerSide}));
+    m_rows = static_cast<int>(std::clamp(std::floor(m_height / cellSize), 1.,
+                                         double{maxCellsPerSide}));
+  }
+  m_cellWidth = m_width / m_cols;
+  m_cellHeight = m_height / m_rows;
+
+  int N = boids.size();
+  int cells = cellCount();
+  int buckets = layers * cells;
+  m_cellStart.assign(buckets + 1, 0);
+  m_cellOf.resize(N);
+  m_indices.resize(N);
+  m_slot.resize(N);
+  m_sorted.resize(N);
+
+  for (int i = 0; i < N; ++i) {
+    int c = cell(boids.x[i], boids.y[i]);
+    if (layers > 1) {
+      c += layer[i] * cells;
+    }
+    m_cellOf[i] = c;
+    ++m_cellStart[c + 1];
+  }
+  for (int c = 0; c < buckets; ++c) {
+    m_cellStart[c + 1] += m_cellStart[c];
+  }
+  // m_cellStart[c] is used as insertion cursor and ends up at the start of
+  // cell c + 1, so shift everything back by one afterwards
+  for (int i = 0; i < N; ++i) {
+    int k = m_cellStart[m_cellOf[i]]++;
+    m_indices[k] = i;
+    m_slot[i] = k;
+    m_sorted.x[k] = boids.x[i];
+    m_sorted.y[k] = boids.y[i];
+    m_sorted.vx[k] = boids.vx[i];
+    m_sorted.vy[k] = boids.vy[i];
+  }
+  for (int c = buckets; c > 0; --c) {
+    m_cellStart[c] = m_cellStart[c - 1];
+  }
+  m_cellStart[0] = 0;
+}
+
+template <class T>
+int BasicGrid<T>::cell(double x, double y) const {
+  // positions outside the world (before borders() runs) are clamped to the
+  // edge cells, which never moves two boids more than one cell apart
+  int col = static_cast<int>(
+      std::clamp(std::floor(x / m_cellWidth), 0., m_cols - 1.));
+  int row = static_cast<int>(
+      std::clamp(std::floor(y / m_cellHeight), 0., m_rows - 1.));
+  return row * m_cols + col;
+}
+
+template <class T>
+void BasicGrid<T>::update(int i, const Vec2<T>& position,
+                          const Vec2<T>& velocity) {
+  int k = m_slot[i];
+  m_sorted.x[k] = position.x;
+  m_sorted.y[k] = position.y;
+  m_sorted.vx[k] = velocity.x;
+  m_sorted.vy[k] = velocity.y;
+}
+
+template <class T>
+void BasicGrid<T>::refresh(const BasicBoidArrays<T>& boids) {
+  int N = m_indices.size();
+  for (int k = 0; k < N; ++k) {
+    int i = m_indices[k];
+    m_sorted.x[k] = boids.x[i];
+    m_sorted.y[k] = boids.y[i];
+    m_sorted.vx[k] = boids.vx[i];
+    m_sorted.vy[k] = boids.vy[i];
+  }
+}
+
+template <class T>
+int BasicGrid<T>::neighbors(double x, double y, Spans& spans,
+                            int layer) const {
+  int c = cell(x, y);
+  int first = layer * cellCount();
+  int col = c % m_cols;
+  int row = c / m_cols;
+  int n = 0;
+
+  if (!m_periodic) {
+    // the block cut at the edges of the world: one span per row
+    int colBegin = std::max(col - 1, 0);
+    int colEnd = std::min(col + 2, m_cols);
+    for (int r = std::max(row - 1, 0); r < std::min(row + 2, m_rows); ++r) {
+      int rowStart = first + r * m_cols;
+      spans[n++] = {m_cellStart[rowStart + colBegin],
+                    m_cellStart[rowStart + colEnd]};
+    }
+    return n;
+  }
+
+  // with fewer than three cells on a side the wrapped 3x3 block would visit
+  // the same cell twice, so take the whole side instead
+  int nRows = std::min(m_rows, 3);
+  int firstRow = m_rows < 3 ? 0 : row - 1 + m_rows;
+
+  for (int j = 0; j < nRows; ++j) {
+    int rowStart = first + (firstRow + j) % m_rows * m_cols;
+    // cells next to each other in a row are contiguous in sorted()
+    if (m_cols < 3) {
+      spans[n++] = {m_cellStart[rowStart], m_cellStart[rowStart + m_cols]};
+    } else if (col == 0) {
+      spans[n++] = {m_cellStart[rowStart], m_cellStart[rowStart + 2]};
+      spans[n++] = {m_cellStart[rowStart + m_cols - 1],
+                    m_cellStart[rowStart + m_cols]};
+    } else if (col == m_cols - 1) {
+      spans[n++] = {m_cellStart[rowStart + col - 1],
+                    m_cellStart[rowStart + m_cols]};
+      spans[n++] = {m_cellStart[rowStart], m_cellStart[rowStart + 1]};
+    } else {
+      spans[n++] = {m_cellStart[rowStart + col - 1],
+                    m_cellStart[rowStart + col + 2]};
+    }
+  }
+  return n;
+}
+
+template <class T>
+void BasicGrid<T>::within(double x, double y, double radius, int layer,
+                          std::vector<Span>& spans) const {
+  // a boid outside the world is in the cell of the nearest point inside,
+  // which is never farther from the others than the boid itself
+  x = std::clamp(x, 0., m_width);
+  y = std::clamp(y, 0., m_height);
+  int first = layer * cellCount();
+  auto add = [&](int rowStart, int begin, int end) {
+    if (m_cellStart[rowStart + begin] < m_cellStart[rowStart + end]) {
+      spans.push_back(
+          {m_cellStart[rowStart + begin], m_cellStart[rowStart + end]});
+    }
+  };
+
+  int row0 = static_cast<int>(std::floor((y - radius) / m_cellHeight));
+  int row1 = static_cast<int>(std::floor((y + radius) / m_cellHeight));
+  if (!m_periodic) {
+    row0 = std::max(row0, 0);
+    row1 = std::min(row1, m_rows - 1);
+  } else if (row1 - row0 + 1 > m_rows) {
+    // every row once, as seen from the nearest of its images
+    row0 = static_cast<int>(std::floor(y / m_cellHeight)) - m_rows / 2;
+    row1 = row0 + m_rows - 1;
+  }
+  for (int r = row0; r <= row1; ++r) {
+    // the widest part of the circle within the row
+    double below = r * m_cellHeight - y;
+    double above = y - (r + 1) * m_cellHeight;
+    double dy = std::max({below, above, 0.});
+    double half = std::sqrt(std::max(radius * radius - dy * dy, 0.));
+    int col0 = static_cast<int>(std::floor((x - half) / m_cellWidth));
+    int col1 = static_cast<int>(std::floor((x + half) / m_cellWidth));
+    int rowStart = first + (r % m_rows + m_rows) % m_rows * m_cols;
+    if (!m_periodic) {
+      add(rowStart, std::max(col0, 0), std::min(col1, m_cols - 1) + 1);
+    } else if (col1 - col0 + 1 >= m_cols) {
+      add(rowStart, 0, m_cols);
+    } else {
+      // cells next to each other in a row are contiguous in sorted()
+      int begin = (col0 % m_cols + m_cols) % m_cols;
+      int end = begin + col1 - col0 + 1;
+      if (end <= m_cols) {
+        add(rowStart, begin, end);
+      } else {
+        add(rowStart, begin, m_cols);
+        add(rowStart, 0, end - m_cols);
+      }
+    }
+  }
+}
+
+template class BasicGrid<double>;
+template class BasicGrid<float>;
+
+}  // namespace bd
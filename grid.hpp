@@ -0,0 +1,94 @@
+#pragma once
+#ifndef GRID_HPP
+#define GRID_HPP
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "boid.hpp"
+
+namespace bd {
+
+// Uniform cell grid over the World of Boid::borders(), toroidal or not, see
+// periodic() and neighbors(). Boid indices
+// are bucketed by cell with a counting sort, so the boids of cell c are
+// indices()[cellStart(c)] ... indices()[cellStart(c + 1) - 1], and sorted()
+// holds their positions and velocities in the same order.
+// Built with layers, boids are bucketed by layer first and by cell within
+// it: the boids of a layer are contiguous, and cell c of layer l is entry
+// l * cellCount() + c of cellStart().
+template <class T>
+class BasicGrid {
+  double m_width;
+  double m_height;
+  double m_cellWidth;
+  double m_cellHeight;
+  int m_cols{1};
+  int m_rows{1};
+  int m_layers{1};
+  bool m_periodic;
+  std::vector<int> m_cellStart;
+  std::vector<int> m_indices;
+  std::vector<int> m_cellOf;
+  std::vector<int> m_slot;
+  BasicBoidArrays<T> m_sorted;
+
+ public:
+  static constexpr int maxCellsPerSide{1024};
+
+  // contiguous range of sorted()
+  using Span = Range;
+  // three rows, split in two where the columns wrap around
+  using Spans = std::array<Span, 6>;
+
+  BasicGrid(double width, double height, bool periodic = true);
+
+  double width() const { return m_width; }
+  double height() const { return m_height; }
+  bool periodic() const { return m_periodic; }
+  int cols() const { return m_cols; }
+  int rows() const { return m_rows; }
+  int cellCount() const { return m_cols * m_rows; }
+
+  int layers() const { return m_layers; }
+
+  // cells are at least cellSize wide, so every boid closer than cellSize is
+  // found in the 3x3 block around a cell
+  void build(const BasicBoidArrays<T>& boids, double cellSize);
+  // the same with boid i in layer layer[i], below layers
+  void build(const BasicBoidArrays<T>& boids,
+             const std::vector<std::uint16_t>& layer, int layers,
+             double cellSize);
+
+  int cell(double x, double y) const;
+  int cellStart(int c) const { return m_cellStart[c]; }
+  const std::vector<int>& indices() const { return m_indices; }
+  const BasicBoidArrays<T>& sorted() const { return m_sorted; }
+  int slot(int i) const { return m_slot[i]; }
+
+  // keeps sorted() in step with a boid updated in place during the tick
+  void update(int i, const Vec2<T>& position, const Vec2<T>& velocity);
+  // sorted() from boids as they are now, in the order of the last build
+  void refresh(const BasicBoidArrays<T>& boids);
+
+  // ranges of sorted() covering the 3x3 cells around (x, y) in layer,
+  // wrapping at the borders if periodic(), cut at them otherwise; returns
+  // how many of spans are filled
+  int neighbors(double x, double y, Spans& spans, int layer = 0) const;
+  // the same for the cells within radius of (x, y), any number of cells
+  // away: one range per row, two where the row wraps, empty ones left out,
+  // appended to spans
+  void within(double x, double y, double radius, int layer,
+              std::vector<Span>& spans) const;
+};
+
+using Grid = BasicGrid<double>;
+using GridF = BasicGrid<float>;
+
+extern template class BasicGrid<double>;
+extern template class BasicGrid<float>;
+
+}  // namespace bd
+
+#endif
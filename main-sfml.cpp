@@ -1,14 +1,21 @@
 #include <SFML/Graphics.hpp>
 #include <SFML/System.hpp>
 #include <SFML/Window.hpp>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <memory>
 #include <random>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "boid.hpp"
 #include "flock.hpp"
+#include "profiler.hpp"
+#include "renderer.hpp"
+#include "simulation.hpp"
+#include "trajectory.hpp"
 
 void ignoreLine() {
   std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
@@ -18,7 +25,6 @@ int main() {
   try {
     int N{};  // number of boids
     char cmd;
-    double rotation{};
 
     bd::Flock flock1;
     int screenWidth{1280};
@@ -37,6 +43,7 @@ int main() {
     std::cout << "Valid commands:\n"
               << "[g] to generate a flock\n"
               << "[b] to view the boids\n"
+              << "[r] to replay a recorded trajectory\n"
               << "[q] to quit.\n";
 
     while (std::cin >> cmd) {
@@ -109,14 +116,15 @@ int main() {
                                   "Boids");
           window.setFramerateLimit(60);
 
-          sf::Clock clock;
+          // la simulazione gira in un suo thread a passo fisso, qui si
+          // disegna l'interpolazione tra gli ultimi due tick
+          bd::Simulation simulation(flock1, 1. / 60.);
+          simulation.start();
+          bd::FlockRenderer renderer(triangleSide);
+          bd::BoidArrays frame;
 
           while (window.isOpen()) {
             sf::Event event;
-            sf::Time elapsed = clock.restart();
-            double delta_t =
-                elapsed.asSeconds();  // to make boid movement independent from
-                                      // frame rate
             while (window.pollEvent(event)) {
               if ((event.type ==
                    sf::Event::Closed) ||  // press X button to quit
@@ -128,9 +136,9 @@ int main() {
             }
             //flock1.updateFlock(delta_t);
             /*for (bd::Boid& boid : flock1.flock()) {
-            sf::Vector2<double>  v1 = boid.separation(flock1.flock());
-            sf::Vector2<double>  v2 = boid.alignment(flock1.flock());
-            sf::Vector2<double>  v3 = boid.cohesion(flock1.flock());
+            bd::Vec2<double>  v1 = boid.separation(flock1.flock());
+            bd::Vec2<double>  v2 = boid.alignment(flock1.flock());
+            bd::Vec2<double>  v3 = boid.cohesion(flock1.flock());
 
             std::cout << "v1 " << v1.x << "\n";
             std::cout << "v1 " << v1.y << "\n";
@@ -140,7 +148,17 @@ int main() {
             std::cout << "v3 " << v3.y << "\n";
           }*/
 
-          flock1.updateFlock(delta_t);
+            if (!simulation.running()) {
+              window.close();
+            }
+
+            {
+              bd::ScopedTimer timer("interpolate");
+              const bd::Snapshot& snapshot = simulation.latest();
+              bd::interpolate(snapshot.previous, snapshot.current,
+                              simulation.alpha(snapshot), flock1.world(),
+                              frame);
+            }
 
           /*for (bd::Boid& boid : flock1.flock()) {
 
@@ -152,24 +170,77 @@ int main() {
 
             window.clear();
 
-            
-
-            // Draw boids
-            for (const bd::Boid& boid : flock1.flock()) {
-              sf::ConvexShape shape;
-              shape.setPosition(boid.getPosition().x, boid.getPosition().y);
-              shape.setPointCount(3);
-              shape.setPoint(0, sf::Vector2f(-triangleSide, triangleSide));
-              shape.setPoint(1, sf::Vector2f(triangleSide, triangleSide));
-              shape.setPoint(2, sf::Vector2f(0, 5 * triangleSide));
-              shape.setFillColor(sf::Color::White);
-              rotation = bd::angle(boid.getVelocity());
-              shape.setRotation(270 +(rotation * 180 )/
-                                M_PI);  // conversione da radianti a gradi
-
-              window.draw(shape);
+            {
+              bd::ScopedTimer timer("draw");
+              // tutti i boid con una sola chiamata di draw
+              renderer.update(frame);
+              window.draw(renderer);
             }
 
+            {
+              bd::ScopedTimer timer("display");
+              window.display();
+            }
+          }
+          simulation.stop();
+          flock1 = simulation.flock();
+          if (bd::profiling) {
+            bd::profiler().print(std::cout);
+          }
+          break;
+        }
+        case 'r': {
+          std::cout << "Enter the trajectory file (see boid-sim --record): ";
+          std::string path;
+          std::cin >> path;
+          ignoreLine();
+
+          std::unique_ptr<bd::TrajectoryReader> reader;
+          try {
+            reader = std::make_unique<bd::TrajectoryReader>(path);
+          } catch (std::exception const& e) {
+            std::cout << e.what() << '\n';
+            break;
+          }
+          const bd::TrajectoryHeader& header = reader->header();
+          if (reader->frames() == 0 || header.delta_t <= 0.) {
+            std::cout << "The trajectory has no frames.\n";
+            break;
+          }
+
+          sf::RenderWindow window(
+              sf::VideoMode(header.world.width, header.world.height),
+              "Boids replay");
+          window.setFramerateLimit(60);
+          bd::FlockRenderer renderer(triangleSide);
+          bd::BoidArrays frame;
+          sf::Clock clock;
+          double t{};  // simulated seconds since the first frame
+
+          // ogni frame si trova in tempo costante, quindi le frecce
+          // spostano avanti e indietro di 5 secondi
+          while (window.isOpen()) {
+            sf::Event event;
+            while (window.pollEvent(event)) {
+              if (event.type == sf::Event::Closed ||
+                  (event.type == sf::Event::KeyPressed &&
+                   event.key.code == sf::Keyboard::Escape)) {
+                window.close();
+              } else if (event.type == sf::Event::KeyPressed &&
+                         event.key.code == sf::Keyboard::Right) {
+                t += 5.;
+              } else if (event.type == sf::Event::KeyPressed &&
+                         event.key.code == sf::Keyboard::Left) {
+                t = std::max(t - 5., 0.);
+              }
+            }
+            t += clock.restart().asSeconds();
+            long k = static_cast<long>(t / header.delta_t) % reader->frames();
+            reader->read(k, frame);
+
+            window.clear();
+            renderer.update(frame);
+            window.draw(renderer);
             window.display();
           }
           break;
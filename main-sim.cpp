@@ -0,0 +1,416 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "boid.hpp"
+#include "checkpoint.hpp"
+#include "flock.hpp"
+#include "profiler.hpp"
+#include "trajectory.hpp"
+
+// Headless simulation: runs a flock for a number of ticks as fast as
+// possible and prints the throughput. Every option can be given on the
+// command line as --name value or --name=value, or in a config file with
+// one "name = value" per line ('#' starts a comment), loaded with
+// --config file. Options given later override the ones before them.
+
+namespace {
+
+struct Options {
+  int n{1000};
+  bd::Parameters par{50.0, 10.0, 0.05, 0.05, 0.05};
+  double maxspeed{500};
+  int ticks{1000};
+  double delta_t{1. / 60.};
+  unsigned seed{1};
+  bd::World world;
+  double density{};  // boids per million square units, 0 to keep the size
+  int threads{1};
+  double skin{};  // of the Verlet lists, none if 0
+  int reorder{};  // ticks between reorders of the boids, none if 0
+  double theta{-1.};  // opening angle of Barnes-Hut, off if negative
+  bool doubleBuffered{false};
+  std::string profile;  // CSV of the phase times, stdout if empty
+  std::string record;   // trajectory file, none if empty
+  bd::Encoding encoding{bd::Encoding::float32};
+  std::string checkpoint;  // checkpoint file, none if empty
+  long checkpointEvery{1000};
+  std::string restore;     // checkpoint to continue from
+  bool single{false};      // boids in float instead of double
+};
+
+void printUsage() {
+  std::cout
+      << "Usage: boid-sim [--name value]...\n"
+      << "  --n N            number of boids (default 1000)\n"
+      << "  --d, --ds, --s, --a, --c\n"
+      << "                   flocking parameters (default 50 10 .05 .05 .05)\n"
+      << "  --maxspeed V     speed limit of the boids (default 500)\n"
+      << "  --ticks T        number of updates (default 1000)\n"
+      << "  --dt DT          time step in seconds (default 1/60)\n"
+      << "  --seed S         seed of the initial positions (default 1)\n"
+      << "  --width W, --height H\n"
+      << "                   size of the world (default 1280 x 720)\n"
+      << "  --boundary B     periodic, reflective or open (default periodic)\n"
+      << "  --margin M, --turn F\n"
+      << "                   open: boids closer than M to an edge turn back\n"
+      << "                   by F * maxspeed per tick (default 50 .05)\n"
+      << "  --density D      boids per million square units: the world is\n"
+      << "                   scaled to it, keeping the ratio of W and H\n"
+      << "  --threads K      threads, needs --mode double (default 1)\n"
+      << "  --skin S         Verlet lists of reach d + S, searched again only\n"
+      << "                   when a boid moved S / 2 (default 0, no lists;\n"
+      << "                   a restored run keeps the saved one)\n"
+      << "  --reorder K      sort the boids in memory along a Z-order curve\n"
+      << "                   every K ticks (default 0, never)\n"
+      << "  --theta T        alignment and cohesion with a Barnes-Hut tree of\n"
+      << "                   opening angle T, 0 exact (default off)\n"
+      << "  --mode M         inplace or double (default inplace)\n"
+      << "  --precision P    double or float (default double)\n"
+      << "  --profile FILE   write the phase times as CSV to FILE, needs a\n"
+      << "                   build with BOID_PROFILE (default stdout)\n"
+      << "  --record FILE    write every tick to the trajectory FILE\n"
+      << "  --encoding E     float64, float32 or int16 (default float32)\n"
+      << "  --checkpoint FILE\n"
+      << "                   save the state to FILE every few ticks\n"
+      << "  --checkpoint-every K\n"
+      << "                   ticks between checkpoints (default 1000)\n"
+      << "  --restore FILE   continue the run saved in the checkpoint FILE;\n"
+      << "                   with --record, its boids must share one group\n"
+      << "  --config FILE    read options from FILE\n";
+}
+
+template <class T>
+T parse(const std::string& name, const std::string& value) {
+  std::istringstream in(value);
+  T result;
+  if (!(in >> result) || !(in >> std::ws).eof()) {
+    throw std::runtime_error{"Bad value '" + value + "' for option " + name};
+  }
+  return result;
+}
+
+void readFile(Options& options, const std::string& path);
+
+void set(Options& options, const std::string& name, const std::string& value) {
+  if (name == "n") {
+    options.n = parse<int>(name, value);
+  } else if (name == "d") {
+    options.par.d = parse<double>(name, value);
+  } else if (name == "ds") {
+    options.par.ds = parse<double>(name, value);
+  } else if (name == "s") {
+    options.par.s = parse<double>(name, value);
+  } else if (name == "a") {
+    options.par.a = parse<double>(name, value);
+  } else if (name == "c") {
+    options.par.c = parse<double>(name, value);
+  } else if (name == "maxspeed") {
+    options.maxspeed = parse<double>(name, value);
+  } else if (name == "ticks") {
+    options.ticks = parse<int>(name, value);
+  } else if (name == "dt") {
+    options.delta_t = parse<double>(name, value);
+  } else if (name == "seed") {
+    options.seed = parse<unsigned>(name, value);
+  } else if (name == "width") {
+    options.world.width = parse<double>(name, value);
+  } else if (name == "height") {
+    options.world.height = parse<double>(name, value);
+  } else if (name == "boundary") {
+    options.world.boundary = bd::boundaryFromName(value);
+  } else if (name == "margin") {
+    options.world.margin = parse<double>(name, value);
+  } else if (name == "turn") {
+    options.world.turn = parse<double>(name, value);
+  } else if (name == "density") {
+    options.density = parse<double>(name, value);
+  } else if (name == "threads") {
+    options.threads = parse<int>(name, value);
+  } else if (name == "skin") {
+    options.skin = parse<double>(name, value);
+  } else if (name == "reorder") {
+    options.reorder = parse<int>(name, value);
+  } else if (name == "theta") {
+    options.theta = parse<double>(name, value);
+    if (!(options.theta >= 0.)) {
+      throw std::runtime_error{"The opening angle must be positive"};
+    }
+  } else if (name == "mode") {
+    if (value != "inplace" && value != "double") {
+      throw std::runtime_error{"The mode must be inplace or double"};
+    }
+    options.doubleBuffered = value == "double";
+  } else if (name == "precision") {
+    if (value != "double" && value != "float") {
+      throw std::runtime_error{"The precision must be double or float"};
+    }
+    options.single = value == "float";
+  } else if (name == "profile") {
+    options.profile = value;
+  } else if (name == "record") {
+    options.record = value;
+  } else if (name == "encoding") {
+    options.encoding = bd::encodingFromName(value);
+  } else if (name == "checkpoint") {
+    options.checkpoint = value;
+  } else if (name == "checkpoint-every") {
+    options.checkpointEvery = parse<long>(name, value);
+  } else if (name == "restore") {
+    options.restore = value;
+  } else if (name == "config") {
+    readFile(options, value);
+  } else {
+    throw std::runtime_error{"Unknown option " + name};
+  }
+}
+
+std::string trim(const std::string& s) {
+  auto first = s.find_first_not_of(" \t\r");
+  if (first == std::string::npos) {
+    return "";
+  }
+  auto last = s.find_last_not_of(" \t\r");
+  return s.substr(first, last - first + 1);
+}
+
+void readFile(Options& options, const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error{"Cannot open config file " + path};
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty()) {
+      continue;
+    }
+    auto eq = line.find('=');
+    if (eq == std::string::npos) {
+      throw std::runtime_error{"Expected name = value in " + path + ": " +
+                               line};
+    }
+    set(options, trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+  }
+}
+
+Options readOptions(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      throw std::runtime_error{"Options start with --, got " + arg};
+    }
+    arg = arg.substr(2);
+    auto eq = arg.find('=');
+    if (eq != std::string::npos) {
+      set(options, arg.substr(0, eq), arg.substr(eq + 1));
+    } else if (i + 1 < argc) {
+      set(options, arg, argv[++i]);
+    } else {
+      throw std::runtime_error{"Missing value for option --" + arg};
+    }
+  }
+  return options;
+}
+
+// the simulation with boids of scalar T
+template <class T>
+void run(Options& options) {
+  bd::BasicFlock<T> flock;
+  flock.setWorld(options.world);
+  flock.setUpdateMode(options.doubleBuffered ? bd::UpdateMode::doubleBuffered
+                                             : bd::UpdateMode::inPlace);
+  flock.setThreads(options.threads);
+  flock.setSkin(options.skin);
+  flock.setReorderEvery(options.reorder);
+  if (options.theta >= 0.) {
+    flock.setBarnesHut(true, options.theta);
+  }
+
+  std::default_random_engine eng(options.seed);
+  long tick = 0;
+  if (options.restore.empty()) {
+    std::uniform_real_distribution<double> xDist(0, options.world.width);
+    std::uniform_real_distribution<double> yDist(0, options.world.height);
+    std::uniform_real_distribution<double> vDist(-1, 1);
+    bd::checkParameters(options.par);
+    for (int i = 0; i < options.n; ++i) {
+      bd::BasicBoid<T> boid(xDist(eng), yDist(eng));
+      boid.setVelocity({T(vDist(eng)), T(vDist(eng))});
+      boid.setMaxspeed(options.maxspeed);
+      boid.setPar(options.par);
+      flock.addBoid(boid);
+    }
+  } else {
+    // the flock, its world, update mode, reorder period and Verlet lists,
+    // and the engine as they were saved; threads, theta and the number of
+    // ticks still come from the options
+    bd::FlockState state = bd::loadState(options.restore);
+    flock.restore(state);
+    std::istringstream(state.rng) >> eng;
+    tick = state.tick;
+    // and so does what a recording says about the flock, which its header
+    // can only tell for a single group; the seed the flock started from
+    // is not in the checkpoint
+    options.n = flock.size();
+    options.world = flock.world();
+    if (!options.record.empty() && flock.groups() > 1) {
+      throw std::runtime_error{
+          "Cannot --record a restored flock of " +
+          std::to_string(flock.groups()) +
+          " groups: a trajectory holds the parameters of one"};
+    }
+    options.par = flock.groupPar(0);
+    options.maxspeed = flock.groupMaxspeed(0);
+  }
+
+  std::unique_ptr<bd::Checkpointer> checkpointer;
+  auto engineState = [&] {
+    std::ostringstream out;
+    out << eng;
+    return out.str();
+  };
+  if (!options.checkpoint.empty()) {
+    checkpointer = std::make_unique<bd::Checkpointer>(
+        options.checkpoint, options.checkpointEvery);
+  }
+
+  std::unique_ptr<bd::TrajectoryWriter> writer;
+  if (!options.record.empty()) {
+    bd::TrajectoryHeader header;
+    header.encoding = options.encoding;
+    header.n = options.n;
+    header.seed = options.seed;
+    header.seedKnown = options.restore.empty();
+    header.world = options.world;
+    header.delta_t = options.delta_t;
+    header.par = options.par;
+    header.maxspeed = options.maxspeed;
+    writer = std::make_unique<bd::TrajectoryWriter>(options.record, header);
+  }
+  // frames hold the boids by id, wherever reorders moved them
+  bd::BasicBoidArrays<T> frame;
+  if (writer) {
+    flock.arraysById(frame);
+    writer->write(tick, frame);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < options.ticks; ++t) {
+    flock.updateFlock(options.delta_t);
+    ++tick;
+    if (writer) {
+      flock.arraysById(frame);
+      writer->write(tick, frame);
+    }
+    if (checkpointer && checkpointer->due(tick)) {
+      checkpointer->tick(flock, tick, engineState());
+    }
+  }
+  if (writer) {
+    writer->close();
+  }
+  if (checkpointer) {
+    checkpointer->flush();
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  double updates = double(options.n) * options.ticks;
+  bd::Statistics speed = flock.average_speed();
+  std::cout << "boids " << options.n << ", ticks " << options.ticks
+            << ", threads " << flock.threads() << '\n'
+            << "elapsed " << elapsed << " s\n"
+            << "ticks/s " << options.ticks / elapsed << '\n'
+            << "boid updates/s " << updates / elapsed << '\n'
+            << "ns/boid/tick " << elapsed * 1e9 / updates << '\n'
+            << "final speed " << speed.mean << " +- " << speed.sigma
+            << '\n'
+            << "final neighbors "
+            << flock.statistics().last().neighbors.mean << " +- "
+            << flock.statistics().last().neighbors.sigma << '\n';
+  if (flock.skin() > 0.) {
+    const auto& lists = flock.verletLists();
+    std::cout << "verlet builds " << lists.builds() << " in "
+              << lists.ticks() << " ticks (" << 100. * lists.buildRate()
+              << "%)\n"
+              << "verlet candidates/boid " << lists.candidatesPerBoid()
+              << ", runs/boid " << lists.runsPerBoid()
+              << ", bytes/boid " << lists.bytesPerBoid() << '\n';
+  }
+  if (flock.barnesHut()) {
+    // the error of the final state against the exact sums, for a few
+    // angles around the one run with
+    std::cout << "barnes-hut nodes " << flock.quadtree().nodes().size()
+              << "\n"
+              << "theta  center (mean/max)  velocity (mean/max)  neighbors\n";
+    for (double theta : {0.25, 0.5, 0.75, 1., flock.theta()}) {
+      bd::BarnesHutError error = flock.barnesHutError(theta, 1000);
+      std::cout << theta << "  " << error.center << " / " << error.maxCenter
+                << "  " << error.velocity << " / " << error.maxVelocity
+                << "  " << 100. * error.neighbors << "%"
+                << (theta == flock.theta() ? "  (run)" : "") << '\n';
+    }
+  }
+
+  if (bd::profiling) {
+    if (options.profile.empty()) {
+      bd::profiler().print(std::cout);
+    } else {
+      bd::profiler().writeCsv(options.profile);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  try {
+    for (int i = 1; i < argc; ++i) {
+      if (std::string{argv[i]} == "--help") {
+        printUsage();
+        return EXIT_SUCCESS;
+      }
+    }
+
+    Options options = readOptions(argc, argv);
+    if (options.n < 2) {
+      throw std::runtime_error{"Not enough boids, at least 2 are needed"};
+    }
+    if (options.ticks < 1 || options.delta_t <= 0.) {
+      throw std::runtime_error{"ticks and dt must be positive"};
+    }
+    if (options.density < 0.) {
+      throw std::runtime_error{"The density must be positive"};
+    }
+    if (options.density > 0.) {
+      // same shape, area n / density
+      bd::World& world = options.world;
+      double scale = std::sqrt(options.n / (options.density * 1e-6) /
+                               (world.width * world.height));
+      world.width *= scale;
+      world.height *= scale;
+    }
+
+    if (options.single) {
+      run<float>(options);
+    } else {
+      run<double>(options);
+    }
+  } catch (std::exception const& e) {
+    std::cerr << "An exception occurred: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  } catch (...) {
+    std::cerr << "Caught unknown exception\n";
+    return EXIT_FAILURE;
+  }
+}
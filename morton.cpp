@@ -0,0 +1,104 @@
+#include "morton.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace bd {
+
+namespace {
+
+// the 16 bits of v in the even bits of the result
+std::uint32_t spread(std::uint32_t v) {
+  v = (v | (v << 8)) & 0x00ff00ffu;
+  v = (v | (v << 4)) & 0x0f0f0f0fu;
+  v = (v | (v << 2)) & 0x33333333u;
+  v = (v | (v << 1)) & 0x55555555u;
+  return v;
+}
+
+// which of the 65536 steps of size v falls in
+std::uint32_t step(double v, double size) {
+  double s = v / size * 65536.;
+  if (!(s > 0.)) {
+    return 0;
+  }
+  return s < 65535. ? static_cast<std::uint32_t>(s) : 65535u;
+}
+
+// fewer keys than this per thread are not worth a task
+constexpr int minBlock{4096};
+constexpr int radix{256};
+
+}  // namespace
+
+std::uint32_t mortonCode(double x, double y, const World& world) {
+  return spread(step(x, world.width)) | spread(step(y, world.height)) << 1;
+}
+
+void radixSort(const std::vector<std::uint32_t>& keys, std::vector<int>& order,
+               ThreadPool& pool, Arena& scratch) {
+  int n = keys.size();
+  order.resize(n);
+  for (int i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  if (n < 2) {
+    return;
+  }
+  Arena::Scope scope(scratch);
+  std::uint32_t* key = scratch.allocate<std::uint32_t>(n);
+  std::uint32_t* keyOut = scratch.allocate<std::uint32_t>(n);
+  int* orderIn = scratch.allocate<int>(n);
+  int* orderOut = scratch.allocate<int>(n);
+  std::copy(keys.begin(), keys.end(), key);
+  std::copy(order.begin(), order.end(), orderIn);
+  int blocks = std::max(1, std::min(pool.size(), n / minBlock));
+  auto first = [&](int b) { return static_cast<int>(long(n) * b / blocks); };
+  // counts of each digit in each block, then where the block writes them
+  int* at = scratch.allocate<int>(blocks * radix);
+
+  for (int shift = 0; shift < 32; shift += 8) {
+    std::fill(at, at + blocks * radix, 0);
+    pool.parallelFor(blocks, 1, [&](int begin, int end) {
+      for (int b = begin; b < end; ++b) {
+        int* count = &at[b * radix];
+        for (int i = first(b); i < first(b + 1); ++i) {
+          ++count[(key[i] >> shift) & (radix - 1)];
+        }
+      }
+    });
+    // digit by digit, and block by block within a digit, so equal keys
+    // keep their order; a pass where all the keys share the digit would
+    // leave them where they are
+    bool moves = true;
+    int total = 0;
+    for (int digit = 0; digit < radix; ++digit) {
+      int same = 0;
+      for (int b = 0; b < blocks; ++b) {
+        int count = at[b * radix + digit];
+        at[b * radix + digit] = total;
+        total += count;
+        same += count;
+      }
+      moves = moves && same != n;
+    }
+    if (!moves) {
+      continue;
+    }
+    pool.parallelFor(blocks, 1, [&](int begin, int end) {
+      for (int b = begin; b < end; ++b) {
+        int* next = &at[b * radix];
+        for (int i = first(b); i < first(b + 1); ++i) {
+          int k = next[(key[i] >> shift) & (radix - 1)]++;
+          keyOut[k] = key[i];
+          orderOut[k] = orderIn[i];
+        }
+      }
+    });
+    std::swap(key, keyOut);
+    std::swap(orderIn, orderOut);
+  }
+  std::copy(orderIn, orderIn + n, order.begin());
+}
+
+}  // namespace bd
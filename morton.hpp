@@ -0,0 +1,29 @@
+#pragma once
+#ifndef MORTON_HPP
+#define MORTON_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "arena.hpp"
+#include "boid.hpp"
+#include "threadpool.hpp"
+
+namespace bd {
+
+// Z-order (Morton) code of a point of world: x and y cut in 65536 steps
+// each, their bits interleaved, x in the even ones. Points close in the
+// world mostly get close codes, so sorting by code puts boids close in the
+// world close in memory. Points out of the world count as on its edge.
+std::uint32_t mortonCode(double x, double y, const World& world);
+
+// order of keys, ascending, keys that are equal in the order they come:
+// a radix sort of 8 bits a pass, from the lowest. Each pass is split in
+// blocks over the threads of pool, and the result is the same whatever
+// their number. The buffers of the passes come from scratch.
+void radixSort(const std::vector<std::uint32_t>& keys, std::vector<int>& order,
+               ThreadPool& pool, Arena& scratch);
+
+}  // namespace bd
+
+#endif
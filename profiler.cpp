@@ -0,0 +1,85 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+namespace bd {
+
+void Profiler::record(const char* phase, double seconds) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = std::find_if(m_phases.begin(), m_phases.end(),
+                         [&](const Phase& p) { return p.name == phase; });
+  if (it == m_phases.end()) {
+    m_phases.push_back({phase, {}, 0});
+    it = m_phases.end() - 1;
+    // the whole window at once, so a phase seen before takes no memory
+    it->window.reserve(windowSize);
+  }
+  if (it->window.size() < windowSize) {
+    it->window.push_back(seconds);
+  } else {
+    it->window[it->samples % windowSize] = seconds;
+  }
+  ++it->samples;
+}
+
+std::vector<PhaseSummary> Profiler::summary() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::vector<PhaseSummary> result;
+  for (auto const& phase : m_phases) {
+    std::vector<double> sorted = phase.window;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.;
+    for (double t : sorted) {
+      sum += t;
+    }
+    // nearest rank
+    int rank = std::ceil(0.99 * sorted.size()) - 1;
+    result.push_back({phase.name, phase.samples, sorted.front(),
+                      sum / sorted.size(), sorted[std::max(rank, 0)]});
+  }
+  return result;
+}
+
+void Profiler::clear() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_phases.clear();
+}
+
+void Profiler::print(std::ostream& out) const {
+  out << std::left << std::setw(16) << "phase" << std::right << std::setw(10)
+      << "samples" << std::setw(12) << "min us" << std::setw(12) << "mean us"
+      << std::setw(12) << "p99 us" << '\n';
+  for (auto const& s : summary()) {
+    out << std::left << std::setw(16) << s.phase << std::right
+        << std::setw(10) << s.samples << std::fixed << std::setprecision(1)
+        << std::setw(12) << s.min * 1e6 << std::setw(12) << s.mean * 1e6
+        << std::setw(12) << s.p99 * 1e6 << '\n';
+  }
+}
+
+void Profiler::writeCsv(std::ostream& out) const {
+  out << "phase,samples,min_us,mean_us,p99_us\n";
+  for (auto const& s : summary()) {
+    out << s.phase << ',' << s.samples << ',' << s.min * 1e6 << ','
+        << s.mean * 1e6 << ',' << s.p99 * 1e6 << '\n';
+  }
+}
+
+void Profiler::writeCsv(const std::string& path) const {
+  std::ofstream out(path);
+  if (!out) {
+    throw std::runtime_error{"Cannot write " + path};
+  }
+  writeCsv(out);
+}
+
+Profiler& profiler() {
+  static Profiler instance;
+  return instance;
+}
+
+}  // namespace bd
@@ -0,0 +1,125 @@
+#pragma once
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <array>
+#include <chrono>
+#include <initializer_list>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace bd {
+
+// Timing of the phases of a tick. ScopedTimer and Laps only measure when the
+// code is compiled with BOID_PROFILE defined (cmake -DBOID_PROFILE=ON);
+// otherwise they are empty and the compiler removes them.
+#ifdef BOID_PROFILE
+constexpr bool profiling{true};
+#else
+constexpr bool profiling{false};
+#endif
+
+// min, mean and 99th percentile of the last samples of a phase, in seconds
+struct PhaseSummary {
+  std::string phase;
+  long samples{};  // recorded since the start, the window holds the last ones
+  double min{};
+  double mean{};
+  double p99{};
+};
+
+// Rolling window of the durations of each phase, one sample per call of
+// record(); only the first sample of a phase allocates. Thread safe.
+class Profiler {
+  struct Phase {
+    std::string name;
+    std::vector<double> window;
+    long samples{};
+  };
+
+  mutable std::mutex m_mutex;
+  std::vector<Phase> m_phases;  // in order of first use
+
+ public:
+  static constexpr int windowSize{1024};
+
+  void record(const char* phase, double seconds);
+  std::vector<PhaseSummary> summary() const;
+  void clear();
+
+  // table in microseconds
+  void print(std::ostream& out) const;
+  // phase,samples,min_us,mean_us,p99_us
+  void writeCsv(std::ostream& out) const;
+  void writeCsv(const std::string& path) const;
+};
+
+// the one used by the simulation and the render loop
+Profiler& profiler();
+
+// records the time from construction to destruction as one sample of phase
+class ScopedTimer {
+#ifdef BOID_PROFILE
+  const char* m_phase;
+  std::chrono::steady_clock::time_point m_start;
+
+ public:
+  explicit ScopedTimer(const char* phase)
+      : m_phase{phase}, m_start{std::chrono::steady_clock::now()} {}
+  ~ScopedTimer() {
+    profiler().record(m_phase, std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - m_start)
+                                   .count());
+  }
+#else
+ public:
+  explicit ScopedTimer(const char*) {}
+#endif
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+// Splits the time of a loop between phases that alternate in every step,
+// like the rules and the integration of each boid: lap(k) adds the time
+// since the previous lap to phase k. The totals are recorded once, as one
+// sample per phase.
+class Laps {
+ public:
+  static constexpr int maxPhases{8};
+
+#ifdef BOID_PROFILE
+ private:
+  std::array<double, maxPhases> m_total{};
+  std::chrono::steady_clock::time_point m_last{
+      std::chrono::steady_clock::now()};
+
+ public:
+  void lap(int phase) {
+    auto now = std::chrono::steady_clock::now();
+    m_total[phase] += std::chrono::duration<double>(now - m_last).count();
+    m_last = now;
+  }
+  void merge(const Laps& other) {
+    for (int k = 0; k < maxPhases; ++k) {
+      m_total[k] += other.m_total[k];
+    }
+  }
+  void record(std::initializer_list<const char*> phases) const {
+    int k = 0;
+    for (const char* phase : phases) {
+      profiler().record(phase, m_total[k++]);
+    }
+  }
+#else
+  void lap(int) {}
+  void merge(const Laps&) {}
+  void record(std::initializer_list<const char*>) const {}
+#endif
+};
+
+}  // namespace bd
+
+#endif
@@ -0,0 +1,269 @@
+#include "quadtree.hpp"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <utility>
+
+#include "morton.hpp"
+
+namespace bd {
+
+namespace {
+
+// distance from 0 of the nearest point of [lo, hi]
+double distance(double lo, double hi) {
+  return lo > 0. ? lo : hi < 0. ? -hi : 0.;
+}
+
+// [lo, hi], displacements from a boid along one side of the world, as the
+// boid sees it: on a periodic side, moved to its image nearest to the
+// boid, shift being what was added. A box that straddles half the side
+// has boids with different nearest images, and near is the distance of
+// the nearest of either part.
+struct Side {
+  double lo;
+  double hi;
+  double shift{};
+  double near{};
+  bool straddles{false};
+};
+
+Side side(double lo, double hi, double size, bool periodic) {
+  Side s{lo, hi};
+  if (periodic) {
+    double half = size / 2;
+    double center = (lo + hi) / 2;
+    s.shift = center > half ? -size : center < -half ? size : 0.;
+    s.lo += s.shift;
+    s.hi += s.shift;
+    if (s.hi > half) {
+      s.straddles = true;
+      s.near = std::min(distance(s.lo, half), distance(-half, s.hi - size));
+      return s;
+    }
+    if (s.lo < -half) {
+      s.straddles = true;
+      s.near = std::min(distance(-half, s.hi), distance(s.lo + size, half));
+      return s;
+    }
+  }
+  s.near = distance(s.lo, s.hi);
+  return s;
+}
+
+// the Morton code has 16 levels of two bits
+constexpr int levels{16};
+
+}  // namespace
+
+template <class T>
+void BasicQuadtree<T>::build(const BasicBoidArrays<T>& boids,
+                             const std::vector<std::uint16_t>& group,
+                             int layers, const World& world,
+                             ThreadPool& pool, Arena& scratch) {
+  m_world = world;
+  int N = boids.size();
+  m_codes.resize(N);
+  for (int i = 0; i < N; ++i) {
+    m_codes[i] = mortonCode(boids.x[i], boids.y[i], world);
+  }
+  radixSort(m_codes, m_order, pool, scratch);
+
+  // bucketed by layer, each in Morton order
+  m_layerStart.assign(layers + 1, 0);
+  if (layers > 1) {
+    for (int i = 0; i < N; ++i) {
+      ++m_layerStart[group[i] + 1];
+    }
+    for (int l = 0; l < layers; ++l) {
+      m_layerStart[l + 1] += m_layerStart[l];
+    }
+    Arena::Scope scope(scratch);
+    int* next = scratch.allocate<int>(layers);
+    std::copy(m_layerStart.begin(), m_layerStart.end() - 1, next);
+    m_byLayer.resize(N);
+    for (int k = 0; k < N; ++k) {
+      int i = m_order[k];
+      m_byLayer[next[group[i]]++] = i;
+    }
+    std::swap(m_order, m_byLayer);
+  } else {
+    m_layerStart[1] = N;
+  }
+
+  m_sorted.resize(N);
+  m_sortedCodes.resize(N);
+  for (int k = 0; k < N; ++k) {
+    int i = m_order[k];
+    m_sorted.x[k] = boids.x[i];
+    m_sorted.y[k] = boids.y[i];
+    m_sorted.vx[k] = boids.vx[i];
+    m_sorted.vy[k] = boids.vy[i];
+    m_sortedCodes[k] = m_codes[i];
+  }
+
+  m_nodes.clear();
+  m_roots.assign(layers, -1);
+  for (int l = 0; l < layers; ++l) {
+    if (m_layerStart[l] < m_layerStart[l + 1]) {
+      m_roots[l] = m_nodes.size();
+      m_nodes.emplace_back();
+      buildNode(m_roots[l], m_layerStart[l], m_layerStart[l + 1], 0);
+    }
+  }
+}
+
+template <class T>
+void BasicQuadtree<T>::buildNode(int index, int begin, int end, int level) {
+  Node node;
+  node.begin = begin;
+  node.end = end;
+  node.count = end - begin;
+  if (node.count > leafSize && level < levels) {
+    // the boids share the bits of the code above shift + 2, and the two
+    // below split them in quadrants
+    int shift = 2 * (levels - 1 - level);
+    const std::uint32_t* codes = m_sortedCodes.data();
+    std::uint64_t prefix =
+        codes[begin] & ~((std::uint64_t{4} << shift) - 1);
+    std::array<int, 5> bounds{begin};
+    for (int q = 0; q < 4; ++q) {
+      std::uint64_t next = prefix + (std::uint64_t(q + 1) << shift);
+      bounds[q + 1] =
+          std::lower_bound(codes + bounds[q], codes + end, next) - codes;
+    }
+    node.child = m_nodes.size();
+    for (int q = 0; q < 4; ++q) {
+      node.children += bounds[q] < bounds[q + 1];
+    }
+    m_nodes.resize(node.child + node.children);
+    int c = node.child;
+    for (int q = 0; q < 4; ++q) {
+      if (bounds[q] < bounds[q + 1]) {
+        buildNode(c++, bounds[q], bounds[q + 1], level + 1);
+      }
+    }
+    node.x0 = node.y0 = std::numeric_limits<double>::infinity();
+    node.x1 = node.y1 = -std::numeric_limits<double>::infinity();
+    for (c = node.child; c < node.child + node.children; ++c) {
+      const Node& n = m_nodes[c];
+      node.x0 = std::min(node.x0, n.x0);
+      node.y0 = std::min(node.y0, n.y0);
+      node.x1 = std::max(node.x1, n.x1);
+      node.y1 = std::max(node.y1, n.y1);
+      node.sumX += n.sumX;
+      node.sumY += n.sumY;
+      node.sumVx += n.sumVx;
+      node.sumVy += n.sumVy;
+    }
+  } else {
+    node.x0 = node.x1 = m_sorted.x[begin];
+    node.y0 = node.y1 = m_sorted.y[begin];
+    for (int k = begin; k < end; ++k) {
+      double x = m_sorted.x[k];
+      double y = m_sorted.y[k];
+      node.x0 = std::min(node.x0, x);
+      node.y0 = std::min(node.y0, y);
+      node.x1 = std::max(node.x1, x);
+      node.y1 = std::max(node.y1, y);
+      node.sumX += x;
+      node.sumY += y;
+      node.sumVx += m_sorted.vx[k];
+      node.sumVy += m_sorted.vy[k];
+    }
+  }
+  m_nodes[index] = node;
+}
+
+template <class T>
+void BasicQuadtree<T>::sums(BasicSteeringSums<T>& sums,
+                            const Vec2<T>& position, const Vec2<T>& velocity,
+                            double d, double theta, unsigned terms,
+                            int layer) const {
+  terms &= velocitiesTerm | positionsTerm | neighborsTerm;
+  int root = m_roots[layer];
+  if (terms == 0 || root < 0) {
+    return;
+  }
+  bool periodic = m_world.boundary == Boundary::periodic;
+  double px = position.x;
+  double py = position.y;
+  double d2 = d * d;
+  double theta2 = theta * theta;
+  // for the kernel, which is not asked for the displacements
+  Parameters par{d, 0., 0., 0., 0.};
+  // the nodes taken whole, in double
+  double sumX = 0.;
+  double sumY = 0.;
+  double sumVx = 0.;
+  double sumVy = 0.;
+  long count = 0;
+
+  // depth first: at most three nodes left behind per level
+  std::array<int, 4 * levels> stack;
+  int top = 0;
+  stack[top++] = root;
+  while (top > 0) {
+    const Node& node = m_nodes[stack[--top]];
+    Side x = side(node.x0 - px, node.x1 - px, m_world.width, periodic);
+    Side y = side(node.y0 - py, node.y1 - py, m_world.height, periodic);
+    double near2 = x.near * x.near + y.near * y.near;
+    if (near2 >= d2) {
+      continue;
+    }
+
+    if (!x.straddles && !y.straddles) {
+      double farX = std::max(-x.lo, x.hi);
+      double farY = std::max(-y.lo, y.hi);
+      bool whole = farX * farX + farY * farY < d2;
+      // seen under a small angle, from out of its box: all of it at its
+      // center of mass
+      if (!whole && near2 > 0.) {
+        double cX = node.sumX / node.count - px + x.shift;
+        double cY = node.sumY / node.count - py + y.shift;
+        double distance2 = cX * cX + cY * cY;
+        double size = std::max(node.x1 - node.x0, node.y1 - node.y0);
+        if (size * size < theta2 * distance2) {
+          if (distance2 >= d2) {
+            continue;
+          }
+          whole = true;
+        }
+      }
+      if (whole) {
+        sumX += node.sumX + node.count * x.shift;
+        sumY += node.sumY + node.count * y.shift;
+        sumVx += node.sumVx;
+        sumVy += node.sumVy;
+        count += node.count;
+        continue;
+      }
+    }
+
+    if (node.child < 0) {
+      steeringSums(sums, position, velocity, par, m_sorted, node.begin,
+                   node.end, terms, &m_world);
+    } else {
+      for (int c = 0; c < node.children; ++c) {
+        stack[top++] = node.child + c;
+      }
+    }
+  }
+
+  if (terms & velocitiesTerm) {
+    sums.velocities += Vec2<T>{T(sumVx - count * double(velocity.x)),
+                               T(sumVy - count * double(velocity.y))};
+  }
+  if (terms & positionsTerm) {
+    sums.positions += Vec2<T>{T(sumX), T(sumY)};
+  }
+  if (terms & neighborsTerm) {
+    sums.neighbors += count;
+  }
+}
+
+template class BasicQuadtree<double>;
+template class BasicQuadtree<float>;
+
+}  // namespace bd
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef QUADTREE_HPP
+#define QUADTREE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "arena.hpp"
+#include "boid.hpp"
+#include "threadpool.hpp"
+
+namespace bd {
+
+// Quadtree over the boids for Barnes-Hut: every node holds the number of
+// boids under it, the sums of their positions and velocities and the box
+// that bounds them. sums() gathers the velocities, positions and neighbors
+// terms of a boid within d: a node wholly closer than d is added as it is
+// and one wholly farther is skipped, with no boid of it looked at; one
+// seen under an angle below theta, size / distance to its center of mass,
+// counts as all its boids at the center, within d or not. The others are
+// opened, down to leaves of at most leafSize boids, gathered exactly with
+// the kernel of steeringSums(). With theta 0 the sums are exact, save for
+// rounding; with a large d most of the flock is added a node at a time.
+// The boids are sorted by their Morton code (see morton.hpp), so the boids
+// of a node are a contiguous range of sorted(), and the children of a node
+// split it by the next two bits of the code. Built with layers, each one
+// gets a tree of its own.
+template <class T>
+class BasicQuadtree {
+ public:
+  static constexpr int leafSize{16};
+
+  struct Node {
+    // box of the boids in it, and their sums
+    double x0{};
+    double y0{};
+    double x1{};
+    double y1{};
+    double sumX{};
+    double sumY{};
+    double sumVx{};
+    double sumVy{};
+    int count{};
+    int begin{};  // the boids of sorted() in it
+    int end{};
+    int child{-1};  // the first of its children, -1 for a leaf
+    int children{};
+  };
+
+ private:
+  World m_world;
+  std::vector<std::uint32_t> m_codes;
+  std::vector<int> m_order;
+  std::vector<int> m_byLayer;
+  std::vector<int> m_layerStart;
+  BasicBoidArrays<T> m_sorted;
+  std::vector<std::uint32_t> m_sortedCodes;
+  std::vector<Node> m_nodes;
+  std::vector<int> m_roots;  // per layer, -1 if empty
+
+  void buildNode(int index, int begin, int end, int level);
+
+ public:
+  // over boids, boid i in layer group[i] when layers is more than 1; the
+  // Morton codes are sorted with the threads of pool, in buffers of scratch
+  void build(const BasicBoidArrays<T>& boids,
+             const std::vector<std::uint16_t>& group, int layers,
+             const World& world, ThreadPool& pool, Arena& scratch);
+
+  // adds the terms velocitiesTerm, positionsTerm and neighborsTerm of the
+  // boids of layer closer than d to position, as steeringSums() with world
+  // would; others in terms are left alone
+  void sums(BasicSteeringSums<T>& sums, const Vec2<T>& position,
+            const Vec2<T>& velocity, double d, double theta, unsigned terms,
+            int layer = 0) const;
+
+  const std::vector<Node>& nodes() const { return m_nodes; }
+  int root(int layer) const { return m_roots[layer]; }
+  const BasicBoidArrays<T>& sorted() const { return m_sorted; }
+};
+
+using Quadtree = BasicQuadtree<double>;
+using QuadtreeF = BasicQuadtree<float>;
+
+extern template class BasicQuadtree<double>;
+extern template class BasicQuadtree<float>;
+
+}  // namespace bd
+
+#endif
@@ -0,0 +1,28 @@
+#include "renderer.hpp"
+
+#include "sfml.hpp"
+
+namespace bd {
+
+void FlockRenderer::update(const Flock& flock) { update(flock.arrays()); }
+
+void FlockRenderer::update(const BoidArrays& boids) {
+  int n = boids.size();
+  m_vertices.resize(3 * n);
+  for (int i = 0; i < n; ++i) {
+    auto corners = triangle({boids.x[i], boids.y[i]},
+                            {boids.vx[i], boids.vy[i]}, m_side);
+    for (int k = 0; k < 3; ++k) {
+      sf::Vertex& vertex = m_vertices[3 * i + k];
+      vertex.position = toSf<float>(corners[k]);
+      vertex.color = m_color;
+    }
+  }
+}
+
+void FlockRenderer::draw(sf::RenderTarget& target,
+                         sf::RenderStates states) const {
+  target.draw(m_vertices, states);
+}
+
+}  // namespace bd
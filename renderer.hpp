@@ -0,0 +1,33 @@
+#pragma once
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+
+#include <SFML/Graphics.hpp>
+
+#include "flock.hpp"
+
+namespace bd {
+
+// Draws a whole flock with one draw call: the triangles of all the boids,
+// see triangle(), are kept in a single vertex array that is refilled every
+// frame and only grows with the flock.
+class FlockRenderer : public sf::Drawable {
+  sf::VertexArray m_vertices{sf::Triangles};
+  double m_side;
+  sf::Color m_color;
+
+  void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
+
+ public:
+  explicit FlockRenderer(double triangleSide,
+                         sf::Color color = sf::Color::White)
+      : m_side{triangleSide}, m_color{color} {}
+
+  // copies the current positions and velocities of flock
+  void update(const Flock& flock);
+  void update(const BoidArrays& boids);
+};
+
+}  // namespace bd
+
+#endif
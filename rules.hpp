@@ -0,0 +1,116 @@
+#pragma once
+#ifndef RULES_HPP
+#define RULES_HPP
+
+#include <cstdint>
+
+#include "boid.hpp"
+
+namespace bd {
+
+// Steering rules as policies, put together with Rules<...> and handed to
+// Flock::setRules(). A rule is a type with
+//   static constexpr unsigned terms;  // SteeringTerm members it reads
+//   template <class T>
+//   static Vec2<T> steer(const BasicBoid<T>& boid,
+//                        const BasicSteeringSums<T>& sums,
+//                        const RuleContext& context);
+// The neighbor kernel only gathers the terms some rule of the set reads, so
+// a rule left out costs nothing, and a new one needs no change to the loop.
+
+// what a rule may need besides the boid and its sums
+struct RuleContext {
+  int N;      // boids in the flock
+  int index;  // of the boid in the flock
+  int id;     // of the boid, the same wherever Flock::reorder() moves it
+  long tick;  // updates done so far
+};
+
+// v1: away from the boids closer than ds
+struct Separation {
+  static constexpr unsigned terms = displacementsTerm;
+
+  template <class T>
+  static Vec2<T> steer(const BasicBoid<T>& boid,
+                       const BasicSteeringSums<T>& sums, const RuleContext&) {
+    return -T(boid.getPar().s) * sums.displacements;
+  }
+};
+
+// v2: towards the velocity of the boids closer than d
+struct Alignment {
+  static constexpr unsigned terms = velocitiesTerm;
+
+  template <class T>
+  static Vec2<T> steer(const BasicBoid<T>& boid,
+                       const BasicSteeringSums<T>& sums,
+                       const RuleContext& context) {
+    return T(boid.getPar().a) * (T{1} / (context.N - 1)) * sums.velocities;
+  }
+};
+
+// v3: towards the center of mass of the boids closer than d
+struct Cohesion {
+  static constexpr unsigned terms = positionsTerm;
+
+  template <class T>
+  static Vec2<T> steer(const BasicBoid<T>& boid,
+                       const BasicSteeringSums<T>& sums,
+                       const RuleContext& context) {
+    Vec2<T> position = boid.getPosition();
+    Vec2<T> xc = (T{1} / (context.N - 1)) * (sums.positions - position);
+    if (xc.x != 0 && xc.y != 0) {
+      return T(boid.getPar().c) * (xc - position);
+    }
+    return {0, 0};
+  }
+};
+
+// a random push of up to strength * maxspeed per component, drawn from the
+// id of the boid and the tick only: the same in any update mode, with any
+// number of threads, across reorders and again after a restore()
+struct Wander {
+  static constexpr unsigned terms = 0;
+  static constexpr double strength = 0.05;
+
+  template <class T>
+  static Vec2<T> steer(const BasicBoid<T>& boid, const BasicSteeringSums<T>&,
+                       const RuleContext& context) {
+    // splitmix64 of the pair, two 24 bit uniforms out of it
+    std::uint64_t h = (std::uint64_t(std::uint32_t(context.id)) << 32) ^
+                      std::uint64_t(context.tick);
+    h += 0x9e3779b97f4a7c15ull;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    constexpr double unit = 1. / (1 << 23);  // [0, 2^24) to [0, 2)
+    double x = (h >> 40) * unit - 1.;
+    double y = ((h >> 16) & 0xffffff) * unit - 1.;
+    double scale = strength * boid.getMaxspeed();
+    return {T(x * scale), T(y * scale)};
+  }
+};
+
+// the sum of the steering of R..., added left to right
+template <class... R>
+struct Rules {
+  static constexpr unsigned terms = (0u | ... | R::terms);
+
+  template <class T>
+  static Vec2<T> steer(const BasicBoid<T>& boid,
+                       const BasicSteeringSums<T>& sums,
+                       const RuleContext& context) {
+    if constexpr (sizeof...(R) == 0) {
+      return {0, 0};
+    } else {
+      return (... + R::steer(boid, sums, context));
+    }
+  }
+};
+
+// the rules of Boid::steering(), v1 + v2 + v3
+using DefaultRules = Rules<Separation, Alignment, Cohesion>;
+
+}  // namespace bd
+
+#endif
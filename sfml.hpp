@@ -0,0 +1,30 @@
+#pragma once
+#ifndef SFML_HPP
+#define SFML_HPP
+
+#include <SFML/System/Vector2.hpp>
+
+#include "vec2.hpp"
+
+namespace bd {
+
+// conversions between the vectors of the simulation and the ones of SFML,
+// for the render layer only; both are two plain components
+template <class U, class T>
+sf::Vector2<U> toSf(const Vec2<T>& v) {
+  return sf::Vector2<U>(static_cast<U>(v.x), static_cast<U>(v.y));
+}
+
+template <class T>
+sf::Vector2<T> toSf(const Vec2<T>& v) {
+  return toSf<T, T>(v);
+}
+
+template <class T>
+Vec2<T> fromSf(const sf::Vector2<T>& v) {
+  return {v.x, v.y};
+}
+
+}  // namespace bd
+
+#endif
@@ -0,0 +1,932 @@
+#include "simd.hpp"
+
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BD_SIMD_X86
+#endif
+
+namespace bd {
+
+namespace {
+
+// inputs shared by all the kernels
+template <class T>
+struct Query {
+  T px;
+  T py;
+  T pvx;
+  T pvy;
+  T ds2;
+  T d2;
+  T width;  // of the periodic world, see minimum image below
+  T halfWidth;
+  T height;
+  T halfHeight;
+  const T* x;
+  const T* y;
+  const T* vx;
+  const T* vy;
+};
+
+template <class T>
+Query<T> makeQuery(const Vec2<T>& position, const Vec2<T>& velocity,
+                   const Parameters& par, const BasicBoidArrays<T>& boids,
+                   const World* world) {
+  double width = world ? world->width : 0.;
+  double height = world ? world->height : 0.;
+  return {position.x,
+          position.y,
+          velocity.x,
+          velocity.y,
+          static_cast<T>(par.ds * par.ds),
+          static_cast<T>(par.d * par.d),
+          static_cast<T>(width),
+          static_cast<T>(width / 2),
+          static_cast<T>(height),
+          static_cast<T>(height / 2),
+          boids.x.data(),
+          boids.y.data(),
+          boids.vx.data(),
+          boids.vy.data()};
+}
+
+// partial sums, one per component of SteeringSums
+template <class T>
+struct Partial {
+  T sep_x{};
+  T sep_y{};
+  T ali_x{};
+  T ali_y{};
+  T coh_x{};
+  T coh_y{};
+  int count{};
+};
+
+// what a kernel gathers, out of the SteeringTerm bits of Terms: the code of
+// the other members is left out of it
+template <unsigned Terms>
+struct Gather {
+  static constexpr bool displacements = Terms & displacementsTerm;
+  static constexpr bool velocities = Terms & velocitiesTerm;
+  static constexpr bool positions = Terms & positionsTerm;
+  static constexpr bool neighbors = Terms & neighborsTerm;
+  // the test against d is needed by the last three
+  static constexpr bool inRange = velocities || positions || neighbors;
+};
+
+// one boid at a time: the body of the scalar kernel and the tail of the
+// vector ones
+template <unsigned Terms, bool Periodic, class T>
+inline void visit(Partial<T>& p, const Query<T>& q, int j) {
+  using G = Gather<Terms>;
+  T dX = q.x[j] - q.px;
+  T dY = q.y[j] - q.py;
+  if constexpr (Periodic) {
+    dX -= dX > q.halfWidth ? q.width : T{};
+    dX += dX < -q.halfWidth ? q.width : T{};
+    dY -= dY > q.halfHeight ? q.height : T{};
+    dY += dY < -q.halfHeight ? q.height : T{};
+  }
+  T distance2 = dX * dX + dY * dY;
+  if constexpr (G::displacements) {
+    bool close = distance2 < q.ds2;
+    p.sep_x += close ? dX : T{};
+    p.sep_y += close ? dY : T{};
+  }
+  if constexpr (G::inRange) {
+    bool inRange = distance2 < q.d2;
+    if constexpr (G::velocities) {
+      p.ali_x += inRange ? q.vx[j] - q.pvx : T{};
+      p.ali_y += inRange ? q.vy[j] - q.pvy : T{};
+    }
+    if constexpr (G::positions) {
+      p.coh_x += inRange ? (Periodic ? q.px + dX : q.x[j]) : T{};
+      p.coh_y += inRange ? (Periodic ? q.py + dY : q.y[j]) : T{};
+    }
+    if constexpr (G::neighbors) {
+      p.count += inRange;
+    }
+  }
+}
+
+template <unsigned Terms, class T>
+void addTo(BasicSteeringSums<T>& sums, const Partial<T>& p) {
+  using G = Gather<Terms>;
+  if constexpr (G::displacements) {
+    sums.displacements.x += p.sep_x;
+    sums.displacements.y += p.sep_y;
+  }
+  if constexpr (G::velocities) {
+    sums.velocities.x += p.ali_x;
+    sums.velocities.y += p.ali_y;
+  }
+  if constexpr (G::positions) {
+    sums.positions.x += p.coh_x;
+    sums.positions.y += p.coh_y;
+  }
+  if constexpr (G::neighbors) {
+    sums.neighbors += p.count;
+  }
+}
+
+template <unsigned Terms, bool Periodic, class T>
+void scalarKernel(BasicSteeringSums<T>& sums, const Query<T>& q,
+                  const Range* ranges, int count) {
+  using G = Gather<Terms>;
+  T sep_x{};
+  T sep_y{};
+  T ali_x{};
+  T ali_y{};
+  T coh_x{};
+  T coh_y{};
+  int neighbors{};
+
+  for (int r = 0; r < count; ++r) {
+    // same as visit(), written out so that the pragma sees the reduction
+#pragma omp simd reduction(+ : sep_x, sep_y, ali_x, ali_y, coh_x, coh_y, \
+                               neighbors)
+    for (int j = ranges[r].begin; j < ranges[r].end; ++j) {
+      T dX = q.x[j] - q.px;
+      T dY = q.y[j] - q.py;
+      if constexpr (Periodic) {
+        dX -= dX > q.halfWidth ? q.width : T{};
+        dX += dX < -q.halfWidth ? q.width : T{};
+        dY -= dY > q.halfHeight ? q.height : T{};
+        dY += dY < -q.halfHeight ? q.height : T{};
+      }
+      T distance2 = dX * dX + dY * dY;
+      if constexpr (G::displacements) {
+        bool close = distance2 < q.ds2;
+        sep_x += close ? dX : T{};
+        sep_y += close ? dY : T{};
+      }
+      if constexpr (G::inRange) {
+        bool inRange = distance2 < q.d2;
+        if constexpr (G::velocities) {
+          ali_x += inRange ? q.vx[j] - q.pvx : T{};
+          ali_y += inRange ? q.vy[j] - q.pvy : T{};
+        }
+        if constexpr (G::positions) {
+          coh_x += inRange ? (Periodic ? q.px + dX : q.x[j]) : T{};
+          coh_y += inRange ? (Periodic ? q.py + dY : q.y[j]) : T{};
+        }
+        if constexpr (G::neighbors) {
+          neighbors += inRange;
+        }
+      }
+    }
+  }
+
+  addTo<Terms>(sums,
+               Partial<T>{sep_x, sep_y, ali_x, ali_y, coh_x, coh_y, neighbors});
+}
+
+#ifdef BD_SIMD_X86
+
+// The comparison masks are all ones or all zeros, so and-ing them with a
+// term keeps it or turns it into 0. The constants a kernel does not need
+// are left unused when some terms are compiled out.
+template <unsigned Terms, bool Periodic>
+__attribute__((target("sse2"))) void sse2Kernel(SteeringSums& sums,
+                                                const Query<double>& q,
+                                                const Range* ranges,
+                                                int count) {
+  using G = Gather<Terms>;
+  const __m128d px = _mm_set1_pd(q.px);
+  const __m128d py = _mm_set1_pd(q.py);
+  [[maybe_unused]] const __m128d wx = _mm_set1_pd(q.width);
+  [[maybe_unused]] const __m128d hwx = _mm_set1_pd(q.halfWidth);
+  [[maybe_unused]] const __m128d nhwx = _mm_set1_pd(-q.halfWidth);
+  [[maybe_unused]] const __m128d wy = _mm_set1_pd(q.height);
+  [[maybe_unused]] const __m128d hwy = _mm_set1_pd(q.halfHeight);
+  [[maybe_unused]] const __m128d nhwy = _mm_set1_pd(-q.halfHeight);
+  [[maybe_unused]] const __m128d pvx = _mm_set1_pd(q.pvx);
+  [[maybe_unused]] const __m128d pvy = _mm_set1_pd(q.pvy);
+  [[maybe_unused]] const __m128d ds2 = _mm_set1_pd(q.ds2);
+  [[maybe_unused]] const __m128d d2 = _mm_set1_pd(q.d2);
+  __m128d sep_x = _mm_setzero_pd();
+  __m128d sep_y = _mm_setzero_pd();
+  __m128d ali_x = _mm_setzero_pd();
+  __m128d ali_y = _mm_setzero_pd();
+  __m128d coh_x = _mm_setzero_pd();
+  __m128d coh_y = _mm_setzero_pd();
+  int neighbors = 0;
+
+  for (int r = 0; r < count; ++r) {
+    int begin = ranges[r].begin;
+    int end = ranges[r].end;
+    for (int j = begin; j + 2 <= end; j += 2) {
+      __m128d x = _mm_loadu_pd(q.x + j);
+      __m128d y = _mm_loadu_pd(q.y + j);
+      __m128d dX = _mm_sub_pd(x, px);
+      __m128d dY = _mm_sub_pd(y, py);
+      if constexpr (Periodic) {
+        dX = _mm_sub_pd(dX, _mm_and_pd(_mm_cmpgt_pd(dX, hwx), wx));
+        dX = _mm_add_pd(dX, _mm_and_pd(_mm_cmplt_pd(dX, nhwx), wx));
+        dY = _mm_sub_pd(dY, _mm_and_pd(_mm_cmpgt_pd(dY, hwy), wy));
+        dY = _mm_add_pd(dY, _mm_and_pd(_mm_cmplt_pd(dY, nhwy), wy));
+        x = _mm_add_pd(px, dX);
+        y = _mm_add_pd(py, dY);
+      }
+      __m128d distance2 = _mm_add_pd(_mm_mul_pd(dX, dX), _mm_mul_pd(dY, dY));
+      if constexpr (G::displacements) {
+        __m128d close = _mm_cmplt_pd(distance2, ds2);
+        sep_x = _mm_add_pd(sep_x, _mm_and_pd(close, dX));
+        sep_y = _mm_add_pd(sep_y, _mm_and_pd(close, dY));
+      }
+      if constexpr (G::inRange) {
+        __m128d inRange = _mm_cmplt_pd(distance2, d2);
+        if constexpr (G::velocities) {
+          __m128d dVx = _mm_sub_pd(_mm_loadu_pd(q.vx + j), pvx);
+          __m128d dVy = _mm_sub_pd(_mm_loadu_pd(q.vy + j), pvy);
+          ali_x = _mm_add_pd(ali_x, _mm_and_pd(inRange, dVx));
+          ali_y = _mm_add_pd(ali_y, _mm_and_pd(inRange, dVy));
+        }
+        if constexpr (G::positions) {
+          coh_x = _mm_add_pd(coh_x, _mm_and_pd(inRange, x));
+          coh_y = _mm_add_pd(coh_y, _mm_and_pd(inRange, y));
+        }
+        if constexpr (G::neighbors) {
+          neighbors += __builtin_popcount(_mm_movemask_pd(inRange));
+        }
+      }
+    }
+  }
+
+  double lanes[6][2];
+  _mm_storeu_pd(lanes[0], sep_x);
+  _mm_storeu_pd(lanes[1], sep_y);
+  _mm_storeu_pd(lanes[2], ali_x);
+  _mm_storeu_pd(lanes[3], ali_y);
+  _mm_storeu_pd(lanes[4], coh_x);
+  _mm_storeu_pd(lanes[5], coh_y);
+  Partial<double> p{lanes[0][0] + lanes[0][1], lanes[1][0] + lanes[1][1],
+                    lanes[2][0] + lanes[2][1], lanes[3][0] + lanes[3][1],
+                    lanes[4][0] + lanes[4][1], lanes[5][0] + lanes[5][1],
+                    neighbors};
+  // the tails last, in the order of the ranges
+  for (int r = 0; r < count; ++r) {
+    int end = ranges[r].end;
+    for (int j = end - (end - ranges[r].begin) % 2; j < end; ++j) {
+      visit<Terms, Periodic>(p, q, j);
+    }
+  }
+  addTo<Terms>(sums, p);
+}
+
+template <unsigned Terms, bool Periodic>
+__attribute__((target("avx2"))) void avx2Kernel(SteeringSums& sums,
+                                                const Query<double>& q,
+                                                const Range* ranges,
+                                                int count) {
+  using G = Gather<Terms>;
+  const __m256d px = _mm256_set1_pd(q.px);
+  const __m256d py = _mm256_set1_pd(q.py);
+  [[maybe_unused]] const __m256d wx = _mm256_set1_pd(q.width);
+  [[maybe_unused]] const __m256d hwx = _mm256_set1_pd(q.halfWidth);
+  [[maybe_unused]] const __m256d nhwx = _mm256_set1_pd(-q.halfWidth);
+  [[maybe_unused]] const __m256d wy = _mm256_set1_pd(q.height);
+  [[maybe_unused]] const __m256d hwy = _mm256_set1_pd(q.halfHeight);
+  [[maybe_unused]] const __m256d nhwy = _mm256_set1_pd(-q.halfHeight);
+  [[maybe_unused]] const __m256d pvx = _mm256_set1_pd(q.pvx);
+  [[maybe_unused]] const __m256d pvy = _mm256_set1_pd(q.pvy);
+  [[maybe_unused]] const __m256d ds2 = _mm256_set1_pd(q.ds2);
+  [[maybe_unused]] const __m256d d2 = _mm256_set1_pd(q.d2);
+  __m256d sep_x = _mm256_setzero_pd();
+  __m256d sep_y = _mm256_setzero_pd();
+  __m256d ali_x = _mm256_setzero_pd();
+  __m256d ali_y = _mm256_setzero_pd();
+  __m256d coh_x = _mm256_setzero_pd();
+  __m256d coh_y = _mm256_setzero_pd();
+  int neighbors = 0;
+
+  for (int r = 0; r < count; ++r) {
+    int begin = ranges[r].begin;
+    int end = ranges[r].end;
+    for (int j = begin; j + 4 <= end; j += 4) {
+      __m256d x = _mm256_loadu_pd(q.x + j);
+      __m256d y = _mm256_loadu_pd(q.y + j);
+      __m256d dX = _mm256_sub_pd(x, px);
+      __m256d dY = _mm256_sub_pd(y, py);
+      if constexpr (Periodic) {
+        dX = _mm256_sub_pd(
+            dX, _mm256_and_pd(_mm256_cmp_pd(dX, hwx, _CMP_GT_OQ), wx));
+        dX = _mm256_add_pd(
+            dX, _mm256_and_pd(_mm256_cmp_pd(dX, nhwx, _CMP_LT_OQ), wx));
+        dY = _mm256_sub_pd(
+            dY, _mm256_and_pd(_mm256_cmp_pd(dY, hwy, _CMP_GT_OQ), wy));
+        dY = _mm256_add_pd(
+            dY, _mm256_and_pd(_mm256_cmp_pd(dY, nhwy, _CMP_LT_OQ), wy));
+        x = _mm256_add_pd(px, dX);
+        y = _mm256_add_pd(py, dY);
+      }
+      __m256d distance2 =
+          _mm256_add_pd(_mm256_mul_pd(dX, dX), _mm256_mul_pd(dY, dY));
+      if constexpr (G::displacements) {
+        __m256d close = _mm256_cmp_pd(distance2, ds2, _CMP_LT_OQ);
+        sep_x = _mm256_add_pd(sep_x, _mm256_and_pd(close, dX));
+        sep_y = _mm256_add_pd(sep_y, _mm256_and_pd(close, dY));
+      }
+      if constexpr (G::inRange) {
+        __m256d inRange = _mm256_cmp_pd(distance2, d2, _CMP_LT_OQ);
+        if constexpr (G::velocities) {
+          __m256d dVx = _mm256_sub_pd(_mm256_loadu_pd(q.vx + j), pvx);
+          __m256d dVy = _mm256_sub_pd(_mm256_loadu_pd(q.vy + j), pvy);
+          ali_x = _mm256_add_pd(ali_x, _mm256_and_pd(inRange, dVx));
+          ali_y = _mm256_add_pd(ali_y, _mm256_and_pd(inRange, dVy));
+        }
+        if constexpr (G::positions) {
+          coh_x = _mm256_add_pd(coh_x, _mm256_and_pd(inRange, x));
+          coh_y = _mm256_add_pd(coh_y, _mm256_and_pd(inRange, y));
+        }
+        if constexpr (G::neighbors) {
+          neighbors += __builtin_popcount(_mm256_movemask_pd(inRange));
+        }
+      }
+    }
+  }
+
+  double lanes[6][4];
+  _mm256_storeu_pd(lanes[0], sep_x);
+  _mm256_storeu_pd(lanes[1], sep_y);
+  _mm256_storeu_pd(lanes[2], ali_x);
+  _mm256_storeu_pd(lanes[3], ali_y);
+  _mm256_storeu_pd(lanes[4], coh_x);
+  _mm256_storeu_pd(lanes[5], coh_y);
+  double h[6];
+  for (int k = 0; k < 6; ++k) {
+    h[k] = (lanes[k][0] + lanes[k][1]) + (lanes[k][2] + lanes[k][3]);
+  }
+  Partial<double> p{h[0], h[1], h[2], h[3], h[4], h[5], neighbors};
+  // the tails last, in the order of the ranges
+  for (int r = 0; r < count; ++r) {
+    int end = ranges[r].end;
+    for (int j = end - (end - ranges[r].begin) % 4; j < end; ++j) {
+      visit<Terms, Periodic>(p, q, j);
+    }
+  }
+  addTo<Terms>(sums, p);
+}
+
+// AVX-512 has mask registers: out of range lanes are simply not added, and
+// the tail is handled with masked loads instead of scalar code
+template <unsigned Terms, bool Periodic>
+__attribute__((target("avx512f"))) void avx512Kernel(SteeringSums& sums,
+                                                     const Query<double>& q,
+                                                     const Range* ranges,
+                                                     int count) {
+  using G = Gather<Terms>;
+  const __m512d px = _mm512_set1_pd(q.px);
+  const __m512d py = _mm512_set1_pd(q.py);
+  [[maybe_unused]] const __m512d wx = _mm512_set1_pd(q.width);
+  [[maybe_unused]] const __m512d hwx = _mm512_set1_pd(q.halfWidth);
+  [[maybe_unused]] const __m512d nhwx = _mm512_set1_pd(-q.halfWidth);
+  [[maybe_unused]] const __m512d wy = _mm512_set1_pd(q.height);
+  [[maybe_unused]] const __m512d hwy = _mm512_set1_pd(q.halfHeight);
+  [[maybe_unused]] const __m512d nhwy = _mm512_set1_pd(-q.halfHeight);
+  [[maybe_unused]] const __m512d pvx = _mm512_set1_pd(q.pvx);
+  [[maybe_unused]] const __m512d pvy = _mm512_set1_pd(q.pvy);
+  [[maybe_unused]] const __m512d ds2 = _mm512_set1_pd(q.ds2);
+  [[maybe_unused]] const __m512d d2 = _mm512_set1_pd(q.d2);
+  __m512d sep_x = _mm512_setzero_pd();
+  __m512d sep_y = _mm512_setzero_pd();
+  __m512d ali_x = _mm512_setzero_pd();
+  __m512d ali_y = _mm512_setzero_pd();
+  __m512d coh_x = _mm512_setzero_pd();
+  __m512d coh_y = _mm512_setzero_pd();
+  int neighbors = 0;
+
+  for (int r = 0; r < count; ++r) {
+    int begin = ranges[r].begin;
+    int end = ranges[r].end;
+    for (int j = begin; j < end; j += 8) {
+      __mmask8 valid = end - j >= 8 ? 0xff : (1u << (end - j)) - 1;
+      __m512d x = _mm512_maskz_loadu_pd(valid, q.x + j);
+      __m512d y = _mm512_maskz_loadu_pd(valid, q.y + j);
+      __m512d dX = _mm512_sub_pd(x, px);
+      __m512d dY = _mm512_sub_pd(y, py);
+      if constexpr (Periodic) {
+        dX = _mm512_mask_sub_pd(
+            dX, _mm512_cmp_pd_mask(dX, hwx, _CMP_GT_OQ), dX, wx);
+        dX = _mm512_mask_add_pd(
+            dX, _mm512_cmp_pd_mask(dX, nhwx, _CMP_LT_OQ), dX, wx);
+        dY = _mm512_mask_sub_pd(
+            dY, _mm512_cmp_pd_mask(dY, hwy, _CMP_GT_OQ), dY, wy);
+        dY = _mm512_mask_add_pd(
+            dY, _mm512_cmp_pd_mask(dY, nhwy, _CMP_LT_OQ), dY, wy);
+        x = _mm512_add_pd(px, dX);
+        y = _mm512_add_pd(py, dY);
+      }
+      __m512d distance2 =
+          _mm512_add_pd(_mm512_mul_pd(dX, dX), _mm512_mul_pd(dY, dY));
+      if constexpr (G::displacements) {
+        __mmask8 close =
+            _mm512_mask_cmp_pd_mask(valid, distance2, ds2, _CMP_LT_OQ);
+        sep_x = _mm512_mask_add_pd(sep_x, close, sep_x, dX);
+        sep_y = _mm512_mask_add_pd(sep_y, close, sep_y, dY);
+      }
+      if constexpr (G::inRange) {
+        __mmask8 inRange =
+            _mm512_mask_cmp_pd_mask(valid, distance2, d2, _CMP_LT_OQ);
+        if constexpr (G::velocities) {
+          __m512d dVx =
+              _mm512_sub_pd(_mm512_maskz_loadu_pd(valid, q.vx + j), pvx);
+          __m512d dVy =
+              _mm512_sub_pd(_mm512_maskz_loadu_pd(valid, q.vy + j), pvy);
+          ali_x = _mm512_mask_add_pd(ali_x, inRange, ali_x, dVx);
+          ali_y = _mm512_mask_add_pd(ali_y, inRange, ali_y, dVy);
+        }
+        if constexpr (G::positions) {
+          coh_x = _mm512_mask_add_pd(coh_x, inRange, coh_x, x);
+          coh_y = _mm512_mask_add_pd(coh_y, inRange, coh_y, y);
+        }
+        if constexpr (G::neighbors) {
+          neighbors += __builtin_popcount(inRange);
+        }
+      }
+    }
+  }
+
+  // stored and added by hand: _mm512_reduce_add_pd trips -Wuninitialized
+  // in the headers of GCC 12
+  double lanes[6][8];
+  _mm512_storeu_pd(lanes[0], sep_x);
+  _mm512_storeu_pd(lanes[1], sep_y);
+  _mm512_storeu_pd(lanes[2], ali_x);
+  _mm512_storeu_pd(lanes[3], ali_y);
+  _mm512_storeu_pd(lanes[4], coh_x);
+  _mm512_storeu_pd(lanes[5], coh_y);
+  double h[6];
+  for (int k = 0; k < 6; ++k) {
+    const double* l = lanes[k];
+    h[k] = ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+  }
+  addTo<Terms>(sums,
+               Partial<double>{h[0], h[1], h[2], h[3], h[4], h[5], neighbors});
+}
+
+// The same three kernels in float, with twice the lanes
+
+template <unsigned Terms, bool Periodic>
+__attribute__((target("sse2"))) void sse2Kernel(SteeringSumsF& sums,
+                                                const Query<float>& q,
+                                                const Range* ranges,
+                                                int count) {
+  using G = Gather<Terms>;
+  const __m128 px = _mm_set1_ps(q.px);
+  const __m128 py = _mm_set1_ps(q.py);
+  [[maybe_unused]] const __m128 wx = _mm_set1_ps(q.width);
+  [[maybe_unused]] const __m128 hwx = _mm_set1_ps(q.halfWidth);
+  [[maybe_unused]] const __m128 nhwx = _mm_set1_ps(-q.halfWidth);
+  [[maybe_unused]] const __m128 wy = _mm_set1_ps(q.height);
+  [[maybe_unused]] const __m128 hwy = _mm_set1_ps(q.halfHeight);
+  [[maybe_unused]] const __m128 nhwy = _mm_set1_ps(-q.halfHeight);
+  [[maybe_unused]] const __m128 pvx = _mm_set1_ps(q.pvx);
+  [[maybe_unused]] const __m128 pvy = _mm_set1_ps(q.pvy);
+  [[maybe_unused]] const __m128 ds2 = _mm_set1_ps(q.ds2);
+  [[maybe_unused]] const __m128 d2 = _mm_set1_ps(q.d2);
+  __m128 sep_x = _mm_setzero_ps();
+  __m128 sep_y = _mm_setzero_ps();
+  __m128 ali_x = _mm_setzero_ps();
+  __m128 ali_y = _mm_setzero_ps();
+  __m128 coh_x = _mm_setzero_ps();
+  __m128 coh_y = _mm_setzero_ps();
+  int neighbors = 0;
+
+  for (int r = 0; r < count; ++r) {
+    int begin = ranges[r].begin;
+    int end = ranges[r].end;
+    for (int j = begin; j + 4 <= end; j += 4) {
+      __m128 x = _mm_loadu_ps(q.x + j);
+      __m128 y = _mm_loadu_ps(q.y + j);
+      __m128 dX = _mm_sub_ps(x, px);
+      __m128 dY = _mm_sub_ps(y, py);
+      if constexpr (Periodic) {
+        dX = _mm_sub_ps(dX, _mm_and_ps(_mm_cmpgt_ps(dX, hwx), wx));
+        dX = _mm_add_ps(dX, _mm_and_ps(_mm_cmplt_ps(dX, nhwx), wx));
+        dY = _mm_sub_ps(dY, _mm_and_ps(_mm_cmpgt_ps(dY, hwy), wy));
+        dY = _mm_add_ps(dY, _mm_and_ps(_mm_cmplt_ps(dY, nhwy), wy));
+        x = _mm_add_ps(px, dX);
+        y = _mm_add_ps(py, dY);
+      }
+      __m128 distance2 = _mm_add_ps(_mm_mul_ps(dX, dX), _mm_mul_ps(dY, dY));
+      if constexpr (G::displacements) {
+        __m128 close = _mm_cmplt_ps(distance2, ds2);
+        sep_x = _mm_add_ps(sep_x, _mm_and_ps(close, dX));
+        sep_y = _mm_add_ps(sep_y, _mm_and_ps(close, dY));
+      }
+      if constexpr (G::inRange) {
+        __m128 inRange = _mm_cmplt_ps(distance2, d2);
+        if constexpr (G::velocities) {
+          __m128 dVx = _mm_sub_ps(_mm_loadu_ps(q.vx + j), pvx);
+          __m128 dVy = _mm_sub_ps(_mm_loadu_ps(q.vy + j), pvy);
+          ali_x = _mm_add_ps(ali_x, _mm_and_ps(inRange, dVx));
+          ali_y = _mm_add_ps(ali_y, _mm_and_ps(inRange, dVy));
+        }
+        if constexpr (G::positions) {
+          coh_x = _mm_add_ps(coh_x, _mm_and_ps(inRange, x));
+          coh_y = _mm_add_ps(coh_y, _mm_and_ps(inRange, y));
+        }
+        if constexpr (G::neighbors) {
+          neighbors += __builtin_popcount(_mm_movemask_ps(inRange));
+        }
+      }
+    }
+  }
+
+  float lanes[6][4];
+  _mm_storeu_ps(lanes[0], sep_x);
+  _mm_storeu_ps(lanes[1], sep_y);
+  _mm_storeu_ps(lanes[2], ali_x);
+  _mm_storeu_ps(lanes[3], ali_y);
+  _mm_storeu_ps(lanes[4], coh_x);
+  _mm_storeu_ps(lanes[5], coh_y);
+  float h[6];
+  for (int k = 0; k < 6; ++k) {
+    h[k] = (lanes[k][0] + lanes[k][1]) + (lanes[k][2] + lanes[k][3]);
+  }
+  Partial<float> p{h[0], h[1], h[2], h[3], h[4], h[5], neighbors};
+  // the tails last, in the order of the ranges
+  for (int r = 0; r < count; ++r) {
+    int end = ranges[r].end;
+    for (int j = end - (end - ranges[r].begin) % 4; j < end; ++j) {
+      visit<Terms, Periodic>(p, q, j);
+    }
+  }
+  addTo<Terms>(sums, p);
+}
+
+template <unsigned Terms, bool Periodic>
+__attribute__((target("avx2"))) void avx2Kernel(SteeringSumsF& sums,
+                                                const Query<float>& q,
+                                                const Range* ranges,
+                                                int count) {
+  using G = Gather<Terms>;
+  const __m256 px = _mm256_set1_ps(q.px);
+  const __m256 py = _mm256_set1_ps(q.py);
+  [[maybe_unused]] const __m256 wx = _mm256_set1_ps(q.width);
+  [[maybe_unused]] const __m256 hwx = _mm256_set1_ps(q.halfWidth);
+  [[maybe_unused]] const __m256 nhwx = _mm256_set1_ps(-q.halfWidth);
+  [[maybe_unused]] const __m256 wy = _mm256_set1_ps(q.height);
+  [[maybe_unused]] const __m256 hwy = _mm256_set1_ps(q.halfHeight);
+  [[maybe_unused]] const __m256 nhwy = _mm256_set1_ps(-q.halfHeight);
+  [[maybe_unused]] const __m256 pvx = _mm256_set1_ps(q.pvx);
+  [[maybe_unused]] const __m256 pvy = _mm256_set1_ps(q.pvy);
+  [[maybe_unused]] const __m256 ds2 = _mm256_set1_ps(q.ds2);
+  [[maybe_unused]] const __m256 d2 = _mm256_set1_ps(q.d2);
+  __m256 sep_x = _mm256_setzero_ps();
+  __m256 sep_y = _mm256_setzero_ps();
+  __m256 ali_x = _mm256_setzero_ps();
+  __m256 ali_y = _mm256_setzero_ps();
+  __m256 coh_x = _mm256_setzero_ps();
+  __m256 coh_y = _mm256_setzero_ps();
+  int neighbors = 0;
+
+  for (int r = 0; r < count; ++r) {
+    int begin = ranges[r].begin;
+    int end = ranges[r].end;
+    for (int j = begin; j + 8 <= end; j += 8) {
+      __m256 x = _mm256_loadu_ps(q.x + j);
+      __m256 y = _mm256_loadu_ps(q.y + j);
+      __m256 dX = _mm256_sub_ps(x, px);
+      __m256 dY = _mm256_sub_ps(y, py);
+      if constexpr (Periodic) {
+        dX = _mm256_sub_ps(
+            dX, _mm256_and_ps(_mm256_cmp_ps(dX, hwx, _CMP_GT_OQ), wx));
+        dX = _mm256_add_ps(
+            dX, _mm256_and_ps(_mm256_cmp_ps(dX, nhwx, _CMP_LT_OQ), wx));
+        dY = _mm256_sub_ps(
+            dY, _mm256_and_ps(_mm256_cmp_ps(dY, hwy, _CMP_GT_OQ), wy));
+        dY = _mm256_add_ps(
+            dY, _mm256_and_ps(_mm256_cmp_ps(dY, nhwy, _CMP_LT_OQ), wy));
+        x = _mm256_add_ps(px, dX);
+        y = _mm256_add_ps(py, dY);
+      }
+      __m256 distance2 =
+          _mm256_add_ps(_mm256_mul_ps(dX, dX), _mm256_mul_ps(dY, dY));
+      if constexpr (G::displacements) {
+        __m256 close = _mm256_cmp_ps(distance2, ds2, _CMP_LT_OQ);
+        sep_x = _mm256_add_ps(sep_x, _mm256_and_ps(close, dX));
+        sep_y = _mm256_add_ps(sep_y, _mm256_and_ps(close, dY));
+      }
+      if constexpr (G::inRange) {
+        __m256 inRange = _mm256_cmp_ps(distance2, d2, _CMP_LT_OQ);
+        if constexpr (G::velocities) {
+          __m256 dVx = _mm256_sub_ps(_mm256_loadu_ps(q.vx + j), pvx);
+          __m256 dVy = _mm256_sub_ps(_mm256_loadu_ps(q.vy + j), pvy);
+          ali_x = _mm256_add_ps(ali_x, _mm256_and_ps(inRange, dVx));
+          ali_y = _mm256_add_ps(ali_y, _mm256_and_ps(inRange, dVy));
+        }
+        if constexpr (G::positions) {
+          coh_x = _mm256_add_ps(coh_x, _mm256_and_ps(inRange, x));
+          coh_y = _mm256_add_ps(coh_y, _mm256_and_ps(inRange, y));
+        }
+        if constexpr (G::neighbors) {
+          neighbors += __builtin_popcount(_mm256_movemask_ps(inRange));
+        }
+      }
+    }
+  }
+
+  float lanes[6][8];
+  _mm256_storeu_ps(lanes[0], sep_x);
+  _mm256_storeu_ps(lanes[1], sep_y);
+  _mm256_storeu_ps(lanes[2], ali_x);
+  _mm256_storeu_ps(lanes[3], ali_y);
+  _mm256_storeu_ps(lanes[4], coh_x);
+  _mm256_storeu_ps(lanes[5], coh_y);
+  float h[6];
+  for (int k = 0; k < 6; ++k) {
+    const float* l = lanes[k];
+    h[k] = ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+  }
+  Partial<float> p{h[0], h[1], h[2], h[3], h[4], h[5], neighbors};
+  // the tails last, in the order of the ranges
+  for (int r = 0; r < count; ++r) {
+    int end = ranges[r].end;
+    for (int j = end - (end - ranges[r].begin) % 8; j < end; ++j) {
+      visit<Terms, Periodic>(p, q, j);
+    }
+  }
+  addTo<Terms>(sums, p);
+}
+
+template <unsigned Terms, bool Periodic>
+__attribute__((target("avx512f"))) void avx512Kernel(SteeringSumsF& sums,
+                                                     const Query<float>& q,
+                                                     const Range* ranges,
+                                                     int count) {
+  using G = Gather<Terms>;
+  const __m512 px = _mm512_set1_ps(q.px);
+  const __m512 py = _mm512_set1_ps(q.py);
+  [[maybe_unused]] const __m512 wx = _mm512_set1_ps(q.width);
+  [[maybe_unused]] const __m512 hwx = _mm512_set1_ps(q.halfWidth);
+  [[maybe_unused]] const __m512 nhwx = _mm512_set1_ps(-q.halfWidth);
+  [[maybe_unused]] const __m512 wy = _mm512_set1_ps(q.height);
+  [[maybe_unused]] const __m512 hwy = _mm512_set1_ps(q.halfHeight);
+  [[maybe_unused]] const __m512 nhwy = _mm512_set1_ps(-q.halfHeight);
+  [[maybe_unused]] const __m512 pvx = _mm512_set1_ps(q.pvx);
+  [[maybe_unused]] const __m512 pvy = _mm512_set1_ps(q.pvy);
+  [[maybe_unused]] const __m512 ds2 = _mm512_set1_ps(q.ds2);
+  [[maybe_unused]] const __m512 d2 = _mm512_set1_ps(q.d2);
+  __m512 sep_x = _mm512_setzero_ps();
+  __m512 sep_y = _mm512_setzero_ps();
+  __m512 ali_x = _mm512_setzero_ps();
+  __m512 ali_y = _mm512_setzero_ps();
+  __m512 coh_x = _mm512_setzero_ps();
+  __m512 coh_y = _mm512_setzero_ps();
+  int neighbors = 0;
+
+  for (int r = 0; r < count; ++r) {
+    int begin = ranges[r].begin;
+    int end = ranges[r].end;
+    for (int j = begin; j < end; j += 16) {
+      __mmask16 valid = end - j >= 16 ? 0xffff : (1u << (end - j)) - 1;
+      __m512 x = _mm512_maskz_loadu_ps(valid, q.x + j);
+      __m512 y = _mm512_maskz_loadu_ps(valid, q.y + j);
+      __m512 dX = _mm512_sub_ps(x, px);
+      __m512 dY = _mm512_sub_ps(y, py);
+      if constexpr (Periodic) {
+        dX = _mm512_mask_sub_ps(
+            dX, _mm512_cmp_ps_mask(dX, hwx, _CMP_GT_OQ), dX, wx);
+        dX = _mm512_mask_add_ps(
+            dX, _mm512_cmp_ps_mask(dX, nhwx, _CMP_LT_OQ), dX, wx);
+        dY = _mm512_mask_sub_ps(
+            dY, _mm512_cmp_ps_mask(dY, hwy, _CMP_GT_OQ), dY, wy);
+        dY = _mm512_mask_add_ps(
+            dY, _mm512_cmp_ps_mask(dY, nhwy, _CMP_LT_OQ), dY, wy);
+        x = _mm512_add_ps(px, dX);
+        y = _mm512_add_ps(py, dY);
+      }
+      __m512 distance2 =
+          _mm512_add_ps(_mm512_mul_ps(dX, dX), _mm512_mul_ps(dY, dY));
+      if constexpr (G::displacements) {
+        __mmask16 close =
+            _mm512_mask_cmp_ps_mask(valid, distance2, ds2, _CMP_LT_OQ);
+        sep_x = _mm512_mask_add_ps(sep_x, close, sep_x, dX);
+        sep_y = _mm512_mask_add_ps(sep_y, close, sep_y, dY);
+      }
+      if constexpr (G::inRange) {
+        __mmask16 inRange =
+            _mm512_mask_cmp_ps_mask(valid, distance2, d2, _CMP_LT_OQ);
+        if constexpr (G::velocities) {
+          __m512 dVx =
+              _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, q.vx + j), pvx);
+          __m512 dVy =
+              _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, q.vy + j), pvy);
+          ali_x = _mm512_mask_add_ps(ali_x, inRange, ali_x, dVx);
+          ali_y = _mm512_mask_add_ps(ali_y, inRange, ali_y, dVy);
+        }
+        if constexpr (G::positions) {
+          coh_x = _mm512_mask_add_ps(coh_x, inRange, coh_x, x);
+          coh_y = _mm512_mask_add_ps(coh_y, inRange, coh_y, y);
+        }
+        if constexpr (G::neighbors) {
+          neighbors += __builtin_popcount(inRange);
+        }
+      }
+    }
+  }
+
+  // the upper half of each sum is added to the lower one as a vector first,
+  // which halves the additions left to do one by one; through memory, for
+  // the same reason as in the kernel in double
+  const __m512 total[6]{sep_x, sep_y, ali_x, ali_y, coh_x, coh_y};
+  float lanes[6][16];
+  for (int k = 0; k < 6; ++k) {
+    _mm512_storeu_ps(lanes[k], total[k]);
+    _mm256_storeu_ps(lanes[k], _mm256_add_ps(_mm256_loadu_ps(lanes[k]),
+                                             _mm256_loadu_ps(lanes[k] + 8)));
+  }
+  float h[6];
+  for (int k = 0; k < 6; ++k) {
+    const float* l = lanes[k];
+    h[k] = ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+  }
+  addTo<Terms>(sums,
+               Partial<float>{h[0], h[1], h[2], h[3], h[4], h[5], neighbors});
+}
+
+#endif
+
+Simd& selected() {
+  static Simd level = bestSimd();
+  return level;
+}
+
+}  // namespace
+
+const char* simdName(Simd level) {
+  switch (level) {
+    case Simd::scalar:
+      return "scalar";
+    case Simd::sse2:
+      return "sse2";
+    case Simd::avx2:
+      return "avx2";
+    case Simd::avx512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+bool simdSupported(Simd level) {
+#ifdef BD_SIMD_X86
+  // __builtin_cpu_supports reads CPUID once at startup, and also checks
+  // with XGETBV that the OS saves the wider registers
+  switch (level) {
+    case Simd::scalar:
+      return true;
+    case Simd::sse2:
+      return __builtin_cpu_supports("sse2");
+    case Simd::avx2:
+      return __builtin_cpu_supports("avx2");
+    case Simd::avx512:
+      return __builtin_cpu_supports("avx512f");
+  }
+  return false;
+#else
+  return level == Simd::scalar;
+#endif
+}
+
+Simd bestSimd() {
+  for (Simd level : {Simd::avx512, Simd::avx2, Simd::sse2}) {
+    if (simdSupported(level)) {
+      return level;
+    }
+  }
+  return Simd::scalar;
+}
+
+Simd currentSimd() { return selected(); }
+
+void useSimd(Simd level) {
+  if (!simdSupported(level)) {
+    throw std::runtime_error{std::string{"This CPU does not support "} +
+                             simdName(level)};
+  }
+  selected() = level;
+}
+
+namespace {
+
+template <class T>
+using Kernel = void (*)(BasicSteeringSums<T>&, const Query<T>&, const Range*,
+                        int);
+
+// kernels of every level, each for every set of terms and both kinds of
+// distance: the set asked for is a run time value, the code that gathers it
+// is not
+template <class T, bool Periodic, unsigned... Terms>
+constexpr std::array<std::array<Kernel<T>, allTerms + 1>, 4> kernelTable(
+    std::integer_sequence<unsigned, Terms...>) {
+#ifdef BD_SIMD_X86
+  return {{{&scalarKernel<Terms, Periodic, T>...},
+           {&sse2Kernel<Terms, Periodic>...},
+           {&avx2Kernel<Terms, Periodic>...},
+           {&avx512Kernel<Terms, Periodic>...}}};
+#else
+  return {{{&scalarKernel<Terms, Periodic, T>...},
+           {&scalarKernel<Terms, Periodic, T>...},
+           {&scalarKernel<Terms, Periodic, T>...},
+           {&scalarKernel<Terms, Periodic, T>...}}};
+#endif
+}
+
+// [periodic][level][terms]
+template <class T>
+constexpr std::array<std::array<std::array<Kernel<T>, allTerms + 1>, 4>, 2>
+    kernels{kernelTable<T, false>(
+                std::make_integer_sequence<unsigned, allTerms + 1>{}),
+            kernelTable<T, true>(
+                std::make_integer_sequence<unsigned, allTerms + 1>{})};
+
+template <class T>
+void dispatch(Simd level, BasicSteeringSums<T>& sums, const Vec2<T>& position,
+              const Vec2<T>& velocity, const Parameters& par,
+              const BasicBoidArrays<T>& boids, const Range* ranges, int count,
+              unsigned terms, const World* world) {
+  bool periodic = world && world->boundary == Boundary::periodic;
+  Query<T> q = makeQuery(position, velocity, par, boids, world);
+  kernels<T>[periodic][static_cast<int>(level)][terms & allTerms](
+      sums, q, ranges, count);
+}
+
+}  // namespace
+
+void steeringSums(Simd level, SteeringSums& sums,
+                  const Vec2<double>& position,
+                  const Vec2<double>& velocity, const Parameters& par,
+                  const BoidArrays& boids, const Range* ranges, int count,
+                  unsigned terms, const World* world) {
+  dispatch(level, sums, position, velocity, par, boids, ranges, count, terms,
+           world);
+}
+
+void steeringSums(Simd level, SteeringSumsF& sums,
+                  const Vec2<float>& position, const Vec2<float>& velocity,
+                  const Parameters& par, const BoidArraysF& boids,
+                  const Range* ranges, int count, unsigned terms,
+                  const World* world) {
+  dispatch(level, sums, position, velocity, par, boids, ranges, count, terms,
+           world);
+}
+
+void steeringSums(Simd level, SteeringSums& sums,
+                  const Vec2<double>& position,
+                  const Vec2<double>& velocity, const Parameters& par,
+                  const BoidArrays& boids, int begin, int end,
+                  unsigned terms, const World* world) {
+  Range range{begin, end};
+  dispatch(level, sums, position, velocity, par, boids, &range, 1, terms,
+           world);
+}
+
+void steeringSums(Simd level, SteeringSumsF& sums,
+                  const Vec2<float>& position, const Vec2<float>& velocity,
+                  const Parameters& par, const BoidArraysF& boids, int begin,
+                  int end, unsigned terms, const World* world) {
+  Range range{begin, end};
+  dispatch(level, sums, position, velocity, par, boids, &range, 1, terms,
+           world);
+}
+
+void steeringSums(SteeringSums& sums, const Vec2<double>& position,
+                  const Vec2<double>& velocity, const Parameters& par,
+                  const BoidArrays& boids, int begin, int end,
+                  unsigned terms, const World* world) {
+  steeringSums(selected(), sums, position, velocity, par, boids, begin, end,
+               terms, world);
+}
+
+void steeringSums(SteeringSumsF& sums, const Vec2<float>& position,
+                  const Vec2<float>& velocity, const Parameters& par,
+                  const BoidArraysF& boids, int begin, int end,
+                  unsigned terms, const World* world) {
+  steeringSums(selected(), sums, position, velocity, par, boids, begin, end,
+               terms, world);
+}
+
+void steeringSums(SteeringSums& sums, const Vec2<double>& position,
+                  const Vec2<double>& velocity, const Parameters& par,
+                  const BoidArrays& boids, const Range* ranges, int count,
+                  unsigned terms, const World* world) {
+  steeringSums(selected(), sums, position, velocity, par, boids, ranges,
+               count, terms, world);
+}
+
+void steeringSums(SteeringSumsF& sums, const Vec2<float>& position,
+                  const Vec2<float>& velocity, const Parameters& par,
+                  const BoidArraysF& boids, const Range* ranges, int count,
+                  unsigned terms, const World* world) {
+  steeringSums(selected(), sums, position, velocity, par, boids, ranges,
+               count, terms, world);
+}
+
+}  // namespace bd
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include "boid.hpp"
+
+namespace bd {
+
+// instruction sets with a hand-vectorized steeringSums() kernel
+enum class Simd { scalar, sse2, avx2, avx512 };
+
+const char* simdName(Simd level);
+
+// whether the CPU and the OS support the level, as reported by CPUID
+bool simdSupported(Simd level);
+
+// widest supported level, used by default
+Simd bestSimd();
+
+// level used by steeringSums(); not to be changed during an update
+Simd currentSimd();
+void useSimd(Simd level);
+
+// steeringSums() with the kernel of the given level. All kernels select the
+// same neighbors, since the distance test is computed in the same way, but
+// the vector ones add them up in a different order: for n neighbors each
+// component of the sums may differ from the scalar one by at most
+// 2 * (n - 1) * 2^-53 times the sum of the absolute values of its terms,
+// 2 * (n - 1) * 2^-24 times in float. Every level has a kernel for each
+// set of terms, so the members left out are not computed at all.
+void steeringSums(Simd level, SteeringSums& sums,
+                  const Vec2<double>& position,
+                  const Vec2<double>& velocity, const Parameters& par,
+                  const BoidArrays& boids, int begin, int end,
+                  unsigned terms = allTerms, const World* world = nullptr);
+void steeringSums(Simd level, SteeringSumsF& sums,
+                  const Vec2<float>& position, const Vec2<float>& velocity,
+                  const Parameters& par, const BoidArraysF& boids, int begin,
+                  int end, unsigned terms = allTerms,
+                  const World* world = nullptr);
+void steeringSums(Simd level, SteeringSums& sums,
+                  const Vec2<double>& position,
+                  const Vec2<double>& velocity, const Parameters& par,
+                  const BoidArrays& boids, const Range* ranges, int count,
+                  unsigned terms = allTerms, const World* world = nullptr);
+void steeringSums(Simd level, SteeringSumsF& sums,
+                  const Vec2<float>& position, const Vec2<float>& velocity,
+                  const Parameters& par, const BoidArraysF& boids,
+                  const Range* ranges, int count, unsigned terms = allTerms,
+                  const World* world = nullptr);
+
+}  // namespace bd
+
+#endif
@@ -0,0 +1,125 @@
+#include "simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace bd {
+
+namespace {
+
+double lerp(double from, double to, double alpha, double size) {
+  // a jump longer than half the world is a crossing of the border
+  if (std::abs(to - from) > size / 2) {
+    return to;
+  }
+  return from + alpha * (to - from);
+}
+
+}  // namespace
+
+void interpolate(const BoidArrays& from, const BoidArrays& to, double alpha,
+                 const World& world, BoidArrays& out) {
+  int n = to.size();
+  if (from.size() != n) {
+    throw std::runtime_error{"Cannot interpolate flocks of different sizes"};
+  }
+  out.resize(n);
+  for (int i = 0; i < n; ++i) {
+    out.x[i] = lerp(from.x[i], to.x[i], alpha, world.width);
+    out.y[i] = lerp(from.y[i], to.y[i], alpha, world.height);
+    out.vx[i] = from.vx[i] + alpha * (to.vx[i] - from.vx[i]);
+    out.vy[i] = from.vy[i] + alpha * (to.vy[i] - from.vy[i]);
+  }
+}
+
+Simulation::Simulation(const Flock& flock, double step)
+    : m_flock{flock}, m_step{step} {
+  if (step <= 0.) {
+    throw std::runtime_error{"The time step must be positive"};
+  }
+  Snapshot& first = m_snapshots.back();
+  m_flock.arraysById(first.current);
+  first.previous = first.current;
+  first.time = clock::now();
+  m_snapshots.publish();
+}
+
+Simulation::~Simulation() {
+  m_stop = true;
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+void Simulation::start() {
+  if (m_thread.joinable()) {
+    throw std::runtime_error{"The simulation is already running"};
+  }
+  m_stop = false;
+  m_running = true;
+  m_thread = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop() {
+  m_stop = true;
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  m_running = false;
+  if (m_error) {
+    std::exception_ptr error = m_error;
+    m_error = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void Simulation::run() {
+  auto step = std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(m_step));
+  auto next = clock::now() + step;
+  try {
+    while (!m_stop) {
+      std::this_thread::sleep_until(next);
+
+      Snapshot& snapshot = m_snapshots.back();
+      // by id, as a reorder moves the boids between the two
+      m_flock.arraysById(snapshot.previous);
+      m_flock.updateFlock(m_step);
+      m_flock.arraysById(snapshot.current);
+      snapshot.tick = ++m_ticks;
+      snapshot.time = clock::now();
+      m_snapshots.publish();
+
+      // a slow tick is followed by shorter sleeps until the simulation is
+      // back on schedule, unless it fell too far behind
+      next += step;
+      if (clock::now() - next > maxLag * step) {
+        next = clock::now();
+      }
+    }
+  } catch (...) {
+    m_error = std::current_exception();
+  }
+  m_running = false;
+}
+
+const Snapshot& Simulation::latest() {
+  m_snapshots.update();
+  return m_snapshots.front();
+}
+
+double Simulation::alpha(const Snapshot& snapshot) const {
+  double elapsed =
+      std::chrono::duration<double>(clock::now() - snapshot.time).count();
+  return std::min(elapsed / m_step, 1.);
+}
+
+const Flock& Simulation::flock() const {
+  if (m_thread.joinable()) {
+    throw std::runtime_error{"The flock is in use by the simulation thread"};
+  }
+  return m_flock;
+}
+
+}  // namespace bd
@@ -0,0 +1,78 @@
+#pragma once
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <thread>
+
+#include "flock.hpp"
+#include "triplebuffer.hpp"
+
+namespace bd {
+
+// state of the flock before and after a tick, as handed to the renderer
+struct Snapshot {
+  BoidArrays previous;
+  BoidArrays current;
+  long tick{};  // ticks done when current was computed
+  std::chrono::steady_clock::time_point time;  // when current was published
+};
+
+// positions and velocities a fraction alpha of the way from one state to
+// the next. A boid that crossed a border of world jumped to the other side
+// and is shown where it landed.
+void interpolate(const BoidArrays& from, const BoidArrays& to, double alpha,
+                 const World& world, BoidArrays& out);
+
+// Runs a flock on its own thread with a fixed time step, at the pace of the
+// wall clock, whatever the frame rate. Every tick is published as a Snapshot
+// through a triple buffer, so neither thread ever waits for the other; the
+// result only depends on the initial flock and on the number of ticks.
+class Simulation {
+  using clock = std::chrono::steady_clock;
+
+  Flock m_flock;
+  double m_step;
+  long m_ticks{};
+  TripleBuffer<Snapshot> m_snapshots;
+  std::thread m_thread;
+  std::atomic<bool> m_stop{false};
+  std::atomic<bool> m_running{false};
+  std::exception_ptr m_error;
+
+  void run();
+
+ public:
+  // at most this many steps of delay are caught up, more are skipped
+  static constexpr int maxLag{5};
+
+  Simulation(const Flock& flock, double step);
+  ~Simulation();
+
+  Simulation(const Simulation&) = delete;
+  Simulation& operator=(const Simulation&) = delete;
+
+  double step() const { return m_step; }
+
+  void start();
+  // joins the thread, rethrowing what made it fail if anything did
+  void stop();
+  // false once stopped or failed
+  bool running() const { return m_running; }
+
+  // render thread: the last published snapshot; the first one is the
+  // initial flock, at tick 0
+  const Snapshot& latest();
+  // fraction of a step elapsed since the snapshot was published, to be
+  // used for interpolate()
+  double alpha(const Snapshot& snapshot) const;
+
+  // the flock as left by the last tick, only while stopped
+  const Flock& flock() const;
+};
+
+}  // namespace bd
+
+#endif
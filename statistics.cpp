@@ -0,0 +1,97 @@
+#include "statistics.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bd {
+
+void Accumulator::merge(const Accumulator& other) {
+  if (other.m_count == 0) {
+    return;
+  }
+  if (m_count == 0) {
+    *this = other;
+    return;
+  }
+  // pairwise update of Chan, Golub and LeVeque
+  long count = m_count + other.m_count;
+  double delta = other.m_mean - m_mean;
+  m_mean += delta * other.m_count / count;
+  m_m2 += other.m_m2 + delta * delta * m_count * other.m_count / count;
+  m_count = count;
+  m_min = other.m_min < m_min ? other.m_min : m_min;
+  m_max = other.m_max > m_max ? other.m_max : m_max;
+}
+
+double Accumulator::sigma() const { return std::sqrt(variance()); }
+
+Summary summary(const Accumulator& acc) {
+  if (acc.count() == 0) {
+    return {};
+  }
+  return {acc.count(), acc.mean(), acc.sigma(), acc.min(), acc.max()};
+}
+
+void FlockStatistics::record(long tick, const Accumulator& speed,
+                             const Accumulator& neighbors, double delta_t) {
+  ++m_ticks;
+  m_time += delta_t;
+  if (m_capacity == 0) {
+    return;
+  }
+  if (!empty() && tick <= last().tick) {
+    // a flock taken back to an earlier tick: what it recorded from there
+    // on is dropped, so the ticks kept always go up
+    std::rotate(m_series.begin(), m_series.begin() + m_first,
+                m_series.end());
+    m_first = 0;
+    while (!empty() && tick <= last().tick) {
+      m_series.pop_back();
+    }
+  }
+  TickStatistics entry{tick, m_time, summary(speed), summary(neighbors)};
+  if (m_series.size() < m_capacity) {
+    m_series.push_back(entry);
+  } else {
+    m_series[m_first] = entry;
+    m_first = (m_first + 1) % m_capacity;
+  }
+}
+
+const TickStatistics* FlockStatistics::find(long tick) const {
+  if (empty() || tick < (*this)[0].tick || tick > last().tick) {
+    return nullptr;
+  }
+  // the ticks go up, with gaps where the collection was off
+  std::size_t lo = 0;
+  std::size_t hi = size();
+  while (lo < hi) {
+    std::size_t mid = (lo + hi) / 2;
+    if ((*this)[mid].tick < tick) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return (*this)[lo].tick == tick ? &(*this)[lo] : nullptr;
+}
+
+void FlockStatistics::setCapacity(std::size_t capacity) {
+  // oldest first again, then the oldest ones dropped
+  std::rotate(m_series.begin(), m_series.begin() + m_first, m_series.end());
+  m_first = 0;
+  m_capacity = capacity;
+  if (m_series.size() > m_capacity) {
+    m_series.erase(m_series.begin(),
+                   m_series.end() - static_cast<long>(m_capacity));
+  }
+}
+
+void FlockStatistics::clear() {
+  m_series.clear();
+  m_first = 0;
+  m_ticks = 0;
+  m_time = 0.;
+}
+
+}  // namespace bd
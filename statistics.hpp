@@ -0,0 +1,101 @@
+#pragma once
+#ifndef STATISTICS_HPP
+#define STATISTICS_HPP
+
+#include <cstddef>
+#include <vector>
+#include <limits>
+
+namespace bd {
+
+// Count, mean, sigma, min and max of a stream of values in one pass. The
+// mean and the sum of squared deviations are updated with Welford's method,
+// so sigma doesn't suffer from the cancellation of sum(x^2) - N mean^2 when
+// the values are many and close to each other. Accumulators filled on
+// separate threads are combined with merge().
+class Accumulator {
+  long m_count{};
+  double m_mean{};
+  double m_m2{};  // sum of the squared deviations from the mean
+  double m_min{std::numeric_limits<double>::infinity()};
+  double m_max{-std::numeric_limits<double>::infinity()};
+
+ public:
+  void add(double x) {
+    ++m_count;
+    double delta = x - m_mean;
+    m_mean += delta / m_count;
+    m_m2 += delta * (x - m_mean);
+    m_min = x < m_min ? x : m_min;
+    m_max = x > m_max ? x : m_max;
+  }
+  // as if the values of other had been added to this one
+  void merge(const Accumulator& other);
+
+  long count() const { return m_count; }
+  double mean() const { return m_mean; }
+  // sample variance, 0 with less than two values
+  double variance() const { return m_count > 1 ? m_m2 / (m_count - 1) : 0.; }
+  double sigma() const;
+  double min() const { return m_min; }
+  double max() const { return m_max; }
+};
+
+struct Summary {
+  long count{};
+  double mean{};
+  double sigma{};
+  double min{};
+  double max{};
+};
+
+Summary summary(const Accumulator& acc);
+
+// one entry of the time series of FlockStatistics
+struct TickStatistics {
+  long tick{};    // Flock::tick() at the end of the tick, 1 for the first
+  double time{};  // simulated seconds recorded, up to the end of the tick
+  Summary speed;
+  Summary neighbors;  // other boids closer than d
+};
+
+// Time series of the statistics gathered by Flock::updateFlock() during the
+// steering pass. Only the last capacity() ticks are kept, in a ring that
+// the oldest is overwritten in once it is full, so that recording takes no
+// memory from then on; any of them is found in logarithmic time by its
+// tick number, which is the flock's, gaps and all when the collection was
+// off for a while.
+class FlockStatistics {
+  std::vector<TickStatistics> m_series;
+  std::size_t m_first{};  // where the oldest tick kept is
+  std::size_t m_capacity{10000};
+  long m_ticks{};
+  double m_time{};
+
+ public:
+  // tick, as counted by the flock, must be after the last one kept; the
+  // ones kept from tick on are dropped otherwise
+  void record(long tick, const Accumulator& speed,
+              const Accumulator& neighbors, double delta_t);
+
+  // ticks recorded, gaps not counted
+  long ticks() const { return m_ticks; }
+  bool empty() const { return m_series.empty(); }
+  // ticks kept, and the k-th of them from the oldest
+  std::size_t size() const { return m_series.size(); }
+  const TickStatistics& operator[](std::size_t k) const {
+    return m_series[(m_first + k) % m_series.size()];
+  }
+  // the last tick, which must have been recorded
+  const TickStatistics& last() const { return (*this)[size() - 1]; }
+  // nullptr if tick was not recorded or is not kept any more
+  const TickStatistics* find(long tick) const;
+
+  std::size_t capacity() const { return m_capacity; }
+  void setCapacity(std::size_t capacity);
+  void clear();
+};
+
+}  // namespace bd
+
+#endif
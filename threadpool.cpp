@@ -0,0 +1,176 @@
+#include "threadpool.hpp"
+
+#include <chrono>
+#include <stdexcept>
+
+namespace bd {
+
+namespace {
+
+std::uint64_t pack(std::uint32_t lo, std::uint32_t hi) {
+  return std::uint64_t{lo} << 32 | hi;
+}
+std::uint32_t low(std::uint64_t range) { return range >> 32; }
+std::uint32_t high(std::uint64_t range) { return range & 0xffffffffu; }
+
+double seconds(std::chrono::steady_clock::time_point from,
+               std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration<double>(to - from).count();
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(int threads) : m_queues(threads > 0 ? threads : 1) {
+  if (threads < 1) {
+    throw std::runtime_error{"A thread pool needs at least one thread"};
+  }
+  for (int k = 1; k < threads; ++k) {
+    m_workers.emplace_back(&ThreadPool::work, this, k);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_start.notify_all();
+  for (auto& worker : m_workers) {
+    worker.join();
+  }
+}
+
+bool ThreadPool::pop(int k, int& task) {
+  auto& range = m_queues[k].range;
+  std::uint64_t r = range.load();
+  while (low(r) < high(r)) {
+    if (range.compare_exchange_weak(r, pack(low(r) + 1, high(r)))) {
+      task = low(r);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::steal(int k, int& task) {
+  int threads = size();
+  for (int v = 1; v < threads; ++v) {
+    auto& range = m_queues[(k + v) % threads].range;
+    std::uint64_t r = range.load();
+    while (low(r) < high(r)) {
+      std::uint32_t half = (high(r) - low(r) + 1) / 2;
+      std::uint32_t from = high(r) - half;
+      if (range.compare_exchange_weak(r, pack(low(r), from))) {
+        // run the first stolen task, keep the others in the own queue,
+        // which is empty at this point
+        m_queues[k].range.store(pack(from + 1, from + half));
+        task = from;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(int k, int task, bool stolen) {
+  ThreadStats& stats = m_queues[k].stats;
+  int begin = task * m_grain;
+  int end = begin + m_grain < m_n ? begin + m_grain : m_n;
+  auto start = std::chrono::steady_clock::now();
+  try {
+    (*m_task)(begin, end);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_error) {
+      m_error = std::current_exception();
+    }
+  }
+  stats.busy += seconds(start, std::chrono::steady_clock::now());
+  ++stats.tasks;
+  if (stolen) {
+    ++stats.stolen;
+  }
+}
+
+void ThreadPool::drain(int k) {
+  auto start = std::chrono::steady_clock::now();
+  int task;
+  while (true) {
+    if (pop(k, task)) {
+      run(k, task, false);
+    } else if (steal(k, task)) {
+      run(k, task, true);
+    } else {
+      break;
+    }
+  }
+  m_queues[k].stats.wall += seconds(start, std::chrono::steady_clock::now());
+}
+
+void ThreadPool::work(int k) {
+  long seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+      if (m_stop) {
+        return;
+      }
+      seen = m_generation;
+    }
+    drain(k);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      --m_pending;
+    }
+    m_done.notify_one();
+  }
+}
+
+void ThreadPool::parallelFor(int n, int grain, TaskRef task) {
+  if (grain < 1) {
+    throw std::runtime_error{"Tasks must hold at least one index"};
+  }
+  std::lock_guard<std::mutex> run(m_run);
+  long tasks = (n + grain - 1) / grain;
+  int threads = size();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_n = n;
+    m_grain = grain;
+    for (int k = 0; k < threads; ++k) {
+      m_queues[k].range.store(
+          pack(tasks * k / threads, tasks * (k + 1) / threads));
+    }
+    m_pending = m_workers.size();
+    m_error = nullptr;
+    ++m_generation;
+  }
+  m_start.notify_all();
+
+  drain(0);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [&] { return m_pending == 0; });
+  m_task = nullptr;
+  if (m_error) {
+    std::rethrow_exception(m_error);
+  }
+}
+
+std::vector<ThreadStats> ThreadPool::stats() const {
+  std::vector<ThreadStats> result;
+  for (auto const& queue : m_queues) {
+    result.push_back(queue.stats);
+  }
+  return result;
+}
+
+void ThreadPool::resetStats() {
+  for (auto& queue : m_queues) {
+    queue.stats = ThreadStats{};
+  }
+}
+
+}  // namespace bd
@@ -0,0 +1,104 @@
+#pragma once
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace bd {
+
+// what a thread of a ThreadPool did, summed over the runs since the pool was
+// created or the last resetStats()
+struct ThreadStats {
+  long tasks{};   // tasks run by the thread
+  long stolen{};  // of which taken from the queue of another thread
+  double busy{};  // seconds spent running tasks
+  double wall{};  // seconds spent inside parallelFor
+
+  double utilization() const { return wall > 0. ? busy / wall : 0.; }
+};
+
+// What parallelFor() runs: a reference to a callable taking (begin, end).
+// Unlike std::function it never allocates, however much the callable
+// captures, so a tick starts its tasks without touching the heap. The
+// callable must outlive the reference, as it does for the call it is
+// passed to.
+class TaskRef {
+  const void* m_callable;
+  void (*m_call)(const void*, int, int);
+
+ public:
+  template <class F, class = std::enable_if_t<
+                         !std::is_same<std::decay_t<F>, TaskRef>::value>>
+  TaskRef(const F& callable)
+      : m_callable{std::addressof(callable)},
+        m_call{[](const void* f, int begin, int end) {
+          (*static_cast<const F*>(f))(begin, end);
+        }} {}
+
+  void operator()(int begin, int end) const { m_call(m_callable, begin, end); }
+};
+
+// Fixed set of worker threads kept alive between ticks, with work stealing.
+// The calling thread takes part in every run as thread 0, so a pool of size
+// 1 has no workers at all.
+class ThreadPool {
+  // Each thread owns a range of task indices [lo, hi), packed in one atomic
+  // word. The owner takes tasks from lo, idle threads steal the upper half
+  // from hi. Tasks are only ever moved between queues, never created, so a
+  // compare-and-swap on the packed range is all the locking needed.
+  struct alignas(64) Queue {
+    std::atomic<std::uint64_t> range{};
+    ThreadStats stats;
+  };
+
+  std::vector<std::thread> m_workers;
+  std::vector<Queue> m_queues;
+  std::mutex m_run;  // one parallelFor at a time
+  std::mutex m_mutex;
+  std::condition_variable m_start;
+  std::condition_variable m_done;
+  const TaskRef* m_task{};
+  int m_n{};
+  int m_grain{};
+  long m_generation{};
+  int m_pending{};
+  bool m_stop{};
+  std::exception_ptr m_error;
+
+  void work(int k);
+  void drain(int k);
+  bool pop(int k, int& task);
+  bool steal(int k, int& task);
+  void run(int k, int task, bool stolen);
+
+ public:
+  explicit ThreadPool(int threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int size() const { return m_queues.size(); }
+
+  // cuts [0, n) in tasks of grain indices, calls task(begin, end) on each of
+  // them across the threads and returns when all are done. Tasks are handed
+  // out in contiguous blocks, one per thread, and threads that run out of
+  // work steal from the others. The first exception thrown by a task is
+  // rethrown here.
+  void parallelFor(int n, int grain, TaskRef task);
+
+  std::vector<ThreadStats> stats() const;
+  void resetStats();
+};
+
+}  // namespace bd
+
+#endif
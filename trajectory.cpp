@@ -0,0 +1,380 @@
+#include "trajectory.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace bd {
+
+namespace {
+
+constexpr char magic[8]{'B', 'O', 'I', 'D', 'T', 'R', 'A', 'J'};
+// 2: the boundary of the world, its margin and turn
+constexpr std::uint32_t version{2};
+constexpr double int16Max{32767};
+
+// bits of the flags, all 0 in the files of version 1
+constexpr std::uint32_t seedUnknown{1};
+
+// offsets of the header fields
+enum Offset : std::size_t {
+  magicAt = 0,
+  versionAt = 8,
+  encodingAt = 12,
+  nAt = 16,
+  seedAt = 24,
+  widthAt = 32,
+  heightAt = 40,
+  deltaAt = 48,
+  parAt = 56,  // d, ds, s, a, c
+  maxspeedAt = 96,
+  boundaryAt = 104,
+  flagsAt = 108,
+  marginAt = 112,
+  turnAt = 120,
+};
+
+template <class T>
+void put(char* buffer, std::size_t at, T value) {
+  std::memcpy(buffer + at, &value, sizeof value);
+}
+
+template <class T>
+T get(const char* buffer, std::size_t at) {
+  T value;
+  std::memcpy(&value, buffer + at, sizeof value);
+  return value;
+}
+
+std::size_t valueSize(Encoding encoding) {
+  switch (encoding) {
+    case Encoding::float64:
+      return 8;
+    case Encoding::float32:
+      return 4;
+    case Encoding::int16:
+      return 2;
+  }
+  throw std::runtime_error{"Unknown trajectory encoding"};
+}
+
+// units of the four arrays of a frame, see Encoding
+struct Scales {
+  double x{1};
+  double y{1};
+  double v{1};
+};
+
+Scales scales(const TrajectoryHeader& header) {
+  if (header.encoding != Encoding::int16) {
+    return {};
+  }
+  return {header.world.width / int16Max, header.world.height / int16Max,
+          header.maxspeed / int16Max};
+}
+
+template <class T>
+void encode(const std::vector<T>& values, double scale, Encoding encoding,
+            char* out) {
+  int n = values.size();
+  switch (encoding) {
+    case Encoding::float64:
+      for (int i = 0; i < n; ++i) {
+        put(out, 8 * i, static_cast<double>(values[i]));
+      }
+      return;
+    case Encoding::float32:
+      for (int i = 0; i < n; ++i) {
+        put(out, 4 * i, static_cast<float>(values[i]));
+      }
+      return;
+    case Encoding::int16:
+      for (int i = 0; i < n; ++i) {
+        double q = std::round(values[i] / scale);
+        put(out, 2 * i,
+            static_cast<std::int16_t>(std::clamp(q, -int16Max, int16Max)));
+      }
+      return;
+  }
+}
+
+void decode(const char* in, double scale, Encoding encoding,
+            std::vector<double>& values) {
+  int n = values.size();
+  switch (encoding) {
+    case Encoding::float64:
+      std::memcpy(values.data(), in, n * sizeof(double));
+      return;
+    case Encoding::float32:
+      for (int i = 0; i < n; ++i) {
+        values[i] = get<float>(in, 4 * i);
+      }
+      return;
+    case Encoding::int16:
+      for (int i = 0; i < n; ++i) {
+        values[i] = get<std::int16_t>(in, 2 * i) * scale;
+      }
+      return;
+  }
+}
+
+}  // namespace
+
+const char* encodingName(Encoding encoding) {
+  switch (encoding) {
+    case Encoding::float64:
+      return "float64";
+    case Encoding::float32:
+      return "float32";
+    case Encoding::int16:
+      return "int16";
+  }
+  return "unknown";
+}
+
+Encoding encodingFromName(const std::string& name) {
+  for (Encoding e : {Encoding::float64, Encoding::float32, Encoding::int16}) {
+    if (name == encodingName(e)) {
+      return e;
+    }
+  }
+  throw std::runtime_error{"Unknown trajectory encoding " + name};
+}
+
+std::size_t frameSize(const TrajectoryHeader& header) {
+  return sizeof(std::uint64_t) + 4 * header.n * valueSize(header.encoding);
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string& path,
+                                   const TrajectoryHeader& header)
+    : m_header{header}, m_file{nullptr} {
+  if (header.encoding == Encoding::int16 &&
+      (header.world.width <= 0. || header.world.height <= 0. ||
+       header.maxspeed <= 0.)) {
+    throw std::runtime_error{
+        "int16 trajectories need a world size and a maxspeed"};
+  }
+  char buffer[trajectoryHeaderSize]{};
+  std::memcpy(buffer + magicAt, magic, sizeof magic);
+  put(buffer, versionAt, version);
+  put(buffer, encodingAt, static_cast<std::uint32_t>(header.encoding));
+  put(buffer, nAt, header.n);
+  put(buffer, seedAt, header.seed);
+  put(buffer, widthAt, header.world.width);
+  put(buffer, heightAt, header.world.height);
+  put(buffer, deltaAt, header.delta_t);
+  const Parameters& par = header.par;
+  int k = 0;
+  for (double p : {par.d, par.ds, par.s, par.a, par.c}) {
+    put(buffer, parAt + 8 * k++, p);
+  }
+  put(buffer, maxspeedAt, header.maxspeed);
+  put(buffer, boundaryAt, static_cast<std::uint32_t>(header.world.boundary));
+  put(buffer, flagsAt, header.seedKnown ? 0u : seedUnknown);
+  put(buffer, marginAt, header.world.margin);
+  put(buffer, turnAt, header.world.turn);
+
+  m_file = std::fopen(path.c_str(), "wb");
+  if (!m_file) {
+    throw std::runtime_error{"Cannot write " + path};
+  }
+  if (std::fwrite(buffer, 1, sizeof buffer, m_file) != sizeof buffer) {
+    std::fclose(m_file);
+    throw std::runtime_error{"Cannot write " + path};
+  }
+  m_thread = std::thread(&TrajectoryWriter::run, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+  try {
+    close();
+  } catch (...) {
+    // nobody left to tell
+  }
+}
+
+void TrajectoryWriter::rethrow() {
+  if (m_error) {
+    std::exception_ptr error = m_error;
+    m_error = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+template <class T>
+void TrajectoryWriter::write(long tick, const BasicBoidArrays<T>& boids) {
+  if (boids.size() != static_cast<int>(m_header.n)) {
+    throw std::runtime_error{"The flock does not match the trajectory"};
+  }
+  if (!m_file) {
+    throw std::runtime_error{"The trajectory is closed"};
+  }
+
+  std::vector<char> frame;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_written.wait(lock,
+                   [&] { return m_queue.size() < maxQueued || m_error; });
+    rethrow();
+    if (!m_free.empty()) {
+      frame = std::move(m_free.back());
+      m_free.pop_back();
+    }
+  }
+
+  frame.resize(frameSize(m_header));
+  put(frame.data(), 0, static_cast<std::uint64_t>(tick));
+  Scales s = scales(m_header);
+  std::size_t bytes = m_header.n * valueSize(m_header.encoding);
+  char* out = frame.data() + sizeof(std::uint64_t);
+  encode(boids.x, s.x, m_header.encoding, out);
+  encode(boids.y, s.y, m_header.encoding, out + bytes);
+  encode(boids.vx, s.v, m_header.encoding, out + 2 * bytes);
+  encode(boids.vy, s.v, m_header.encoding, out + 3 * bytes);
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(std::move(frame));
+  }
+  m_queued.notify_one();
+  ++m_frames;
+}
+
+template void TrajectoryWriter::write(long, const BoidArrays&);
+template void TrajectoryWriter::write(long, const BoidArraysF&);
+
+void TrajectoryWriter::run() {
+  while (true) {
+    std::vector<char> frame;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_queued.wait(lock, [&] { return m_closing || !m_queue.empty(); });
+      if (m_queue.empty()) {
+        return;  // closing, and all written
+      }
+      frame = std::move(m_queue.front());
+      m_queue.pop_front();
+    }
+
+    bool written =
+        std::fwrite(frame.data(), 1, frame.size(), m_file) == frame.size();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!written && !m_error) {
+        m_error = std::make_exception_ptr(
+            std::runtime_error{"Cannot write the trajectory"});
+        m_queue.clear();
+      }
+      m_free.push_back(std::move(frame));
+    }
+    m_written.notify_one();
+  }
+}
+
+void TrajectoryWriter::close() {
+  if (!m_file) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closing = true;
+  }
+  m_queued.notify_one();
+  m_thread.join();
+  bool closed = std::fclose(m_file) == 0;
+  m_file = nullptr;
+  rethrow();
+  if (!closed) {
+    throw std::runtime_error{"Cannot write the trajectory"};
+  }
+}
+
+TrajectoryReader::TrajectoryReader(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error{"Cannot open " + path};
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0 ||
+      static_cast<std::size_t>(info.st_size) < trajectoryHeaderSize) {
+    ::close(fd);
+    throw std::runtime_error{path + " is not a trajectory"};
+  }
+  m_size = info.st_size;
+  void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);  // the mapping stays valid
+  if (data == MAP_FAILED) {
+    throw std::runtime_error{"Cannot map " + path};
+  }
+  m_data = static_cast<const char*>(data);
+
+  std::uint32_t fileVersion = get<std::uint32_t>(m_data, versionAt);
+  if (std::memcmp(m_data + magicAt, magic, sizeof magic) != 0 ||
+      fileVersion < 1 || fileVersion > version ||
+      get<std::uint32_t>(m_data, encodingAt) > 2 ||
+      (fileVersion >= 2 && get<std::uint32_t>(m_data, boundaryAt) > 2)) {
+    ::munmap(const_cast<char*>(m_data), m_size);
+    throw std::runtime_error{path + " is not a trajectory"};
+  }
+  m_header.encoding = static_cast<Encoding>(get<std::uint32_t>(m_data, encodingAt));
+  m_header.n = get<std::uint32_t>(m_data, nAt);
+  m_header.seed = get<std::uint64_t>(m_data, seedAt);
+  m_header.seedKnown =
+      fileVersion < 2 || !(get<std::uint32_t>(m_data, flagsAt) & seedUnknown);
+  m_header.world.width = get<double>(m_data, widthAt);
+  m_header.world.height = get<double>(m_data, heightAt);
+  if (fileVersion >= 2) {
+    m_header.world.boundary =
+        static_cast<Boundary>(get<std::uint32_t>(m_data, boundaryAt));
+    m_header.world.margin = get<double>(m_data, marginAt);
+    m_header.world.turn = get<double>(m_data, turnAt);
+  } else {
+    // version 1 was written before the world had a boundary: periodic
+    m_header.world.boundary = Boundary::periodic;
+  }
+  m_header.delta_t = get<double>(m_data, deltaAt);
+  m_header.par = {get<double>(m_data, parAt), get<double>(m_data, parAt + 8),
+                  get<double>(m_data, parAt + 16),
+                  get<double>(m_data, parAt + 24),
+                  get<double>(m_data, parAt + 32)};
+  m_header.maxspeed = get<double>(m_data, maxspeedAt);
+
+  m_frameSize = frameSize(m_header);
+  m_frames = (m_size - trajectoryHeaderSize) / m_frameSize;
+}
+
+TrajectoryReader::~TrajectoryReader() {
+  ::munmap(const_cast<char*>(m_data), m_size);
+}
+
+long TrajectoryReader::tick(long frame) const {
+  if (frame < 0 || frame >= m_frames) {
+    throw std::runtime_error{"No such frame in the trajectory"};
+  }
+  return get<std::uint64_t>(
+      m_data, trajectoryHeaderSize + frame * m_frameSize);
+}
+
+void TrajectoryReader::read(long frame, BoidArrays& boids) const {
+  if (frame < 0 || frame >= m_frames) {
+    throw std::runtime_error{"No such frame in the trajectory"};
+  }
+  const char* in = m_data + trajectoryHeaderSize + frame * m_frameSize +
+                   sizeof(std::uint64_t);
+  boids.resize(m_header.n);
+  Scales s = scales(m_header);
+  std::size_t bytes = m_header.n * valueSize(m_header.encoding);
+  decode(in, s.x, m_header.encoding, boids.x);
+  decode(in + bytes, s.y, m_header.encoding, boids.y);
+  decode(in + 2 * bytes, s.v, m_header.encoding, boids.vx);
+  decode(in + 3 * bytes, s.v, m_header.encoding, boids.vy);
+}
+
+}  // namespace bd
@@ -0,0 +1,117 @@
+#pragma once
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boid.hpp"
+
+namespace bd {
+
+// Binary trajectory file: a header of headerSize bytes, then one frame per
+// recorded tick, all of the same size. A frame is the tick number as a
+// 64 bit integer followed by the arrays x, y, vx and vy of all the boids,
+// each stored as
+//   float64: as they are;
+//   float32: rounded to float;
+//   int16:   positions in units of world size / 32767, velocities in units
+//            of maxspeed / 32767, rounded to the nearest integer.
+// Numbers are in the byte order of the machine that wrote the file.
+enum class Encoding : std::uint32_t { float64, float32, int16 };
+
+const char* encodingName(Encoding encoding);
+Encoding encodingFromName(const std::string& name);
+
+struct TrajectoryHeader {
+  Encoding encoding{Encoding::float64};
+  std::uint32_t n{};  // boids in every frame
+  std::uint64_t seed{};
+  bool seedKnown{true};  // false for a run resumed from a checkpoint
+  World world;        // size, boundary, margin and turn
+  double delta_t{};   // time step of a tick
+  Parameters par;     // parameters the flock was run with
+  double maxspeed{};  // bounds the velocities, scale of the int16 ones
+};
+
+constexpr std::size_t trajectoryHeaderSize{128};
+
+// bytes of a frame of the header's size and encoding
+std::size_t frameSize(const TrajectoryHeader& header);
+
+// Appends frames to a trajectory file. write() converts a frame to the
+// encoding of the file and queues it; a thread of its own does the writing,
+// so the simulation only waits when maxQueued frames are still pending.
+class TrajectoryWriter {
+  TrajectoryHeader m_header;
+  std::FILE* m_file;
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_queued;
+  std::condition_variable m_written;
+  std::deque<std::vector<char>> m_queue;
+  std::vector<std::vector<char>> m_free;  // buffers to reuse
+  bool m_closing{false};
+  std::exception_ptr m_error;
+  long m_frames{};
+
+  void run();
+  void rethrow();
+
+ public:
+  static constexpr std::size_t maxQueued{8};
+
+  TrajectoryWriter(const std::string& path, const TrajectoryHeader& header);
+  ~TrajectoryWriter();
+
+  TrajectoryWriter(const TrajectoryWriter&) = delete;
+  TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+  const TrajectoryHeader& header() const { return m_header; }
+  // frames passed to write() so far
+  long frames() const { return m_frames; }
+
+  // boids must hold header().n boids, in double or float
+  template <class T>
+  void write(long tick, const BasicBoidArrays<T>& boids);
+  // writes what is queued and closes the file; errors of the writing
+  // thread are rethrown here or by the next write()
+  void close();
+};
+
+// Reads a trajectory file through a read-only memory map, so any frame is
+// found in constant time and only the pages actually read are loaded.
+class TrajectoryReader {
+  TrajectoryHeader m_header;
+  const char* m_data{};
+  std::size_t m_size{};
+  std::size_t m_frameSize{};
+  long m_frames{};
+
+ public:
+  explicit TrajectoryReader(const std::string& path);
+  ~TrajectoryReader();
+
+  TrajectoryReader(const TrajectoryReader&) = delete;
+  TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+  const TrajectoryHeader& header() const { return m_header; }
+  // complete frames in the file; a frame cut short by a crash is ignored
+  long frames() const { return m_frames; }
+
+  long tick(long frame) const;
+  // decodes frame into boids
+  void read(long frame, BoidArrays& boids) const;
+};
+
+}  // namespace bd
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+#ifndef TRIPLEBUFFER_HPP
+#define TRIPLEBUFFER_HPP
+
+#include <array>
+#include <atomic>
+
+namespace bd {
+
+// Hands the latest value from one writer thread to one reader thread without
+// locks and without either side ever waiting. The writer fills back() and
+// publishes it; the reader calls update() and reads front(). The third slot
+// sits in the middle: publish() swaps it with the back one, update() with
+// the front one, so the two threads never touch the same slot. Values
+// published while the reader doesn't look are dropped, only the last one
+// is kept.
+template <class T>
+class TripleBuffer {
+  static constexpr int fresh{4};  // set in m_middle by publish()
+
+  std::array<T, 3> m_slots{};
+  alignas(64) std::atomic<int> m_middle{1};
+  alignas(64) int m_back{0};   // writer only
+  alignas(64) int m_front{2};  // reader only
+
+ public:
+  // writer
+  T& back() { return m_slots[m_back]; }
+  void publish() {
+    m_back = m_middle.exchange(m_back | fresh, std::memory_order_acq_rel) &
+             ~fresh;
+  }
+
+  // reader: takes the last published value, if there is a new one
+  bool update() {
+    if (!(m_middle.load(std::memory_order_relaxed) & fresh)) {
+      return false;
+    }
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & ~fresh;
+    return true;
+  }
+  const T& front() const { return m_slots[m_front]; }
+};
+
+}  // namespace bd
+
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+#ifndef VEC2_HPP
+#define VEC2_HPP
+
+namespace bd {
+
+// Two component vector used by the whole simulation, with the same layout and
+// operators as sf::Vector2, so the core doesn't depend on SFML. Conversions
+// to SFML types live in sfml.hpp, next to the renderer.
+template <class T>
+struct Vec2 {
+  T x{};
+  T y{};
+
+  constexpr Vec2() = default;
+  constexpr Vec2(T newX, T newY) : x{newX}, y{newY} {}
+
+  // explicit, like sf::Vector2, since it can lose precision
+  template <class U>
+  constexpr explicit Vec2(const Vec2<U>& v)
+      : x{static_cast<T>(v.x)}, y{static_cast<T>(v.y)} {}
+
+  constexpr Vec2& operator+=(const Vec2& v) {
+    x += v.x;
+    y += v.y;
+    return *this;
+  }
+  constexpr Vec2& operator-=(const Vec2& v) {
+    x -= v.x;
+    y -= v.y;
+    return *this;
+  }
+  constexpr Vec2& operator*=(T k) {
+    x *= k;
+    y *= k;
+    return *this;
+  }
+  constexpr Vec2& operator/=(T k) {
+    x /= k;
+    y /= k;
+    return *this;
+  }
+};
+
+template <class T>
+constexpr Vec2<T> operator-(const Vec2<T>& v) {
+  return {-v.x, -v.y};
+}
+
+template <class T>
+constexpr Vec2<T> operator+(const Vec2<T>& v1, const Vec2<T>& v2) {
+  return {v1.x + v2.x, v1.y + v2.y};
+}
+
+template <class T>
+constexpr Vec2<T> operator-(const Vec2<T>& v1, const Vec2<T>& v2) {
+  return {v1.x - v2.x, v1.y - v2.y};
+}
+
+template <class T>
+constexpr Vec2<T> operator*(const Vec2<T>& v, T k) {
+  return {v.x * k, v.y * k};
+}
+
+template <class T>
+constexpr Vec2<T> operator*(T k, const Vec2<T>& v) {
+  return {k * v.x, k * v.y};
+}
+
+template <class T>
+constexpr Vec2<T> operator/(const Vec2<T>& v, T k) {
+  return {v.x / k, v.y / k};
+}
+
+template <class T>
+constexpr bool operator==(const Vec2<T>& v1, const Vec2<T>& v2) {
+  return v1.x == v2.x && v1.y == v2.y;
+}
+
+template <class T>
+constexpr bool operator!=(const Vec2<T>& v1, const Vec2<T>& v2) {
+  return !(v1 == v2);
+}
+
+template <class T>
+constexpr T dot(const Vec2<T>& v1, const Vec2<T>& v2) {
+  return v1.x * v2.x + v1.y * v2.y;
+}
+
+}  // namespace bd
+
+#endif
@@ -0,0 +1,137 @@
+#include "verlet.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace bd {
+
+namespace {
+
+// the nearest image of the displacement d on a side of the given size
+double wrap(double d, double size) {
+  d -= d > size / 2 ? size : 0.;
+  d += d < -size / 2 ? size : 0.;
+  return d;
+}
+
+}  // namespace
+
+template <class T>
+void BasicVerletLists<T>::setSkin(double skin) {
+  if (!(skin >= 0.)) {
+    throw std::runtime_error{"The skin must be positive"};
+  }
+  m_skin = skin;
+  m_built = false;
+}
+
+template <class T>
+bool BasicVerletLists<T>::stale(const BasicBoidArrays<T>& boids,
+                                const std::vector<std::uint16_t>& group,
+                                const std::vector<Parameters>& par,
+                                int layers, const World& world,
+                                double slack) const {
+  if (!m_built || boids.size() != static_cast<int>(m_x.size()) ||
+      layers != m_layers || group != m_group || par.size() != m_d.size() ||
+      world.width != m_world.width || world.height != m_world.height ||
+      world.boundary != m_world.boundary) {
+    return true;
+  }
+  for (std::size_t g = 0; g < par.size(); ++g) {
+    if (par[g].d != m_d[g]) {
+      return true;
+    }
+  }
+  double reach = m_skin / 2 - slack;
+  if (reach <= 0.) {
+    return true;
+  }
+
+  // the largest move, over all the boids
+  bool periodic = world.boundary == Boundary::periodic;
+  int N = boids.size();
+  double moved2 = 0.;
+  for (int i = 0; i < N; ++i) {
+    double dX = boids.x[i] - m_x[i];
+    double dY = boids.y[i] - m_y[i];
+    if (periodic) {
+      dX = wrap(dX, world.width);
+      dY = wrap(dY, world.height);
+    }
+    moved2 = std::max(moved2, dX * dX + dY * dY);
+  }
+  return moved2 > reach * reach;
+}
+
+template <class T>
+void BasicVerletLists<T>::build(const BasicGrid<T>& grid,
+                                const BasicBoidArrays<T>& boids,
+                                const std::vector<std::uint16_t>& group,
+                                const std::vector<Parameters>& par,
+                                const World& world) {
+  int N = boids.size();
+  m_start.resize(N + 1);
+  m_runs.clear();
+  for (int i = 0; i < N; ++i) {
+    m_start[i] = m_runs.size();
+    double reach = par[group[i]].d + m_skin;
+    for (int layer = 0; layer < grid.layers(); ++layer) {
+      grid.within(boids.x[i], boids.y[i], reach, layer, m_runs);
+    }
+  }
+  m_start[N] = m_runs.size();
+  m_candidates = 0;
+  for (const Span& run : m_runs) {
+    m_candidates += run.end - run.begin;
+  }
+
+  m_x = boids.x;
+  m_y = boids.y;
+  m_group = group;
+  m_d.resize(par.size());
+  for (std::size_t g = 0; g < par.size(); ++g) {
+    m_d[g] = par[g].d;
+  }
+  m_layers = grid.layers();
+  m_world = world;
+  m_built = true;
+  ++m_builds;
+}
+
+template <class T>
+double BasicVerletLists<T>::buildRate() const {
+  return m_ticks > 0 ? double(m_builds) / m_ticks : 0.;
+}
+
+template <class T>
+double BasicVerletLists<T>::candidatesPerBoid() const {
+  return m_x.empty() ? 0. : double(m_candidates) / m_x.size();
+}
+
+template <class T>
+double BasicVerletLists<T>::runsPerBoid() const {
+  return m_x.empty() ? 0. : double(m_runs.size()) / m_x.size();
+}
+
+template <class T>
+double BasicVerletLists<T>::bytesPerBoid() const {
+  if (m_x.empty()) {
+    return 0.;
+  }
+  std::size_t bytes = m_start.capacity() * sizeof(int) +
+                      m_runs.capacity() * sizeof(Span) +
+                      (m_x.capacity() + m_y.capacity()) * sizeof(T) +
+                      m_group.capacity() * sizeof(std::uint16_t);
+  return double(bytes) / m_x.size();
+}
+
+template <class T>
+void BasicVerletLists<T>::resetStatistics() {
+  m_ticks = 0;
+  m_builds = 0;
+}
+
+template class BasicVerletLists<double>;
+template class BasicVerletLists<float>;
+
+}  // namespace bd
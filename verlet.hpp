@@ -0,0 +1,103 @@
+#pragma once
+#ifndef VERLET_HPP
+#define VERLET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "boid.hpp"
+#include "grid.hpp"
+
+namespace bd {
+
+// Verlet neighbor lists: for every boid, the boids that were closer than its
+// d plus a skin when the lists were built, itself included. As long as no
+// boid has moved more than skin / 2 since then, no pair has come closer
+// than d without being in the lists, so the search through the grid is done
+// once every few ticks instead of every tick.
+// The lists are ranges of the sorted() arrays of a grid with cells
+// cellsPerReach times smaller than d + skin, one per row of cells within
+// d + skin of the boid: a few ranges cover little more than the circle,
+// where the 3x3 block of cells as large as d is almost three times as
+// large. The grid keeps sorted() in step with the boids between builds, see
+// BasicGrid::refresh(), so the kernel reads the ranges in place. A range
+// never spans two layers, so it holds boids of one group when built with
+// the groups as layers.
+template <class T>
+class BasicVerletLists {
+  double m_skin{};
+  std::vector<int> m_start;  // of the runs of each boid, and the end
+  std::vector<typename BasicGrid<T>::Span> m_runs;
+  long m_candidates{};  // boids in the runs
+  // what the lists were built from: a change in any calls for a new build
+  std::vector<T> m_x;
+  std::vector<T> m_y;
+  std::vector<std::uint16_t> m_group;
+  std::vector<double> m_d;  // per group
+  int m_layers{};
+  World m_world;
+  bool m_built{false};
+  long m_ticks{};
+  long m_builds{};
+
+ public:
+  using Span = typename BasicGrid<T>::Span;
+  static constexpr int cellsPerReach{4};
+
+  // with skin 0 the lists are off
+  double skin() const { return m_skin; }
+  void setSkin(double skin);
+
+  // whether the lists no longer hold every pair closer than d: some boid
+  // moved more than skin / 2 - slack since the build, the slack being how
+  // far one may still move before its neighbors are searched (in place, a
+  // step), or the boids, groups, their d or the world changed
+  bool stale(const BasicBoidArrays<T>& boids,
+             const std::vector<std::uint16_t>& group,
+             const std::vector<Parameters>& par, int layers,
+             const World& world, double slack) const;
+  // from grid, built over boids with cells of (d + skin) / cellsPerReach
+  void build(const BasicGrid<T>& grid, const BasicBoidArrays<T>& boids,
+             const std::vector<std::uint16_t>& group,
+             const std::vector<Parameters>& par, const World& world);
+  // the next stale() is true, e.g. once the boids moved in memory
+  void invalidate() { m_built = false; }
+  // what the lists were last built from, see stale(): the positions and
+  // groups of the boids, the d of every group and the layers of the grid
+  bool built() const { return m_built; }
+  const std::vector<T>& builtX() const { return m_x; }
+  const std::vector<T>& builtY() const { return m_y; }
+  const std::vector<std::uint16_t>& builtGroup() const { return m_group; }
+  const std::vector<double>& builtD() const { return m_d; }
+  int builtLayers() const { return m_layers; }
+  // counts a tick run with the lists, for buildRate()
+  void use() { ++m_ticks; }
+
+  // the candidates of boid i are the runs runs()[start(i)] ...
+  // runs()[start(i + 1) - 1] of slots of the grid
+  int start(int i) const { return m_start[i]; }
+  const std::vector<Span>& runs() const { return m_runs; }
+
+  // ticks run with the lists, and the builds among them
+  long ticks() const { return m_ticks; }
+  long builds() const { return m_builds; }
+  // builds per tick, 1 when the lists are of no use
+  double buildRate() const;
+  // boids in the runs, and runs, of a boid on average
+  double candidatesPerBoid() const;
+  double runsPerBoid() const;
+  // memory the lists take, per boid
+  double bytesPerBoid() const;
+  void resetStatistics();
+};
+
+using VerletLists = BasicVerletLists<double>;
+using VerletListsF = BasicVerletLists<float>;
+
+extern template class BasicVerletLists<double>;
+extern template class BasicVerletLists<float>;
+
+}  // namespace bd
+
+#endif